@@ -0,0 +1,44 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+/*
+* The size of a block is kept in front of it. The replacements are in their own file: compiled into the files that
+* allocate, GCC would see the offset pointers handed to free and warn about mismatched allocations
+*/
+static std::atomic<unsigned long long> allocations{ 0 };
+static std::atomic<long long> bytesInUse{ 0 };
+static const std::size_t BLOCK_HEADER = alignof(std::max_align_t);
+
+unsigned long long allocationCount() {
+	return allocations;
+}
+
+long long heapBytes() {
+	return bytesInUse;
+}
+
+void* operator new(std::size_t size) {
+	allocations++;
+	if (char* p = static_cast<char*>(std::malloc(size + BLOCK_HEADER))) {
+		*reinterpret_cast<std::size_t*>(p) = size;
+		bytesInUse += size;
+		return p + BLOCK_HEADER;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	if (p == nullptr)
+		return;
+	char* block = static_cast<char*>(p) - BLOCK_HEADER;
+	bytesInUse -= *reinterpret_cast<std::size_t*>(block);
+	std::free(block);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	operator delete(p);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+/*
+* The bench replaces the global operator new and delete (in AllocationCounter.cpp), so every heap allocation of the
+* process is counted and the bytes in use can be measured around a piece of code.
+*/
+
+/* number of calls to operator new so far */
+unsigned long long allocationCount();
+
+/* bytes allocated with operator new and not deleted yet */
+long long heapBytes();
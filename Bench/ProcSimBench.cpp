@@ -0,0 +1,728 @@
+/*
+* Benchmarks for the headless generation code. Usage:
+*
+*   ProcSimBench [segments] [repetitions]
+*
+* Every run uses the same heatmap and random seed, so the numbers of different builds can be compared.
+* The generation code logs to stderr, redirect it to keep the output readable.
+*/
+
+#include "ProcSim/MapGen/MapGen.h"
+#include "ProcSim/MapGen/GenerationCheckpoint.h"
+#include "ProcSim/BlocksGen/Parcel.h"
+#include "AllocationCounter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace {
+
+	const unsigned int SEED = 7;
+	const int HEATMAP_SIZE = 400;
+	const int TILES_PER_SIDE = 4;
+	/* side of the random heatmaps rendered by benchHeatmap */
+	const int SYNTHESIS_SIZE = 2048;
+
+	typedef std::chrono::steady_clock Clock;
+
+	double secondsSince(Clock::time_point start) {
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	/* simplex noise zoomed in by scale, the smaller it is the noisier the heatmap (like Heatmap's completelyRandom) */
+	HeatmapView makeHeatmap(float scale = 60.0f) {
+		unsigned char* pixels = new unsigned char[HEATMAP_SIZE * HEATMAP_SIZE];
+		for (int y = 0; y < HEATMAP_SIZE; y++) {
+			for (int x = 0; x < HEATMAP_SIZE; x++) {
+				double value = (SimplexNoise::noise(x / scale, y / scale) + 1) / 2.0;
+				pixels[y * HEATMAP_SIZE + x] = static_cast<unsigned char>(255 * value * value);
+			}
+		}
+		std::shared_ptr<const unsigned char> image(pixels, std::default_delete<unsigned char[]>());
+		return Heatmap(image, HEATMAP_SIZE, HEATMAP_SIZE).view();
+	}
+
+	/* everything one generation needs, the same members ARoadGenerator has */
+	struct Generation {
+		GenerationContext context;
+		PriorityQueue<Segment*>* priorityQ = nullptr;
+		SpatialIndex<Segment*>* qTree = nullptr;
+		SegmentStore segments;
+		std::vector<Intersection*> intersections;
+		DebugData debugData;
+		size_t steps = 0;
+		/* stop after this many segments, the limit of the config at first */
+		size_t segmentLimit = 0;
+
+		Generation(const GeneratorConfig& config, PriorityQueueType queueType) : context(config), segmentLimit(config.segmentCountLimit) {
+			priorityQ = makePriorityQueue<Segment*>(queueType, [](const Segment* s) { return s->t; });
+			for (auto segment : makeInitialSegments(context))
+				priorityQ->enqueue(segment);
+
+			qTree = makeSpatialIndex<Segment*>(Bounds{ config.minx, config.miny, config.maxx - config.minx, config.maxy - config.miny });
+		}
+
+		~Generation() {
+			delete priorityQ;
+			delete qTree;
+			segments.clear();
+		}
+
+		bool step(const HeatmapView& heatmap) {
+			if (priorityQ->empty() || segments.size() >= segmentLimit)
+				return false;
+			generationStep(*priorityQ, segments, *qTree, debugData, intersections, heatmap, context);
+			steps++;
+			return true;
+		}
+
+		void run(const HeatmapView& heatmap) {
+			while (step(heatmap)) {}
+		}
+	};
+
+	const char* queueName(PriorityQueueType type) {
+		switch (type) {
+		case PriorityQueueType::Linear: return "linear";
+		case PriorityQueueType::BinaryHeap: return "binary heap";
+		case PriorityQueueType::Bucket: return "bucket";
+		}
+		return "?";
+	}
+
+	/* generation loop with each priority queue implementation */
+	void benchPriorityQueues(const GeneratorConfig& config, const HeatmapView& heatmap, int repetitions) {
+		std::printf("\n== priority queue: generation loop ==\n");
+
+		const PriorityQueueType types[] = { PriorityQueueType::Linear, PriorityQueueType::BinaryHeap, PriorityQueueType::Bucket };
+		for (PriorityQueueType type : types) {
+			double best = 1e30;
+			size_t segments = 0;
+			size_t steps = 0;
+			for (int r = 0; r < repetitions; r++) {
+				Generation generation(config, type);
+				Clock::time_point start = Clock::now();
+				generation.run(heatmap);
+				best = std::min(best, secondsSince(start));
+				segments = generation.segments.size();
+				steps = generation.steps;
+			}
+			std::printf("%-12s %8.2f ms  (%zu segments, %.0f steps/s)\n", queueName(type), best * 1000, segments, steps / best);
+		}
+	}
+
+	/* tiled generation with 1 to N threads. The network is the same for every thread count, only the time changes */
+	void benchTiled(const GeneratorConfig& config, const HeatmapView& heatmap, int repetitions) {
+		std::printf("\n== tiled generation: %dx%d tiles ==\n", TILES_PER_SIDE, TILES_PER_SIDE);
+
+		const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+		std::vector<int> threadCounts;
+		for (int threads = 1; threads < cores; threads *= 2)
+			threadCounts.push_back(threads);
+		threadCounts.push_back(cores);
+
+		double singleThreaded = 0;
+		for (int threads : threadCounts) {
+			double best = 1e30;
+			size_t segmentCount = 0;
+			for (int r = 0; r < repetitions; r++) {
+				GenerationContext context(config);
+				std::unique_ptr<SpatialIndex<Segment*>> qTree(
+					makeSpatialIndex<Segment*>(Bounds{ config.minx, config.miny, config.maxx - config.minx, config.maxy - config.miny }));
+				SegmentStore segments;
+				DebugData debugData;
+				std::vector<Intersection*> intersections;
+
+				Clock::time_point start = Clock::now();
+				generateTiled(segments, *qTree, debugData, intersections, heatmap, context, TILES_PER_SIDE, TILES_PER_SIDE, threads);
+				best = std::min(best, secondsSince(start));
+				segmentCount = segments.size();
+			}
+			if (threads == 1)
+				singleThreaded = best;
+			std::printf("%2d threads %10.2f ms  speedup %5.2fx  (%zu segments)\n", threads, best * 1000,
+				singleThreaded / best, segmentCount);
+		}
+	}
+
+	/* conflict removal with 1 to N threads on the same network. The removed segments are the same for every thread count */
+	void benchConflicts(const GeneratorConfig& config, const HeatmapView& heatmap, int repetitions) {
+		Generation generation(config, Config::PRIORITY_QUEUE_TYPE);
+		generation.run(heatmap);
+		const std::vector<Segment*> network = generation.segments.pointers();
+
+		std::printf("\n== conflict removal: %zu segments ==\n", network.size());
+
+		const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+		std::vector<int> threadCounts;
+		for (int threads = 1; threads < cores; threads *= 2)
+			threadCounts.push_back(threads);
+		threadCounts.push_back(cores);
+
+		double singleThreaded = 0;
+		for (int threads : threadCounts) {
+			double best = 1e30;
+			size_t remaining = 0;
+			for (int r = 0; r < repetitions; r++) {
+				// a fresh store of the same segments every time, it gives them the same handles again
+				std::unique_ptr<SpatialIndex<Segment*>> qTree(
+					makeSpatialIndex<Segment*>(Bounds{ config.minx, config.miny, config.maxx - config.minx, config.maxy - config.miny }));
+				SegmentStore segments;
+				for (auto segment : network)
+					segments.add(segment, *qTree);
+
+				Clock::time_point start = Clock::now();
+				removeConflictingSegments(segments, *qTree, threads);
+				best = std::min(best, secondsSince(start));
+				remaining = segments.size();
+			}
+			if (threads == 1)
+				singleThreaded = best;
+			std::printf("%2d threads %10.2f ms  speedup %5.2fx  (%zu removed)\n", threads, best * 1000,
+				singleThreaded / best, network.size() - remaining);
+		}
+	}
+
+	/* stopping halfway, saving, loading and continuing has to give the same network as generating it at once */
+	void benchCheckpoint(const GeneratorConfig& config, const HeatmapView& heatmap, int repetitions) {
+		std::printf("\n== checkpoint: stop at half, save, load, continue ==\n");
+
+		GeneratorConfig half = config;
+		half.segmentCountLimit = config.segmentCountLimit / 2;
+
+		double bestFull = 1e30, bestSave = 1e30, bestLoad = 1e30, bestContinue = 1e30;
+		size_t bytes = 0;
+		bool identical = true;
+		for (int r = 0; r < repetitions; r++) {
+			Generation full(config, Config::PRIORITY_QUEUE_TYPE);
+			Clock::time_point start = Clock::now();
+			full.run(heatmap);
+			bestFull = std::min(bestFull, secondsSince(start));
+
+			Generation first(half, Config::PRIORITY_QUEUE_TYPE);
+			first.run(heatmap);
+
+			std::stringstream checkpoint;
+			start = Clock::now();
+			saveGenerationCheckpoint(checkpoint, *first.priorityQ, first.segments, *first.qTree, first.context);
+			bestSave = std::min(bestSave, secondsSince(start));
+			bytes = checkpoint.str().size();
+
+			Generation resumed(GeneratorConfig(), Config::PRIORITY_QUEUE_TYPE);
+			start = Clock::now();
+			if (!loadGenerationCheckpoint(checkpoint, *resumed.priorityQ, resumed.segments, *resumed.qTree, resumed.context)) {
+				std::printf("loading the checkpoint failed\n");
+				return;
+			}
+			bestLoad = std::min(bestLoad, secondsSince(start));
+
+			resumed.segmentLimit = config.segmentCountLimit;
+			start = Clock::now();
+			resumed.run(heatmap);
+			bestContinue = std::min(bestContinue, secondsSince(start));
+
+			identical = identical && resumed.segments.size() == full.segments.size() &&
+				resumed.segments.startX == full.segments.startX && resumed.segments.startY == full.segments.startY &&
+				resumed.segments.endX == full.segments.endX && resumed.segments.endY == full.segments.endY;
+		}
+
+		std::printf("generate all       %8.2f ms\n", bestFull * 1000);
+		std::printf("save at half       %8.2f ms  (%zu bytes)\n", bestSave * 1000, bytes);
+		std::printf("load               %8.2f ms\n", bestLoad * 1000);
+		std::printf("continue           %8.2f ms  (%s as generating at once)\n", bestContinue * 1000,
+			identical ? "same network" : "DIFFERENT network");
+	}
+
+	/* generation in slices of a fixed budget, like ARoadGenerator does every frame. Slices should stay close to the budget */
+	void benchTimeSliced(const GeneratorConfig& config, const HeatmapView& heatmap) {
+		const double budgets[] = { 0.001, 0.004 };
+		std::printf("\n== time-sliced generation ==\n");
+
+		Generation reference(config, Config::PRIORITY_QUEUE_TYPE);
+		reference.run(heatmap);
+
+		for (double budget : budgets) {
+			Generation generation(config, Config::PRIORITY_QUEUE_TYPE);
+			size_t slices = 0;
+			double longest = 0;
+			GenerationProgress progress;
+			do {
+				Clock::time_point start = Clock::now();
+				progress = advanceGeneration(*generation.priorityQ, generation.segments, *generation.qTree, generation.debugData,
+					generation.intersections, heatmap, generation.context, generation.segmentLimit, budget);
+				longest = std::max(longest, secondsSince(start));
+				slices++;
+			} while (!progress.finished);
+
+			bool identical = generation.segments.startX == reference.segments.startX && generation.segments.endX == reference.segments.endX &&
+				generation.segments.startY == reference.segments.startY && generation.segments.endY == reference.segments.endY;
+			std::printf("budget %4.1f ms  %6zu slices, longest %6.2f ms  (%s)\n", budget * 1000, slices, longest * 1000,
+				identical ? "same network" : "DIFFERENT network");
+		}
+	}
+
+	/* heap allocations of the intersection tests and of a whole generation step */
+	void benchAllocations(const GeneratorConfig& config, const HeatmapView& heatmap) {
+		std::printf("\n== allocations ==\n");
+
+		Generation generation(config, Config::PRIORITY_QUEUE_TYPE);
+
+		unsigned long long before = allocationCount();
+		generation.run(heatmap);
+		unsigned long long stepAllocations = allocationCount() - before;
+
+		// the same candidate tests localConstraints and removeConflictingSegments do, retrieve is only counted
+		size_t retrieved = 0;
+		size_t tests = 0;
+		size_t hits = 0;
+		unsigned long long testAllocations = 0;
+
+		for (SegmentHandle h = 0; h < generation.segments.size(); h++) {
+			retrieved += generation.qTree->retrieve(generation.segments.limits(h)).size();
+
+			before = allocationCount();
+			generation.qTree->query(generation.segments.limits(h), [&](Segment* other) {
+				if (generation.segments[h]->intersectWith(other))
+					hits++;
+				tests++;
+			});
+			testAllocations += allocationCount() - before;
+		}
+
+		std::printf("generation steps:         %zu\n", generation.steps);
+		std::printf("allocations per step:     %.2f (link vectors, topology and spatial index growth)\n",
+			generation.steps ? static_cast<double>(stepAllocations) / generation.steps : 0.0);
+		std::printf("intersection tests:       %zu (%zu hits, retrieve would give %zu candidates)\n", tests, hits, retrieved);
+		std::printf("allocations per query:    %.2f\n", generation.segments.empty() ? 0.0 :
+			static_cast<double>(testAllocations) / generation.segments.size());
+	}
+
+	/*
+	* The crossing and snapping queries of localConstraints for every segment of a network, with the index of the
+	* generation, with quadtrees and hash grids built at once from the segments and with the static R-tree of the passes
+	* after generation: candidates and time per query, time to build and heap used.
+	*/
+	void benchSpatialIndexes(const GeneratorConfig& config, const HeatmapView& heatmap, const char* heatmapName, int repetitions) {
+		Generation generation(config, Config::PRIORITY_QUEUE_TYPE);
+		generation.run(heatmap);
+		const SegmentStore& segments = generation.segments;
+
+		std::printf("\n== spatial index: %s, %zu segments ==\n", heatmapName, segments.size());
+
+		auto report = [&segments, repetitions](const char* label, const auto& index) {
+			size_t crossing = 0;
+			size_t snapping = 0;
+			double bestCrossing = 1e30;
+			double bestSnapping = 1e30;
+			for (int r = 0; r < repetitions; r++) {
+				crossing = 0;
+				snapping = 0;
+				Clock::time_point start = Clock::now();
+				for (SegmentHandle h = 0; h < segments.size(); h++)
+					index.query(segments.limits(h), [&crossing](Segment*) { crossing++; });
+				bestCrossing = std::min(bestCrossing, secondsSince(start));
+
+				start = Clock::now();
+				for (SegmentHandle h = 0; h < segments.size(); h++)
+					index.queryRadius(segments[h]->end, Config::ROAD_SNAP_DISTANCE, [&snapping](Segment*) { snapping++; });
+				bestSnapping = std::min(bestSnapping, secondsSince(start));
+			}
+
+			double queries = segments.empty() ? 1.0 : static_cast<double>(segments.size());
+			std::printf("%-22s crossing %7.1f ns %5.2f candidates  snapping %7.1f ns %5.2f candidates\n", label,
+				bestCrossing * 1e9 / queries, crossing / queries, bestSnapping * 1e9 / queries, snapping / queries);
+		};
+
+		auto build = [&segments, &report](const char* label, auto* index) {
+			long long heapBefore = heapBytes();
+			Clock::time_point start = Clock::now();
+			for (SegmentHandle h = 0; h < segments.size(); h++)
+				index->insert(segments.limits(h), segments[h]);
+			double buildTime = secondsSince(start);
+			long long indexBytes = heapBytes() - heapBefore;
+
+			report(label, *index);
+			std::printf("%-22s built in %.2f ms, %.1f KiB of heap\n", "", buildTime * 1000, indexBytes / 1024.0);
+			delete index;
+		};
+
+		report("generation index", *generation.qTree);
+
+		// Segments outside the bounds of a quadtree all end up in its outer leaves at max_levels, so it is built at the
+		// bounds of the generation and over everything the generation made
+		const Bounds generationBounds{ config.minx, config.miny, config.maxx - config.minx, config.maxy - config.miny };
+		Bounds extent = generationBounds;
+		for (SegmentHandle h = 0; h < segments.size(); h++) {
+			Bounds b = segments.limits(h);
+			double right = std::max(extent.x + extent.width, b.x + b.width);
+			double bottom = std::max(extent.y + extent.height, b.y + b.height);
+			extent.x = std::min(extent.x, b.x);
+			extent.y = std::min(extent.y, b.y);
+			extent.width = right - extent.x;
+			extent.height = bottom - extent.y;
+		}
+
+		build("quadtree", new Quadtree<Segment*>(generationBounds, Config::QUADTREE_MAX_OBJECTS, Config::QUADTREE_MAX_LEVELS));
+		build("quadtree over extent", new Quadtree<Segment*>(extent, Config::QUADTREE_MAX_OBJECTS, Config::QUADTREE_MAX_LEVELS));
+
+		const double cellSizes[] = { 100, 200, 400, 800 };
+		for (double cellSize : cellSizes) {
+			char label[32];
+			std::snprintf(label, sizeof(label), "hash grid %.0f", cellSize);
+			build(label, new HashGrid<Segment*>(generationBounds, cellSize));
+		}
+
+		// what the passes after generation query: packed at once from the final segments and only read afterwards
+		long long heapBefore = heapBytes();
+		Clock::time_point start = Clock::now();
+		StaticRTree<Segment*> rtree;
+		segments.buildStaticIndex(rtree);
+		double buildTime = secondsSince(start);
+		long long indexBytes = heapBytes() - heapBefore;
+
+		report("static R-tree", rtree);
+		std::printf("%-22s built in %.2f ms, %.1f KiB of heap\n", "", buildTime * 1000, indexBytes / 1024.0);
+
+		// both kinds of queries have to give the same candidates as a quadtree of the same segments
+		Quadtree<Segment*> quadtree(extent, Config::QUADTREE_MAX_OBJECTS, Config::QUADTREE_MAX_LEVELS);
+		for (SegmentHandle h = 0; h < segments.size(); h++)
+			quadtree.insert(segments.limits(h), segments[h]);
+
+		size_t differences = 0;
+		std::vector<Segment*> fromTree, fromQuadtree;
+		auto compare = [&fromTree, &fromQuadtree, &differences]() {
+			std::sort(fromTree.begin(), fromTree.end());
+			std::sort(fromQuadtree.begin(), fromQuadtree.end());
+			if (fromTree != fromQuadtree)
+				differences++;
+			fromTree.clear();
+			fromQuadtree.clear();
+		};
+		for (SegmentHandle h = 0; h < segments.size(); h++) {
+			rtree.query(segments.limits(h), [&fromTree](Segment* other) { fromTree.push_back(other); });
+			quadtree.query(segments.limits(h), [&fromQuadtree](Segment* other) { fromQuadtree.push_back(other); });
+			compare();
+			rtree.queryRadius(segments[h]->end, Config::ROAD_SNAP_DISTANCE, [&fromTree](Segment* other) { fromTree.push_back(other); });
+			quadtree.queryRadius(segments[h]->end, Config::ROAD_SNAP_DISTANCE, [&fromQuadtree](Segment* other) { fromQuadtree.push_back(other); });
+			compare();
+		}
+		if (differences == 0)
+			std::printf("%-22s same candidates as the quadtree\n", "");
+		else
+			std::printf("%-22s DIFFERENT candidates from the quadtree for %zu queries\n", "", differences);
+
+		// the crossing queries again, shared by threads that all read the same tree
+		const unsigned int threadCount = std::max(2u, std::thread::hardware_concurrency());
+		std::vector<size_t> candidates(threadCount, 0);
+		std::vector<std::thread> workers;
+		start = Clock::now();
+		for (unsigned int t = 0; t < threadCount; t++) {
+			workers.emplace_back([&rtree, &segments, &candidates, t, threadCount]() {
+				size_t found = 0;
+				for (SegmentHandle h = t; h < segments.size(); h += threadCount)
+					rtree.query(segments.limits(h), [&found](Segment*) { found++; });
+				candidates[t] = found;
+			});
+		}
+		for (auto& worker : workers)
+			worker.join();
+		double queryTime = secondsSince(start);
+
+		size_t crossing = 0;
+		for (size_t found : candidates)
+			crossing += found;
+		double queries = segments.empty() ? 1.0 : static_cast<double>(segments.size());
+		std::printf("%-22s crossing on %u threads %.1f ns %5.2f candidates\n", "", threadCount,
+			queryTime * 1e9 / queries, crossing / queries);
+	}
+
+	/*
+	* The batch tests against the Math functions, with the candidates of the crossing queries of every segment of a
+	* network and a few degenerate ones (parallel, zero length, sharing an end): every result has to be the same, and
+	* the time per candidate of both.
+	*/
+	void benchBatchMath(const GeneratorConfig& config, const HeatmapView& heatmap, int repetitions) {
+		Generation generation(config, Config::PRIORITY_QUEUE_TYPE);
+		generation.run(heatmap);
+		const SegmentStore& segments = generation.segments;
+
+		std::printf("\n== batch segment tests: %s, %zu segments ==\n", BatchMath::instructionSet(), segments.size());
+
+		std::vector<CandidateBlock> blocks(segments.size());
+		size_t candidateCount = 0;
+		for (SegmentHandle h = 0; h < segments.size(); h++) {
+			const Point start = segments.start(h);
+			const Point end = segments.end(h);
+			generation.qTree->query(segments.limits(h), [&](Segment* other) { blocks[h].push(other->start, other->end); });
+			blocks[h].push(Point{ start.x + 1, start.y + 1 }, Point{ end.x + 1, end.y + 1 });
+			blocks[h].push(end, end);
+			blocks[h].push(start, Point{ start.x - end.y + start.y, start.y + end.x - start.x });
+			candidateCount += blocks[h].size();
+		}
+
+		auto same = [](double a, double b) { return a == b || (a != a && b != b); };
+
+		size_t differences = 0;
+		CandidateTests tests;
+		for (SegmentHandle h = 0; h < segments.size(); h++) {
+			const Point start = segments.start(h);
+			const Point end = segments.end(h);
+			const CandidateBlock& block = blocks[h];
+			BatchMath::testAll(start, end, block, tests);
+
+			for (size_t i = 0; i < block.size(); i++) {
+				const Point p{ block.startX[i], block.startY[i] };
+				const Point d{ block.endX[i], block.endY[i] };
+				OptionalIntersection intersection = Math::doLineSegmentsIntersect(start, end, p, d, true);
+				Math::DistanceToLineResult distance = Math::distanceToLine(end, p, d);
+
+				bool equal = (tests.crosses[i] != 0) == static_cast<bool>(intersection);
+				if (equal && intersection)
+					equal = same(tests.crossX[i], intersection->x) && same(tests.crossY[i], intersection->y) && same(tests.crossT[i], intersection->t);
+				equal = equal && same(tests.distance2[i], distance.distance2) && same(tests.lineX[i], distance.pointOnLine.x) &&
+					same(tests.lineY[i], distance.pointOnLine.y) && same(tests.lineProj2[i], distance.lineProj2) &&
+					same(tests.length2[i], distance.length2);
+				if (!equal)
+					differences++;
+			}
+		}
+
+		// both loops read what localConstraints reads, so that neither skips work the other does
+		auto snaps = [](double distance2, double lineProj2, double length2) {
+			return distance2 < Config::ROAD_SNAP_DISTANCE * Config::ROAD_SNAP_DISTANCE && lineProj2 >= 0 && lineProj2 <= length2;
+		};
+
+		double bestScalar = 1e30;
+		double bestBatch = 1e30;
+		size_t scalarHits = 0;
+		size_t batchHits = 0;
+		for (int r = 0; r < repetitions; r++) {
+			scalarHits = 0;
+			Clock::time_point start = Clock::now();
+			for (SegmentHandle h = 0; h < segments.size(); h++) {
+				const Point a = segments.start(h);
+				const Point b = segments.end(h);
+				const CandidateBlock& block = blocks[h];
+				for (size_t i = 0; i < block.size(); i++) {
+					const Point p{ block.startX[i], block.startY[i] };
+					const Point d{ block.endX[i], block.endY[i] };
+					OptionalIntersection intersection = Math::doLineSegmentsIntersect(a, b, p, d, true);
+					if (intersection && intersection->t < 0.5)
+						scalarHits++;
+					Math::DistanceToLineResult distance = Math::distanceToLine(b, p, d);
+					if (snaps(distance.distance2, distance.lineProj2, distance.length2) && distance.pointOnLine.x < b.x)
+						scalarHits++;
+				}
+			}
+			bestScalar = std::min(bestScalar, secondsSince(start));
+
+			batchHits = 0;
+			start = Clock::now();
+			for (SegmentHandle h = 0; h < segments.size(); h++) {
+				BatchMath::testAll(segments.start(h), segments.end(h), blocks[h], tests);
+				for (size_t i = 0; i < blocks[h].size(); i++) {
+					if (tests.crosses[i] && tests.crossT[i] < 0.5)
+						batchHits++;
+					if (snaps(tests.distance2[i], tests.lineProj2[i], tests.length2[i]) && tests.lineX[i] < segments.end(h).x)
+						batchHits++;
+				}
+			}
+			bestBatch = std::min(bestBatch, secondsSince(start));
+		}
+
+		double candidates = candidateCount ? static_cast<double>(candidateCount) : 1.0;
+		std::printf("Math functions     %6.2f ns per candidate  (%zu candidates, %.2f per segment)\n", bestScalar * 1e9 / candidates,
+			candidateCount, segments.empty() ? 0.0 : candidates / segments.size());
+		std::printf("batch              %6.2f ns per candidate  speedup %5.2fx\n", bestBatch * 1e9 / candidates, bestScalar / bestBatch);
+		if (differences == 0 && scalarHits == batchHits)
+			std::printf("results            same as the Math functions\n");
+		else
+			std::printf("results            DIFFERENT from the Math functions for %zu candidates\n", differences);
+	}
+
+	/* CreateRoads followed by the part of ShowRoads that doesn't need the engine */
+	void benchPipeline(const GeneratorConfig& config, const HeatmapView& heatmap, int repetitions) {
+		std::printf("\n== CreateRoads -> ShowRoads ==\n");
+
+		const char* phases[] = { "generation", "remove conflicts", "welding",
+			"world transform", "region culling", "road order", "mesh input" };
+		const int phaseCount = sizeof(phases) / sizeof(phases[0]);
+		std::vector<double> best(phaseCount, 1e30);
+		size_t segmentCount = 0;
+		size_t intersectionCount = 0;
+
+		for (int r = 0; r < repetitions; r++) {
+			Generation generation(config, Config::PRIORITY_QUEUE_TYPE);
+			SegmentStore& segments = generation.segments;
+			std::vector<double> times;
+			Clock::time_point start = Clock::now();
+
+			generation.run(heatmap);
+			times.push_back(secondsSince(start)); start = Clock::now();
+
+			removeConflictingSegments(segments, *generation.qTree);
+			times.push_back(secondsSince(start)); start = Clock::now();
+
+			weldSegmentEnds(segments, generation.intersections, generation.context);
+			times.push_back(secondsSince(start)); start = Clock::now();
+
+			// the region is the generation bounds, shrunk a bit so that culling has work to do
+			transformSegmentsAndIntersections(segments, generation.intersections, *generation.qTree, 100, Point{ 0, 0 });
+			times.push_back(secondsSince(start)); start = Clock::now();
+
+			removeOutsideOfRegion(segments, generation.intersections, *generation.qTree,
+				config.minx * 90, config.maxx * 90, config.miny * 90, config.maxy * 90);
+			times.push_back(secondsSince(start)); start = Clock::now();
+
+			findOrderOfRoads(segments);
+			times.push_back(secondsSince(start)); start = Clock::now();
+
+			// what RoadSegmentsToStartAndEndPoints hands to the mesh maker
+			std::vector<double> vertices;
+			vertices.reserve(segments.size() * 6);
+			for (SegmentHandle h = 0; h < segments.size(); h++) {
+				vertices.push_back(segments.startX[h]);
+				vertices.push_back(segments.startY[h]);
+				vertices.push_back(40.0 + segments.startOrder[h] * 5);
+				vertices.push_back(segments.endX[h]);
+				vertices.push_back(segments.endY[h]);
+				vertices.push_back(40.0 + segments.endOrder[h] * 5);
+			}
+			times.push_back(secondsSince(start));
+
+			for (int i = 0; i < phaseCount; i++)
+				best[i] = std::min(best[i], times[i]);
+			segmentCount = segments.size();
+			intersectionCount = generation.intersections.size();
+		}
+
+		double total = 0;
+		for (int i = 0; i < phaseCount; i++) {
+			std::printf("%-18s %8.3f ms\n", phases[i], best[i] * 1000);
+			total += best[i];
+		}
+		std::printf("%-18s %8.3f ms  (%zu segments, %zu intersections after culling)\n", "total", total * 1000,
+			segmentCount, intersectionCount);
+	}
+
+	/* subdivides one square block into parcels, exercises BlocksGen */
+	void benchParcels(int repetitions) {
+		std::printf("\n== parcels ==\n");
+
+		double best = 1e30;
+		size_t parcels = 0;
+		for (int r = 0; r < repetitions; r++) {
+			IdAllocator vertexIDs;
+			std::vector<GraphVertex*> face = {
+				new GraphVertex(Point{ 0, 0 }, vertexIDs.next()),
+				new GraphVertex(Point{ 0, 100 }, vertexIDs.next()),
+				new GraphVertex(Point{ 100, 100 }, vertexIDs.next()),
+				new GraphVertex(Point{ 100, 0 }, vertexIDs.next())
+			};
+
+			Clock::time_point start = Clock::now();
+			Block block;
+			block.parcels.push_back(new Parcel(face, vertexIDs));
+			block.subdivideParcels(100);
+			best = std::min(best, secondsSince(start));
+			parcels = block.parcels.size();
+		}
+		std::printf("subdivide block    %8.3f ms  (%zu parcels)\n", best * 1000, parcels);
+	}
+
+	/* random heatmap synthesis with 1 to N threads, and the same pattern rendered at a quarter of the resolution */
+	void benchHeatmap(int repetitions) {
+		std::printf("\n== heatmap synthesis: %dx%d ==\n", SYNTHESIS_SIZE, SYNTHESIS_SIZE);
+
+		const HeatmapNoise noise = HeatmapNoise::random(SYNTHESIS_SIZE, SYNTHESIS_SIZE, false, SEED);
+		const size_t pixelCount = static_cast<size_t>(SYNTHESIS_SIZE) * SYNTHESIS_SIZE;
+
+		const int cores = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+		std::vector<int> threadCounts;
+		for (int threads = 1; threads < cores; threads *= 2)
+			threadCounts.push_back(threads);
+		threadCounts.push_back(cores);
+
+		HeatmapView reference;
+		double singleThreaded = 0;
+		for (int threads : threadCounts) {
+			double best = 1e30;
+			bool identical = true;
+			for (int r = 0; r < repetitions; r++) {
+				Clock::time_point start = Clock::now();
+				HeatmapView heatmap = Heatmap(noise, SYNTHESIS_SIZE, SYNTHESIS_SIZE, threads).view();
+				best = std::min(best, secondsSince(start));
+
+				if (!reference.isValid())
+					reference = heatmap;
+				identical = identical && std::equal(heatmap.data(), heatmap.data() + pixelCount, reference.data());
+			}
+			if (threads == 1)
+				singleThreaded = best;
+			std::printf("%2d threads %10.2f ms  speedup %5.2fx  %8.2f Mpixels/s  (%s)\n", threads, best * 1000,
+				singleThreaded / best, pixelCount / best / 1e6, identical ? "same image" : "DIFFERENT image");
+		}
+
+		// every pixel of the smaller image lies on a pixel of the full size one
+		const int step = 4;
+		const int smallSize = SYNTHESIS_SIZE / step;
+		HeatmapView small = Heatmap(noise, smallSize, smallSize).view();
+		size_t differences = 0;
+		for (int y = 0; y < smallSize; y++) {
+			for (int x = 0; x < smallSize; x++) {
+				if (small.data()[y * smallSize + x] != reference.data()[(y * step) * SYNTHESIS_SIZE + x * step])
+					differences++;
+			}
+		}
+		std::printf("%dx%d           %s\n", smallSize, smallSize,
+			differences == 0 ? "same pattern" : "DIFFERENT pattern");
+	}
+}
+
+int main(int argc, char** argv) {
+	int segmentLimit = argc > 1 ? std::atoi(argv[1]) : 5000;
+	int repetitions = argc > 2 ? std::atoi(argv[2]) : 3;
+	if (segmentLimit <= 0 || repetitions <= 0) {
+		std::fprintf(stderr, "usage: %s [segments] [repetitions]\n", argv[0]);
+		return 1;
+	}
+
+	GeneratorConfig config;
+	config.segmentCountLimit = segmentLimit;
+	config.minx = -10000;
+	config.maxx = 10000;
+	config.miny = -10000;
+	config.maxy = 10000;
+	config.seed = SEED;
+
+	HeatmapView heatmap = makeHeatmap();
+	HeatmapView noisyHeatmap = makeHeatmap(6.0f);
+
+	std::printf("segments: %d, repetitions: %d (best run is reported), spatial index: %s\n", segmentLimit, repetitions,
+#if defined(PROCSIM_HASH_GRID) && PROCSIM_HASH_GRID
+		"hash grid");
+#else
+		"quadtree");
+#endif
+
+	benchPriorityQueues(config, heatmap, repetitions);
+	benchTiled(config, heatmap, repetitions);
+	benchConflicts(config, heatmap, repetitions);
+	benchCheckpoint(config, heatmap, repetitions);
+	benchTimeSliced(config, heatmap);
+	benchAllocations(config, heatmap);
+	benchBatchMath(config, heatmap, repetitions);
+	benchSpatialIndexes(config, heatmap, "smooth heatmap", repetitions);
+	benchSpatialIndexes(config, noisyHeatmap, "noisy heatmap", repetitions);
+	benchPipeline(config, heatmap, repetitions);
+	benchParcels(repetitions);
+	benchHeatmap(repetitions);
+
+	return 0;
+}
@@ -28,11 +28,16 @@ Graph<GraphVertex*>* ACityBlocksMaker::MakeGraph(std::vector<Intersection*> inte
 	Graph<GraphVertex*>* graph = new Graph<GraphVertex*>{};
 	
 	// Node ID: intersection ID, Node MetaData: GraphVertex pointer
+	int maxID = -1;
 	for (auto intersection : intersections) {
 		GraphVertex* node = new GraphVertex(intersection->position, intersection->ID);
 		graph->AddNode(node->ID, node);
+		maxID = std::max(maxID, intersection->ID);
 	}
 
+	// vertices created by the parcels continue after the intersection IDs so they never collide with the city graph
+	vertexIDs.reset(maxID + 1);
+
 	for (auto segment : segments) {
 		graph->AddEdge(segment->startIntersectionID, segment->endIntersectionID);
 	}
@@ -66,7 +71,7 @@ Parcel* ACityBlocksMaker::faceToParcel(Graph<GraphVertex*>* graph, std::vector<i
 		graphNodes.push_back(graphNode);
 	}
 
-	return new Parcel(graphNodes);
+	return new Parcel(graphNodes, vertexIDs);
 }
 
 TArray<Block*> ACityBlocksMaker::ParcelBlocks(Graph<GraphVertex*>* graph, FVector midpoint)
@@ -42,6 +42,9 @@ public:
 	/* set actor for intersection showing */
 	void SetBlueprints(TSubclassOf<AActor> beforeBP, TSubclassOf<AActor> afterBP);
 
+	/* IDs of the graph vertices the parcels create */
+	IdAllocator vertexIDs;
+
 	std::vector<Intersection*> in11;
 	TArray<FVector> cyclepositions{};
 
@@ -67,20 +67,24 @@ void AProceduralMeshMaker::CPPConstruction()
 			roadData.Add(FMetaRoadData{ false, (Config::DEFAULT_SEGMENT_WIDTH) });
 		}
 
-		Segment* segment1 = new Segment({ 0,0 }, { 400,0 });
-		Segment* segment2 = new Segment({ 400,0 }, { 800,0 });
-		Segment* segment3 = new Segment({ 0,0 }, { 0,-400 });
-		Segment* segment4 = new Segment({ 0,-400 }, { 0,-800 });
-		Segment* segment5 = new Segment({ 800,-800 }, { 400,-800 });
-		Segment* segment6 = new Segment({ 400,-800 }, { 0,-800 });
-		Segment* segment7 = new Segment({ 800,0 }, { 800,-400 });
-		Segment* segment8 = new Segment({ 800,-400 }, { 800,-800 });
-		Segment* segment9 = new Segment({ 0,-1600 }, { 0,-1200 });
-		Segment* segment10 = new Segment({ 0,-1200 }, { 0,-800 });
-		Segment* segment11 = new Segment({ 800,0 }, { 1200,0 });
-		Segment* segment12 = new Segment({ 1200,0 }, { 1000,-400 });
-		Segment* segment13 = new Segment({ 1000,-400 }, { 800,-800 });
-		Segment* segment14 = new Segment({ 1200,0 }, { 1600,0 });
+		/* test data, IDs are counted here like a generation would */
+		IdAllocator segmentIDs;
+		IdAllocator intersectionIDs;
+
+		Segment* segment1 = new Segment(segmentIDs.next(), { 0,0 }, { 400,0 });
+		Segment* segment2 = new Segment(segmentIDs.next(), { 400,0 }, { 800,0 });
+		Segment* segment3 = new Segment(segmentIDs.next(), { 0,0 }, { 0,-400 });
+		Segment* segment4 = new Segment(segmentIDs.next(), { 0,-400 }, { 0,-800 });
+		Segment* segment5 = new Segment(segmentIDs.next(), { 800,-800 }, { 400,-800 });
+		Segment* segment6 = new Segment(segmentIDs.next(), { 400,-800 }, { 0,-800 });
+		Segment* segment7 = new Segment(segmentIDs.next(), { 800,0 }, { 800,-400 });
+		Segment* segment8 = new Segment(segmentIDs.next(), { 800,-400 }, { 800,-800 });
+		Segment* segment9 = new Segment(segmentIDs.next(), { 0,-1600 }, { 0,-1200 });
+		Segment* segment10 = new Segment(segmentIDs.next(), { 0,-1200 }, { 0,-800 });
+		Segment* segment11 = new Segment(segmentIDs.next(), { 800,0 }, { 1200,0 });
+		Segment* segment12 = new Segment(segmentIDs.next(), { 1200,0 }, { 1000,-400 });
+		Segment* segment13 = new Segment(segmentIDs.next(), { 1000,-400 }, { 800,-800 });
+		Segment* segment14 = new Segment(segmentIDs.next(), { 1200,0 }, { 1600,0 });
 
 		segment1->links_b = { segment3 };
 		segment1->links_f = { segment2 };
@@ -123,11 +127,11 @@ void AProceduralMeshMaker::CPPConstruction()
 		Point int4pos = { 0,-800 };
 		Point int5pos = { 800,-800 };
 
-		Intersection* inter1 = new Intersection(int1segments, int1pos);
-		Intersection* inter2 = new Intersection(int2segments, int2pos);
-		Intersection* inter3 = new Intersection(int3segments, int3pos);
-		Intersection* inter4 = new Intersection(int4segments, int4pos);
-		Intersection* inter5 = new Intersection(int5segments, int5pos);
+		Intersection* inter1 = new Intersection(intersectionIDs.next(), int1segments, int1pos);
+		Intersection* inter2 = new Intersection(intersectionIDs.next(), int2segments, int2pos);
+		Intersection* inter3 = new Intersection(intersectionIDs.next(), int3segments, int3pos);
+		Intersection* inter4 = new Intersection(intersectionIDs.next(), int4segments, int4pos);
+		Intersection* inter5 = new Intersection(intersectionIDs.next(), int5segments, int5pos);
 
 		segment1->startIntersectionID = inter1->ID;
 		segment2->endIntersectionID = inter2->ID;
@@ -200,7 +204,7 @@ void AProceduralMeshMaker::GenerateMesh(TArray<FVector> startPoints, TArray<FVec
 }
 
 // this function is used to create procedural mesh for all the intersections
-void AProceduralMeshMaker::GenerateMeshIntersections(std::vector<Intersection*> intersections, float height)
+void AProceduralMeshMaker::GenerateMeshIntersections(const std::vector<Intersection*>& intersections, float height)
 {
 	UE_LOG(LogTemp, Warning, TEXT("Generating mesh intersections"));
 	TArray<FVector> vertices{};
@@ -216,35 +220,31 @@ void AProceduralMeshMaker::GenerateMeshIntersections(std::vector<Intersection*>
 		}
 		middlePoint = middlePoint / intersection->branches.size();
 
-		// we pair segment ID to angle of the middlepoints of segment end close to intersection, to X-axis
-		std::vector<std::pair<int, float>> pointsPairVector;
+		// we pair the segment to angle of the middlepoints of segment end close to intersection, to X-axis
+		std::vector<std::pair<Segment*, float>> pointsPairVector;
 		pointsPairVector.reserve(intersection->branches.size());
 		for (auto branch : intersection->branches) {
 			// the middlepoint of the segment is transformed to coordinate system with center of all points as origin
 			bool isStart = (branch->start - intersection->position).length() < (branch->end - intersection->position).length();
 			Point transformedMiddlePoint = (isStart ? branch->start : branch->end) - middlePoint;
 			float angle = atan2(transformedMiddlePoint.y, transformedMiddlePoint.x);
-			pointsPairVector.emplace_back(std::pair<int, float>{branch->ID, angle});
+			pointsPairVector.emplace_back(std::pair<Segment*, float>{branch, angle});
 		}
 
 		// we want array of sorted segments
-		auto cmp = [](const std::pair<int, float>& a, const std::pair<int, float>& b) {
+		auto cmp = [](const std::pair<Segment*, float>& a, const std::pair<Segment*, float>& b) {
 			return (a.second < b.second);
 		};
 
 		std::sort(pointsPairVector.begin(), pointsPairVector.end(), cmp);
 
 
-		// now we can get the sorted segments
+		// now we can get the sorted segments, the pairs hold them already so there is nothing to look up by ID
 		std::vector<Segment*> sortedSegments{};
 		sortedSegments.reserve(intersection->branches.size());
 
-		for (size_t i = 0; i < pointsPairVector.size(); i++) {
-			auto it = std::find_if(intersection->branches.begin(), intersection->branches.end(),
-				[pointsPairVector,i](const Segment* segment) {return segment->ID == pointsPairVector[i].first; });
-			if (it != intersection->branches.end()) {
-				sortedSegments.emplace_back(*it);
-			}
+		for (const auto& pair : pointsPairVector) {
+			sortedSegments.emplace_back(pair.first);
 		}
 
 
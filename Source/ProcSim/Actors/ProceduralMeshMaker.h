@@ -37,7 +37,7 @@ public:
 	void GenerateMesh(TArray<FVector> startPoints, TArray<FVector> endPoints, TArray<FMetaRoadData> roadData);
 
 	/* this function can be used to make the mesh connecting the intersections */
-	void GenerateMeshIntersections(std::vector<Intersection*> intersections, float height = 40.0f);
+	void GenerateMeshIntersections(const std::vector<Intersection*>& intersections, float height = 40.0f);
 
 	/* helper functions to generate vertices, triangles, UVs for the procedural mesh */
 	TArray<FVector> CalculateVerticesForProceduralMesh(TArray<FVector> startPoints, TArray<FVector> endPoints, TArray<FMetaRoadData> roadData);
@@ -2,8 +2,13 @@
 #include "RoadGenerator.h"
 #include "Engine/Classes/Components/TextRenderComponent.h"
 
+#include <limits>
 #include <memory>
+#include <random>
+#include <sstream>
+#include "Misc/FileHelper.h"
 #include "ProcSim/Utils/ImageHandler.h"
+#include "ProcSim/MapGen/GenerationCheckpoint.h"
 
 
 // Sets default values
@@ -20,6 +25,16 @@ void ARoadGenerator::BeginPlay()
 	Super::BeginPlay();
 }
 
+// Called every frame
+void ARoadGenerator::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	/* a generation started with StartRoads grows a slice every frame */
+	if (bGeneratingRoads)
+		AdvanceRoads(GenerationBudgetMs / 1000.0);
+}
+
 
 // Choose image from disk and apply it to proceduralmeshcomponent
 void ARoadGenerator::ChooseImageAndApplyToPlane(UProceduralMeshComponent* PlaneReference)
@@ -32,31 +47,25 @@ void ARoadGenerator::ChooseImageAndApplyToPlane(UProceduralMeshComponent* PlaneR
 	int outWidth;
 	int outHeight;
 
-	bool loaded = ImageHandler::LoadImageFromFile(filePath, this->pixels, outWidth, outHeight);
+	/* image is stored as shared pointer to unsigned character array */
+	std::shared_ptr<const uint8> loadedImage;
 
-	if (loaded) {
+	bool loaded = ImageHandler::LoadImageFromFile(filePath, loadedImage, outWidth, outHeight);
 
-		auto Texture = ImageHandler::PixelsToTexture(this->pixels, outWidth, outHeight);
+	if (!loaded)
+		return;
 
-		if (Texture == nullptr) {
-			UE_LOG(LogTemp, Error, TEXT("Couldn't open Heatmap"));
-			return;
-		}
+	/* create heatmap from the loaded image, the decoded buffer is shared and not copied */
+	this->heatmap = Heatmap(loadedImage, outWidth, outHeight).view();
 
-		ImageHandler::ApplyTextureToProceduralMeshComponent(PlaneReference, Texture, "/Game/Materials/HeatmapMaterial");
-	}
+	auto Texture = ImageHandler::PixelsToTexture(this->heatmap.data(), outWidth, outHeight);
 
-	/* image is stored as shared pointer to unsigned character array */
-	std::unique_ptr<unsigned char[]> loadedImage(new unsigned char[outWidth * outHeight]);
-
-	for (int y = 0; y < outHeight; y++) {
-		for (int x = 0; x < outWidth; x++) {
-			loadedImage[y * outWidth + x] = pixels[y * outWidth + x];
-		}
+	if (Texture == nullptr) {
+		UE_LOG(LogTemp, Error, TEXT("Couldn't open Heatmap"));
+		return;
 	}
 
-	/* create heatmap from the loaded image */
-	this->heatmap = new Heatmap(loadedImage.release(), outWidth, outHeight);
+	ImageHandler::ApplyTextureToProceduralMeshComponent(PlaneReference, Texture, "/Game/Materials/HeatmapMaterial");
 
 }
 
@@ -64,21 +73,11 @@ void ARoadGenerator::ChooseImageAndApplyToPlane(UProceduralMeshComponent* PlaneR
 void ARoadGenerator::CreateRandomHeatmapAndApplyToPlane(UProceduralMeshComponent* PlaneReference, bool completelyRandom)
 {
 	/* parameters for the heatmap */
-	Config::COMPLETELYRANDOM = completelyRandom;
 	int width = 800; int height = 800;
-	Heatmap *heat = new Heatmap(width, height);
-	
-	/* pixels TArray is populated with the data from the generated heatmap image*/
-	this->pixels.Empty();
+	HeatmapView heat = Heatmap(width, height, completelyRandom).view();
 
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			this->pixels.Add(static_cast<uint8>(heat->image[y * width + x]));
-		}
-	}
-
-	/* create texture and apply it to the plane*/
-	auto Texture = ImageHandler::PixelsToTexture(this->pixels, width, height);
+	/* create texture and apply it to the plane, straight from the heatmap image*/
+	auto Texture = ImageHandler::PixelsToTexture(heat.data(), width, height);
 
 	if (Texture == nullptr) {
 		UE_LOG(LogTemp, Warning, TEXT("Couldnt make random heatmap"));
@@ -104,64 +103,227 @@ void ARoadGenerator::VisualizeSegmentLinks() {
 	}
 }
 
-// Iterate over segments, find close ones in qTree and check if there is intersection (there shouldn't be)
+// Iterate over segments, find close ones and check if there is intersection (there shouldn't be)
 void ARoadGenerator::PrintConflictingSegments()
 {
+	// the network is final here, a packed tree of it is faster to query than the quadtree built during generation
+	StaticRTree<Segment*> index;
+	segments.buildStaticIndex(index);
+
 	int num = 0;
 	for (auto segment : segments) {
-		for (auto other : qTree->retrieve(segment->limits())) {
+		index.query(segment->limits(), [&](Segment* other) {
 			auto in = other->intersectWith(segment);
-			if (in != nullptr) {
+			if (in) {
 				UE_LOG(LogTemp, Warning, TEXT("CONFLICT: segment: start(%f,%f) end(%f,%f) other: start(%f,%f) end(%f,%f)"),
 					segment->start.x, segment->start.y, segment->end.x, segment->end.y,
 					other->start.x, other->start.y, other->end.x, other->end.y)
 					num++;
 			}
-		}
+		});
 	}
 	UE_LOG(LogTemp, Warning, TEXT("Num mistakes: %d"), num / 2);
 	UE_LOG(LogTemp, Warning, TEXT("Hey is this functions getting claled?"));
 }
 
 
+// Frees the segments, intersections and search structures of the previous generation
+void ARoadGenerator::ResetGeneration()
+{
+	bGeneratingRoads = false;
+
+	delete priorityQ;
+	priorityQ = nullptr;
+	delete qTree;
+	qTree = nullptr;
+
+	segments.clear();
+	intersections.clear();
+	debugData = DebugData{};
+
+	// all segments and intersections live in the arena of the context, this frees them at once
+	context.arena.reset();
+}
+
+// The generation code doesn't know about the editor's enum, it has its own
+static Straightness ToGeneratorStraightness(ESTRAIGHTNESS straightness)
+{
+	switch (straightness) {
+	case ESTRAIGHTNESS::SE_CURVED:
+		return Straightness::Curved;
+	case ESTRAIGHTNESS::SE_VERYSTRAIGHT:
+		return Straightness::VeryStraight;
+	case ESTRAIGHTNESS::SE_STRAIGHT:
+	default:
+		return Straightness::Straight;
+	}
+}
+
 // Main algorithm for creating the 3D roads
 bool ARoadGenerator::CreateRoads(FVector regionStart, FVector regionEnd, ESTRAIGHTNESS straightness, int numSegments)
+{
+	if (!StartRoads(regionStart, regionEnd, straightness, numSegments))
+		return false;
+
+	if (bGeneratingRoads)
+		AdvanceRoads(std::numeric_limits<double>::infinity());
+	return true;
+}
+
+// Sets up the generation, the generation loop itself runs in AdvanceRoads
+bool ARoadGenerator::StartRoads(FVector regionStart, FVector regionEnd, ESTRAIGHTNESS straightness, int numSegments)
 {
 	regionStartPoint = regionStart;
 	regionEndPoint = regionEnd;
 
-	if (this->heatmap == nullptr)
+	if (!this->heatmap.isValid())
 		return false;
 	
 	/* The boundary for generation is calculated from the selected region. divide by 100 to transform units*/
-	Config::minx = -abs((regionStartPoint.X/100) - (regionEndPoint.X/100)) / 2;
-	Config::maxx = +abs((regionStartPoint.X/100) - (regionEndPoint.X/100)) / 2;
+	GeneratorConfig config;
+	config.minx = -abs((regionStartPoint.X/100) - (regionEndPoint.X/100)) / 2;
+	config.maxx = +abs((regionStartPoint.X/100) - (regionEndPoint.X/100)) / 2;
+
+	config.miny = -abs((regionStartPoint.Y/100) - (regionEndPoint.Y/100)) / 2;
+	config.maxy = +abs((regionStartPoint.Y/100) - (regionEndPoint.Y/100)) / 2;
+
 
-	Config::miny = -abs((regionStartPoint.Y/100) - (regionEndPoint.Y/100)) / 2;
-	Config::maxy = +abs((regionStartPoint.Y/100) - (regionEndPoint.Y/100)) / 2;
+	config.straightness = ToGeneratorStraightness(straightness);
+	config.segmentCountLimit = numSegments;
 
+	if (bRandomSeed)
+		Seed = static_cast<int32>(std::random_device()() & 0x7FFFFFFF);
+	config.seed = static_cast<unsigned int>(Seed);
+	UE_LOG(LogTemp, Log, TEXT("Road generation seed: %d"), Seed);
 
-	Config::STRAIGHTNESS = straightness;
-	Config::SEGMENT_COUNT_LIMIT = numSegments;
+	/* previous generation is thrown away */
+	ResetGeneration();
+	context.reset(config);
 
 	/* generation algorithm starts here*/
-	priorityQ = new PriorityQueue<Segment*>([](const Segment* s) { return s->t; });
-	std::vector<Segment*> initialSegments = makeInitialSegments();
+	qTree = makeSpatialIndex<Segment*>(Bounds{ config.minx,
+			config.miny,
+			config.maxx - config.minx,
+			config.maxy - config.miny });
+
+	/* tiled generation runs on all cores at once, it isn't split over frames */
+	if (TilesPerSide > 1) {
+		generateTiled(segments, *qTree, debugData, intersections, this->heatmap, context, TilesPerSide, TilesPerSide);
+		generationCheckpoint.clear();
+		FinishRoads();
+		OnRoadGenerationProgress.Broadcast(static_cast<int32>(segments.size()), 0, true);
+		return true;
+	}
+
+	priorityQ = makePriorityQueue<Segment*>(Config::PRIORITY_QUEUE_TYPE, [](const Segment* s) { return s->t; });
+	std::vector<Segment*> initialSegments = makeInitialSegments(context);
 
 	for (auto initialSegment : initialSegments) {
 		priorityQ->enqueue(initialSegment);
 	}
 
-	qTree = new Quadtree<Segment*>(*(new Bounds{ Config::minx,
-			Config::miny,
-			Config::maxx - Config::minx,
-			Config::maxy - Config::miny }), Config::QUADTREE_MAX_OBJECTS, Config::QUADTREE_MAX_LEVELS);
+	segmentLimit = static_cast<size_t>(FMath::Max(numSegments, 0));
+	bGeneratingRoads = true;
+	return true;
+}
 
-	while (!priorityQ->empty() && segments.size() < Config::SEGMENT_COUNT_LIMIT) {
-		generationStep(*priorityQ, segments, *qTree, debugData, intersections, *(this->heatmap));
+void ARoadGenerator::AdvanceRoads(double budgetSeconds)
+{
+	GenerationProgress progress = advanceGeneration(*priorityQ, segments, *qTree, debugData, intersections,
+		this->heatmap, context, segmentLimit, budgetSeconds);
+
+	if (progress.finished) {
+		bGeneratingRoads = false;
+		SaveGenerationState();
+		FinishRoads();
 	}
-	/* generation algorithm ends here*/
 
+	OnRoadGenerationProgress.Broadcast(static_cast<int32>(progress.segments), static_cast<int32>(progress.queued), progress.finished);
+}
+
+void ARoadGenerator::CancelRoads()
+{
+	if (!bGeneratingRoads)
+		return;
+
+	ResetGeneration();
+	generationCheckpoint.clear();
+	UE_LOG(LogTemp, Warning, TEXT("Road generation cancelled"));
+}
+
+// Continues the generation loop from the checkpoint of the last generation, the heatmap has to be the same
+bool ARoadGenerator::ExtendRoads(int numSegments)
+{
+	if (generationCheckpoint.empty() || !this->heatmap.isValid()) {
+		UE_LOG(LogTemp, Warning, TEXT("Nothing to extend, create roads without tiles first"));
+		return false;
+	}
+
+	if (!RestoreGenerationState())
+		return false;
+
+	segmentLimit = segments.size() + static_cast<size_t>(FMath::Max(numSegments, 0));
+	advanceGeneration(*priorityQ, segments, *qTree, debugData, intersections, this->heatmap, context, segmentLimit,
+		std::numeric_limits<double>::infinity());
+	SaveGenerationState();
+
+	FinishRoads();
+	return true;
+}
+
+bool ARoadGenerator::SaveCheckpoint(const FString& filePath)
+{
+	if (generationCheckpoint.empty()) {
+		UE_LOG(LogTemp, Warning, TEXT("Nothing to save, create roads without tiles first"));
+		return false;
+	}
+
+	TArray<uint8> data;
+	data.Append(reinterpret_cast<const uint8*>(generationCheckpoint.data()), static_cast<int32>(generationCheckpoint.size()));
+	return FFileHelper::SaveArrayToFile(data, *filePath);
+}
+
+bool ARoadGenerator::LoadCheckpoint(const FString& filePath, FVector regionStart, FVector regionEnd)
+{
+	TArray<uint8> data;
+	if (!FFileHelper::LoadFileToArray(data, *filePath))
+		return false;
+
+	generationCheckpoint.assign(reinterpret_cast<const char*>(data.GetData()), data.Num());
+	if (!RestoreGenerationState()) {
+		UE_LOG(LogTemp, Error, TEXT("%s is not a road generation checkpoint"), *filePath);
+		generationCheckpoint.clear();
+		return false;
+	}
+
+	regionStartPoint = regionStart;
+	regionEndPoint = regionEnd;
+
+	FinishRoads();
+	return true;
+}
+
+void ARoadGenerator::SaveGenerationState()
+{
+	std::ostringstream out(std::ios::binary);
+	saveGenerationCheckpoint(out, *priorityQ, segments, *qTree, context);
+	generationCheckpoint = out.str();
+}
+
+bool ARoadGenerator::RestoreGenerationState()
+{
+	ResetGeneration();
+
+	/* the quadtree gets its bounds from the checkpoint */
+	priorityQ = makePriorityQueue<Segment*>(Config::PRIORITY_QUEUE_TYPE, [](const Segment* s) { return s->t; });
+	qTree = makeSpatialIndex<Segment*>(Bounds{});
+
+	std::istringstream in(generationCheckpoint, std::ios::binary);
+	return loadGenerationCheckpoint(in, *priorityQ, segments, *qTree, context);
+}
+
+void ARoadGenerator::FinishRoads()
+{
 	UE_LOG(LogTemp, Warning, TEXT("Number of segments created: %d"), segments.size());
 
 	// remove conflicting segments
@@ -169,13 +331,14 @@ bool ARoadGenerator::CreateRoads(FVector regionStart, FVector regionEnd, ESTRAIG
 	// check if properly removed
 	PrintConflictingSegments();
 
-	populateSegmentLinks(segments);
-	/* find intersections here */
-	GenerateIntersections(segments, intersections);
+	/* link the segments and find intersections here */
+	weldSegmentEnds(segments, intersections, context);
 
 	UE_LOG(LogTemp, Warning, TEXT("intersections size: %d"), intersections.size());
 
-	return true;
+	GenerationArena::Stats arenaStats = context.arena.getStats();
+	UE_LOG(LogTemp, Warning, TEXT("Generation arena: %llu allocations, %llu bytes in use, peak %llu bytes"),
+		static_cast<uint64>(arenaStats.allocations), static_cast<uint64>(arenaStats.bytesInUse), static_cast<uint64>(arenaStats.peakBytes));
 }
 
 void ARoadGenerator::ShowRoads()
@@ -263,7 +426,7 @@ bool ARoadGenerator::CreateBlocks()
 	// Step 2: Set blueprint objects for visualization
 	this->CityBlocksMaker->SetBlueprints(this->MoreThanFourWayBlueprint, this->CheckBlueprint);
 	// Step 3: Create city graph from intersections and segments
-	graph = this->CityBlocksMaker->MakeGraph(this->intersections, this->segments);
+	graph = this->CityBlocksMaker->MakeGraph(this->intersections, this->segments.pointers());
 	
 	int vertices = graph->vertices.size();
 
@@ -295,15 +458,7 @@ void ARoadGenerator::CreateProceduralMeshForRoads(TArray<FVector> startPoints, T
 /* Transform coordinates from algorithm to unreal engine coordinates and clean outside of region */
 void ARoadGenerator::TransformToUECoordinates(FVector midPoint)
 {
-	for (auto& segment : segments) {
-
-		segment->start = segment->start * 100 + Point(midPoint.X, midPoint.Y);
-		segment->end = segment->end * 100 + Point(midPoint.X, midPoint.Y);
-	}
-
-	for (auto intersection : intersections) {
-		intersection->position = intersection->position * 100 + Point{midPoint.X, midPoint.Y};
-	}
+	transformSegmentsAndIntersections(segments, intersections, *qTree, 100, Point{ midPoint.X, midPoint.Y });
 
 	for (auto vert : graph->vertices) {
 		vert.second->data->position = vert.second->data->position * 100 + Point{midPoint.X, midPoint.Y};
@@ -333,86 +488,7 @@ void ARoadGenerator::RemoveOutsideOfRegion()
 		miny = regionEndPoint.Y;
 	}
 
-	auto isOutside = [minx, maxx, miny, maxy](float x, float y) {
-		return (x > maxx || x < minx || y > maxy || y < miny);
-	};
-
-	// iterate over all segments, select the ones outside of the region
-	// remove it from the branches vector from each of the intersections containing it
-	// then remove the segment itself
-	for (auto it = segments.begin(); it != segments.end();) {
-		auto segment = *it;
-		bool startOutside = isOutside(segment->start.x, segment->start.y);
-		bool endOutside = isOutside(segment->end.x, segment->end.y);
-
-		if (startOutside || endOutside) {
-			// two lambdas to compare start intersectionID and endID to intersectionID //
-			auto cmpStart = [segment](Intersection* intersection) {return segment->startIntersectionID == intersection->ID; };
-			auto cmpEnd = [segment](Intersection* intersection) {return segment->endIntersectionID == intersection->ID; };
-
-			// iterator to find intersection corresponding to segment's start and end
-			std::vector<Intersection*>::iterator it2;
-			
-			// compare the startintersectionID to each intersectionID
-			it2 = std::find_if(intersections.begin(), intersections.end(), cmpStart);
-
-			// erase segment from the branches vector in that intersection
-			if (it2 != intersections.end()) {
-				auto it3 = std::find((*it2)->branches.begin(), (*it2)->branches.end(), segment);
-				if (it3 != (*it2)->branches.end()) {
-					(*it2)->branches.erase(it3);
-				}
-			}
-			
-			// compare the endintersectionID to each intersectionID
-			it2 = std::find_if(intersections.begin(), intersections.end(), cmpEnd);
-
-			// erase segment from the branches vector in that intersection
-			if (it2 != intersections.end()) {
-				auto it3 = std::find((*it2)->branches.begin(), (*it2)->branches.end(), segment);
-				if (it3 != (*it2)->branches.end()) {
-					(*it2)->branches.erase(it3);
-				}
-			}
-		
-			it = segments.erase(it);
-		}
-		else {
-			++it;
-		}
-	}
-
-	// iterate over all intersections and remove the ones outside of the region specified
-	for (auto it = intersections.begin(); it != intersections.end();) {
-		Intersection* intersection = *it;
-		if (isOutside(intersection->position.x, intersection->position.y)) {
-			/*for (auto branch : intersection->branches) {
-				if (branch->startIntersectionID == intersection->ID) {
-					UE_LOG(LogTemp, Warning, TEXT("doing somthing here to start"));
-					branch->startIntersectionID = -1;
-				}
-				if (branch->endIntersectionID == intersection->ID) {
-					UE_LOG(LogTemp, Warning, TEXT("doing somthing here to end"));
-					branch->endIntersectionID = -1;
-				}
-			}*/
-
-			for (auto segment : segments) {
-				if (segment->startIntersectionID == intersection->ID) {
-					segment->startIntersectionID = -1;
-				}
-				if (segment->endIntersectionID == intersection->ID) {
-					segment->endIntersectionID = -1;
-				}
-			}
-			//UE_LOG(LogTemp, Warning, TEXT("OUTSIDE OF REGION: %d"), intersection->ID);
-			it = intersections.erase(it);
-		}
-		else {
-			++it;
-		}
-	}
-
+	removeOutsideOfRegion(segments, intersections, *qTree, minx, maxx, miny, maxy);
 }
 
 
@@ -493,10 +569,15 @@ void ARoadGenerator::RoadSegmentsToStartAndEndPoints(TArray<FVector>& startPoint
 	endPoints.Empty();
 	roadData.Empty();
 
-	for (auto segment : this->segments) {
-		startPoints.Add(*(new FVector(segment->start.x,  segment->start.y, z + segment->startOrder * 5))); // add 5cm for each order
-		endPoints.Add(*(new FVector(segment->end.x, segment->end.y, z + segment->endOrder * 5))); // add 5cm for each order
-		roadData.Add(FMetaRoadData{ segment->q.highway, static_cast<float>(segment->width)  * 100});
+	const int32 num = static_cast<int32>(segments.size());
+	startPoints.Reserve(num);
+	endPoints.Reserve(num);
+	roadData.Reserve(num);
+
+	for (SegmentHandle h = 0; h < segments.size(); h++) {
+		startPoints.Add(FVector(segments.startX[h], segments.startY[h], z + segments.startOrder[h] * 5)); // add 5cm for each order
+		endPoints.Add(FVector(segments.endX[h], segments.endY[h], z + segments.endOrder[h] * 5)); // add 5cm for each order
+		roadData.Add(FMetaRoadData{ segments.isHighway(h), static_cast<float>(segments.width[h]) * 100 });
 
 	}
 }
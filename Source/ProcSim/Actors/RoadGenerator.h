@@ -19,6 +19,9 @@
 #include "Engine/StaticMeshActor.h"
 #include "RoadGenerator.generated.h"
 
+/* Reported after every slice of a time-sliced generation, and once more when it is finished */
+DECLARE_DYNAMIC_MULTICAST_DELEGATE_ThreeParams(FRoadGenerationProgress, int32, SegmentsAccepted, int32, SegmentsQueued, bool, bFinished);
+
 UCLASS()
 class PROCSIM_API ARoadGenerator : public AActor
 {
@@ -38,6 +41,38 @@ public:
 	UFUNCTION(BlueprintCallable, Category = "RoadGenerator")
 	bool CreateRoads(FVector regionStart, FVector regionEnd, ESTRAIGHTNESS straightness, int numSegments);
 
+	/* Start creating roads in the background: every Tick grows them for GenerationBudgetMs, OnRoadGenerationProgress
+	reports how far it is. Tiled generations are done at once */
+	UFUNCTION(BlueprintCallable, Category = "RoadGenerator")
+	bool StartRoads(FVector regionStart, FVector regionEnd, ESTRAIGHTNESS straightness, int numSegments);
+
+	/* Stop a generation started with StartRoads, everything generated so far is thrown away */
+	UFUNCTION(BlueprintCallable, Category = "RoadGenerator")
+	void CancelRoads();
+
+	/* True while a generation started with StartRoads is still growing */
+	UFUNCTION(BlueprintCallable, Category = "RoadGenerator")
+	bool IsGeneratingRoads() const { return bGeneratingRoads; }
+
+	/* Milliseconds of each frame a generation started with StartRoads may take */
+	UPROPERTY(EditAnywhere, Category = "RoadGenerator")
+	float GenerationBudgetMs = 8.0f;
+
+	UPROPERTY(BlueprintAssignable, Category = "RoadGenerator")
+	FRoadGenerationProgress OnRoadGenerationProgress;
+
+	/* Grow the roads of the last generation by numSegments more segments, continuing where it stopped */
+	UFUNCTION(BlueprintCallable, Category = "RoadGenerator")
+	bool ExtendRoads(int numSegments);
+
+	/* Write the state of the last generation to a file, so it can be extended in another session */
+	UFUNCTION(BlueprintCallable, Category = "RoadGenerator")
+	bool SaveCheckpoint(const FString& filePath);
+
+	/* Restore a generation saved with SaveCheckpoint into the region, it can be shown or extended afterwards */
+	UFUNCTION(BlueprintCallable, Category = "RoadGenerator")
+	bool LoadCheckpoint(const FString& filePath, FVector regionStart, FVector regionEnd);
+
 	/* Show Roads after everything is done */
 	UFUNCTION(BlueprintCallable, Category = "RoadGenerator")
 	void ShowRoads();
@@ -77,6 +112,33 @@ public:
 	/* This function is used to print whether there are segments intersecting with eachother (there shouldnt be)*/
 	void PrintConflictingSegments();
 
+	/* Frees everything created by the previous generation */
+	void ResetGeneration();
+
+	/* Checkpoints the generation loop into generationCheckpoint, before the network is cleaned up */
+	void SaveGenerationState();
+
+	/* Replaces the generation with the one in generationCheckpoint */
+	bool RestoreGenerationState();
+
+	/* Removes conflicting segments and finds the intersections once the generation loop is done */
+	void FinishRoads();
+
+	/* Runs the generation loop for budgetSeconds, finishes the roads when the loop is done */
+	void AdvanceRoads(double budgetSeconds);
+
+	/* Large maps are generated in TilesPerSide * TilesPerSide tiles on all cores, 1 generates on the game thread */
+	UPROPERTY(EditAnywhere, Category = "RoadGenerator")
+	int TilesPerSide = 1;
+
+	/* Seed of the random numbers of the generation, the same seed, heatmap and settings give the same roads */
+	UPROPERTY(EditAnywhere, Category = "RoadGenerator", meta = (EditCondition = "!bRandomSeed"))
+	int32 Seed = 1;
+
+	/* Draw a new Seed for every generation, so every click gives a new network. The seed drawn is kept in Seed */
+	UPROPERTY(EditAnywhere, Category = "RoadGenerator")
+	bool bRandomSeed = true;
+
 	//UPROPERTY(EditAnywhere, Category = "RoadGenerator")
 	TSubclassOf<AActor> RoadBlueprint;
 
@@ -91,16 +153,22 @@ public:
 	TSubclassOf<AActor> CheckBlueprint;
 
 
-	UPROPERTY()
-	TArray<uint8> pixels;
-
 	FVector regionStartPoint, regionEndPoint;
-	Heatmap* heatmap = nullptr;
+	/* shared by the generation steps and the heatmap texture, never copied */
+	HeatmapView heatmap;
 	PriorityQueue<Segment*>* priorityQ = nullptr;
 	DebugData debugData;
-	Quadtree<Segment*>* qTree = nullptr;
-	std::vector<Segment*> segments;
+	SpatialIndex<Segment*>* qTree = nullptr;
+	/* settings, arena, IDs and random numbers of the current generation, nothing is shared with other generators */
+	GenerationContext context;
+	/* accepted segments, hot fields in contiguous arrays */
+	SegmentStore segments;
 	std::vector<Intersection*> intersections;
+	/* the generation loop as it was when it stopped, empty after a tiled generation since that can't be continued */
+	std::string generationCheckpoint;
+	/* a generation started with StartRoads is growing, segmentLimit is where it stops */
+	bool bGeneratingRoads = false;
+	size_t segmentLimit = 0;
 	AProceduralMeshMaker* ProceduralMeshMaker = nullptr;
 	ACityBlocksMaker* CityBlocksMaker = nullptr;
 	Graph<GraphVertex*>* graph;
@@ -109,6 +177,9 @@ public:
 	// Sets default values for this actor's properties
 	ARoadGenerator();
 
+	// Called every frame
+	virtual void Tick(float DeltaTime) override;
+
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
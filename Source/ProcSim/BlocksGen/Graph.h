@@ -5,6 +5,11 @@
 #include <string>
 #include <set>
 #include <unordered_set>
+#include <vector>
+#include <limits>
+
+#include "ProcSim/MapGen/Math.h"
+#include "ProcSim/MapGen/Log.h"
 
 enum Color { WHITE, GRAY, BLACK };
 
@@ -40,7 +45,7 @@ public:
 	// adds edges in both directions
 	bool AddEdge(const int id1, const int id2) {
 		if (id1 == id2 || vertices.find(id1) == vertices.end() || vertices.find(id2) == vertices.end()) {
-			UE_LOG(LogTemp, Error, TEXT("ERROR ADDING EDGE"));
+			PROCSIM_LOG(Error, "ERROR ADDING EDGE");
 			return false;
 		}
 
@@ -52,7 +57,7 @@ public:
 	// removes edge
 	bool RemoveEdge(const int id1, const int id2) {
 		if (id1 == id2 || vertices.find(id1) == vertices.end() || vertices.find(id2) == vertices.end()) {
-			UE_LOG(LogTemp, Error, TEXT("ERROR REMOVING EDGE"));
+			PROCSIM_LOG(Error, "ERROR REMOVING EDGE");
 			return false;
 		}
 
@@ -67,11 +72,11 @@ public:
 		vertices.clear();
 
 		// adding the nodes
-		for (int i = 0; i < datas.size(); i++) {
+		for (int i = 0; i < static_cast<int>(datas.size()); i++) {
 			this->AddNode(datas[i]->ID, datas[i]);
 		}
 		// adding the edges of the cycle
-		for (int i = 0; i < datas.size(); i++) {
+		for (int i = 0; i < static_cast<int>(datas.size()); i++) {
 			this->AddEdge(datas[i]->ID, datas[(i + 1) % datas.size()]->ID);
 		}
 	}
@@ -82,14 +87,14 @@ public:
 		int minIdInd = 0;
 
 		//start traversing the face at the minimum id, since same faces may have different starting indices
-		for (int i = 0; i < face.size(); i++) {
+		for (int i = 0; i < static_cast<int>(face.size()); i++) {
 			if (face[i] < minId) {
 				minId = face[i];
 				minIdInd = i;
 			}
 		}
 
-		for (int i = minIdInd; i < minIdInd + face.size(); i++) {
+		for (int i = minIdInd; i < minIdInd + static_cast<int>(face.size()); i++) {
 			int toAdd = face[i % face.size()];
 			res += (std::to_string(toAdd) + ",");
 		}
@@ -101,35 +106,36 @@ public:
 	int getMostCCW(int v, std::vector<int> candidates, Point prevEdge) {
 		Point v_p = this->vertices[v]->data->position;
 		int mostCC = -1;
-		float minA = std::numeric_limits<float>::max();
+		// the angles are compared by their cosines, the larger the angle the smaller its cosine
+		double mostCCCosine = 2;
 
 		int colinear = -1;
 
 		int leastClockwise = -1;
-		float maxA = -std::numeric_limits<float>::max();
+		double leastClockwiseCosine = -2;
 
-		for (int i = 0; i < candidates.size(); i++) {
+		for (int i = 0; i < static_cast<int>(candidates.size()); i++) {
 			Point v_cand = this->vertices[candidates[i]]->data->position;
 			Point nextEdge = v_cand - v_p;
-			int orient = FMath::Sign(Math::crossProduct(prevEdge, nextEdge));
+			int orient = Math::sign(Math::crossProduct(prevEdge, nextEdge));
 			prevEdge = prevEdge / prevEdge.length();
 			nextEdge = nextEdge / nextEdge.length();
 
 			//angle represents angle we have to rotate prevedge to get to nextedge, 
 			//represents clockwise or ccw respective to orientation
 			//so if orientation is -1, want the most counter clockwise rotated
-			float a = Math::angleBetween(prevEdge, nextEdge);
+			double cosine = Math::dotProduct(prevEdge, nextEdge);
 
-			if (orient == -1 && maxA < a) {
+			if (orient == -1 && cosine < mostCCCosine) {
 				mostCC = candidates[i];
-				maxA = a;
+				mostCCCosine = cosine;
 			}
 			else if (orient == 0) {
 				colinear = candidates[i];
 			}
-			else if (orient == +1 && minA > a) {
+			else if (orient == +1 && cosine > leastClockwiseCosine) {
 				leastClockwise = candidates[i];
-				minA = a;
+				leastClockwiseCosine = cosine;
 			}
 		}
 
@@ -150,7 +156,7 @@ public:
 		bool ccw = false;
 		if (face.size() > 2) {
 			float orient = 0;
-			for (int i = 0; i < face.size(); i++) {
+			for (int i = 0; i < static_cast<int>(face.size()); i++) {
 				Point p1 = this->vertices[face[i]]->data->position;
 				Point p2 = this->vertices[face[(i + 1) % face.size()]]->data->position;
 				orient += (p2.x - p1.x) * (p2.y + p1.y);
@@ -2,52 +2,58 @@
 
 #include "ProcSim/BlocksGen/Graph.h"
 #include "ProcSim/BlocksGen/GraphVertex.h"
+#include "ProcSim/MapGen/BatchMath.h"
 #include "ProcSim/MapGen/MapGen.h"
+#include "ProcSim/MapGen/Log.h"
 
+#include <cmath>
 #include <limits>
+#include <random>
+#include <tuple>
+#include <vector>
 
 class BoundingBox2D {
 
 private:
-	FVector2D minCorner, maxCorner;
+	Point minCorner, maxCorner;
 
 public:
 
 	BoundingBox2D(float minX, float maxX, float minY, float maxY) {
-		this->minCorner = FVector2D{ minX, minY };
-		this->maxCorner = FVector2D{ maxX, maxY };
+		this->minCorner = Point{ minX, minY };
+		this->maxCorner = Point{ maxX, maxY };
 	}
 
-	FVector2D getSize() {
-		return FVector2D{ FMath::Abs(this->maxCorner[0] - this->minCorner[0]), FMath::Abs(this->maxCorner[1] - this->minCorner[1]) };
+	Point getSize() {
+		return Point{ std::abs(this->maxCorner.x - this->minCorner.x), std::abs(this->maxCorner.y - this->minCorner.y) };
 	}
 
 	float getArea() {
-		return FMath::Abs(this->maxCorner[0] - this->minCorner[0]) * FMath::Abs(this->maxCorner[1] - this->minCorner[1]);
+		return std::abs(this->maxCorner.x - this->minCorner.x) * std::abs(this->maxCorner.y - this->minCorner.y);
 	}
 
-	FVector2D getCenter() {
-		float x = this->minCorner[0] + FMath::Abs(this->maxCorner[0] - this->minCorner[0]) * 0.5;
-		float y = this->minCorner[1] + FMath::Abs(this->maxCorner[1] - this->minCorner[1]) * 0.5;
+	Point getCenter() {
+		float x = this->minCorner.x + std::abs(this->maxCorner.x - this->minCorner.x) * 0.5;
+		float y = this->minCorner.y + std::abs(this->maxCorner.y - this->minCorner.y) * 0.5;
 
-		return FVector2D{ x,y };
+		return Point{ x,y };
 	}
 
-	void fromFVectorList(TArray<FVector> face) {
+	void fromPointList(const std::vector<Point>& face) {
 		float minX = std::numeric_limits<float>::max();
 		float maxX = -std::numeric_limits<float>::max();
 		float minY = std::numeric_limits<float>::max();
 		float maxY = -std::numeric_limits<float>::max();
 
-		for (int i = 0; i < face.Num(); i++) {
-			minX = FMath::Min(face[i].X, minX);
-			maxX = FMath::Max(face[i].X, maxX);
-			minY = FMath::Min(face[i].Y, minY);
-			maxY = FMath::Max(face[i].Y, maxY);
+		for (int i = 0; i < static_cast<int>(face.size()); i++) {
+			minX = std::min(static_cast<float>(face[i].x), minX);
+			maxX = std::max(static_cast<float>(face[i].x), maxX);
+			minY = std::min(static_cast<float>(face[i].y), minY);
+			maxY = std::max(static_cast<float>(face[i].y), maxY);
 		}
 
-		this->minCorner = FVector2D{ minX, minY };
-		this->maxCorner = FVector2D{ maxX, maxY };
+		this->minCorner = Point{ minX, minY };
+		this->maxCorner = Point{ maxX, maxY };
 	}
 
 };
@@ -55,72 +61,72 @@ public:
 class OrientedBoundingBox2D {
 	
 public:
-	FVector2D pos; // center point
+	Point pos; // center point
 	float rot_angle;
-	FVector2D extents;
-	FVector2D long_axis;
-	FVector2D short_axis;
-	TArray<FVector2D> corners;
+	Point extents;
+	Point long_axis;
+	Point short_axis;
+	std::vector<Point> corners;
 
 	OrientedBoundingBox2D() {
-		this->pos = FVector2D{};
+		this->pos = Point{};
 		this->rot_angle = 0.0f;
-		this->extents = FVector2D{};
-		this->long_axis = FVector2D{};
-		this->short_axis = FVector2D{};
-		this->corners = TArray<FVector2D>{};
+		this->extents = Point{};
+		this->long_axis = Point{};
+		this->short_axis = Point{};
+		this->corners = std::vector<Point>{};
 	}
 
 	float getArea() {
-		return this->extents.X * this->extents.Y;
+		return this->extents.x * this->extents.y;
 	}
 
 	// this function transforms corners on unit box to OBB box
 	// e.g: input: {-0.5,-0.5} --> output: bottom left corner on OBB
-	FVector2D transformPoint(FVector2D p) {
-		float deltaX = this->pos.X;
-		float deltaY = this->pos.Y;
+	Point transformPoint(Point p) {
+		float deltaX = this->pos.x;
+		float deltaY = this->pos.y;
 		float theta = this->rot_angle; // TODO: check -this->rot_angle; 
-		float Sx = this->extents.X;
-		float Sy = this->extents.Y;
+		float Sx = this->extents.x;
+		float Sy = this->extents.y;
 
-		float xx = Sx * FMath::Cos(theta) * p.X - Sy * FMath::Sin(theta) * p.Y + deltaX;
-		float yy = Sx * FMath::Sin(theta) * p.X + Sy * FMath::Cos(theta) * p.Y + deltaY;
+		float xx = Sx * std::cos(theta) * p.x - Sy * std::sin(theta) * p.y + deltaX;
+		float yy = Sx * std::sin(theta) * p.x + Sy * std::cos(theta) * p.y + deltaY;
 
-		return FVector2D{ xx,yy };
+		return Point{ xx,yy };
 	}
 
 	void getCorners() {
-		this->corners = TArray<FVector2D>{};
+		this->corners = std::vector<Point>{};
 
 		// clockwise from bottom left
-		FVector2D p1{ -0.5f, -0.5f };
-		FVector2D p2{ -0.5f, 0.5f };
-		FVector2D p3{ 0.5f, 0.5f };
-		FVector2D p4{ 0.5f, -0.5f };
+		Point p1{ -0.5f, -0.5f };
+		Point p2{ -0.5f, 0.5f };
+		Point p3{ 0.5f, 0.5f };
+		Point p4{ 0.5f, -0.5f };
 	
 		p1 = transformPoint(p1);
 		p2 = transformPoint(p2);
 		p3 = transformPoint(p3);
 		p4 = transformPoint(p4);
 
-		this->corners.Add(p1);
-		this->corners.Add(p2);
-		this->corners.Add(p3);
-		this->corners.Add(p4);
+		this->corners.push_back(p1);
+		this->corners.push_back(p2);
+		this->corners.push_back(p3);
+		this->corners.push_back(p4);
 
 	}
 
 	void getAxes() {
-		FVector2D p1 = this->corners[0];
-		FVector2D p2 = this->corners[1];
-		FVector2D p3 = this->corners[2];
+		Point p1 = this->corners[0];
+		Point p2 = this->corners[1];
+		Point p3 = this->corners[2];
 
-		float p1p2 = FVector2D::Distance(p1, p2);
-		float p2p3 = FVector2D::Distance(p2, p3);
+		float p1p2 = Math::length(p1, p2);
+		float p2p3 = Math::length(p2, p3);
 
-		FVector2D dir{};
-		FVector2D ortho{};
+		Point dir{};
+		Point ortho{};
 
 		if (p1p2 < p2p3) {
 			dir = p2 - p1;
@@ -131,61 +137,61 @@ public:
 			ortho = p2 - p1;
 		}
 
-		dir.Normalize();
-		ortho.Normalize();
+		dir = dir.normalized();
+		ortho = ortho.normalized();
 
 		this->short_axis = dir;
 		this->long_axis = ortho;
 	}
 
 	// takes a face as input e.g: {1,10,20,30,1} and finds its obb
-	void getMinimumFromFace(TArray<FVector> face) {
+	void getMinimumFromFace(const std::vector<Point>& face) {
 		float minArea = std::numeric_limits<float>::max();
 		BoundingBox2D bb(0, 0, 0, 0);
-		bb.fromFVectorList(face);
-		FVector2D center = bb.getCenter();
+		bb.fromPointList(face);
+		Point center = bb.getCenter();
 		this->pos = center;
-		for (int i = 0; i < face.Num(); i++) {
-			FVector2D p1{ face[i].X, face[i].Y };
-			FVector2D p2{ face[(i+1)%face.Num()].X, face[(i + 1) % face.Num()].Y};
-			FVector2D e1 = p2 - p1;
+		for (int i = 0; i < static_cast<int>(face.size()); i++) {
+			Point p1 = face[i];
+			Point p2 = face[(i + 1) % face.size()];
+			Point e1 = p2 - p1;
 
-			UE_LOG(LogTemp, Warning, TEXT("p1: {%f, %f}, p2: {%f, %f}"), p1.X, p1.Y, p2.X, p2.Y);
+			PROCSIM_LOG(Verbose, "p1: {%f, %f}, p2: {%f, %f}", p1.x, p1.y, p2.x, p2.y);
 
-			e1.Normalize();
+			e1 = e1.normalized();
 
-			FVector2D dir = e1;
+			Point dir = e1;
 
-			FVector2D xAxis{ 1,0 };
+			Point xAxis{ 1,0 };
 
 			
-			int o = FMath::Sign(-dir.Y); // TODO: check  FMath::Sign(-dir.Y);
-			float d = FVector2D::DotProduct(dir, xAxis);
+			int o = Math::sign(-dir.y); // TODO: check  Math::sign(-dir.y);
+			float d = Math::dotProduct(dir, xAxis);
 
-			float angle = FMath::Acos(d);
+			float angle = std::acos(d);
 
 			if (o == -1)
 				angle *= -1;
 
 			// rotate the face to be in the space of edge
-			TArray<FVector> rotated{};
+			std::vector<Point> rotated{};
 
-			for (int j = 0; j < face.Num(); j++) {
-				FVector c1{ face[j].X, face[j].Y, 0.0f };
+			for (int j = 0; j < static_cast<int>(face.size()); j++) {
+				Point c1 = face[j];
 				// rotate
-				float c1x = c1.X - center.X;
-				float c1y = c1.Y - center.Y;
-				float sinC = FMath::Sin(angle);
-				float cosC = FMath::Cos(angle);
+				float c1x = c1.x - center.x;
+				float c1y = c1.y - center.y;
+				float sinC = std::sin(angle);
+				float cosC = std::cos(angle);
 
-				c1.X = c1x * cosC - c1y * sinC + center.X;
-				c1.Y = c1x * sinC + c1y * cosC + center.Y;
+				c1.x = c1x * cosC - c1y * sinC + center.x;
+				c1.y = c1x * sinC + c1y * cosC + center.y;
 				// rotated
-				rotated.Add(c1);
+				rotated.push_back(c1);
 			}
 
 			BoundingBox2D curBB(0, 0, 0, 0);
-			curBB.fromFVectorList(rotated);
+			curBB.fromPointList(rotated);
 			float currArea = curBB.getArea();
 			if (currArea < minArea) {
 				this->extents = curBB.getSize();
@@ -208,6 +214,10 @@ inline std::vector<std::tuple<Point, GraphVertex*, GraphVertex*, float>> getAllE
 	std::vector<std::tuple<Point, GraphVertex*, GraphVertex*, float>> res{}; // intersections
 	std::unordered_set<GraphVertex*> visited{};
 
+	// the edges to test are collected first and tested against the segment all at once
+	std::vector<std::pair<GraphVertex*, GraphVertex*>> edges{};
+	CandidateBlock block;
+
 	for (auto vert : graph->vertices) {
 		GraphVertex* v1 = vert.second->data;
 		std::unordered_set<GraphVertex*> neighbors{};
@@ -219,17 +229,8 @@ inline std::vector<std::tuple<Point, GraphVertex*, GraphVertex*, float>> getAllE
 			for (auto v2 : neighbors) {
 				if (v2->position.x != s1.position.x || v2->position.y != s1.position.y) {
 					if (!visited.count(v2)) {
-						Segment* seg1 = new Segment(s1.position, s2.position);
-						Segment* seg2 = new Segment(v1->position, v2->position);
-
-						auto intersct = seg1->intersectWith(seg2);
-						if (intersct != nullptr) {
-							Point resPoint{ intersct->x, intersct->y };
-							float dist = sqrt((resPoint.x - s1.position.x) * (resPoint.x - s1.position.x) +
-								(resPoint.y - s1.position.y) * (resPoint.y - s1.position.y));
-
-							res.push_back(std::tuple<Point, GraphVertex*, GraphVertex*, float>{resPoint, v1, v2, dist});
-						}
+						edges.push_back({ v1, v2 });
+						block.push(v1->position, v2->position);
 					}
 				}
 			}
@@ -240,6 +241,18 @@ inline std::vector<std::tuple<Point, GraphVertex*, GraphVertex*, float>> getAllE
 	}
 
 
+	CandidateTests tests;
+	BatchMath::intersectAll(s1.position, s2.position, block, tests);
+	for (size_t i = 0; i < edges.size(); i++) {
+		if (tests.crosses[i]) {
+			Point resPoint{ tests.crossX[i], tests.crossY[i] };
+			float dist = sqrt((resPoint.x - s1.position.x) * (resPoint.x - s1.position.x) +
+				(resPoint.y - s1.position.y) * (resPoint.y - s1.position.y));
+
+			res.push_back(std::tuple<Point, GraphVertex*, GraphVertex*, float>{resPoint, edges[i].first, edges[i].second, dist});
+		}
+	}
+
 	return res;
 }
 
@@ -262,9 +275,11 @@ public:
 	bool street_access = false;
 	bool flag = false;
 	bool has_street_vert = false;
+	/* IDs of the vertices the parcel creates, shared by every parcel split from the same city graph */
+	IdAllocator* vertexIDs;
 
-	// construct parcel from nodes
-	Parcel(std::vector<GraphVertex*> nodes) {
+	// construct parcel from nodes, new vertices get their IDs from vertexIDs
+	Parcel(std::vector<GraphVertex*> nodes, IdAllocator& vertexIDs) : vertexIDs(&vertexIDs) {
 		this->graph = new Graph<GraphVertex*>;
 		this->graph->FromFace(nodes);
 		this->face = nodes;
@@ -272,7 +287,7 @@ public:
 	}
 
 	// copy constructor
-	Parcel(const Parcel& other) {
+	Parcel(const Parcel& other) : vertexIDs(other.vertexIDs) {
 		this->graph = new Graph<GraphVertex*>();
 		this->graph->FromFace(other.face);
 		this->face = other.face;
@@ -282,24 +297,24 @@ public:
 
 	// getOBB
 	void getOBB() {
-		this->obb = *(new OrientedBoundingBox2D());
+		this->obb = OrientedBoundingBox2D();
 		if (this->face.size() > 0) {
-			TArray<FVector> faceVectors{};
-			for (int i = 0; i < this->face.size(); i++) {
-				faceVectors.Add(FVector{ float(this->face[i]->position.x), float(this->face[i]->position.y), 0.0 });
+			std::vector<Point> facePoints{};
+			for (int i = 0; i < static_cast<int>(this->face.size()); i++) {
+				facePoints.push_back(Point{ float(this->face[i]->position.x), float(this->face[i]->position.y) });
 			}
-			this->obb.getMinimumFromFace(faceVectors);
+			this->obb.getMinimumFromFace(facePoints);
 		}
 	}
 
 	// insetParcelUniformXY
 	void insetParcelUniformXY(float inset, float limit = 0.06) {
-		FVector2D center = this->obb.pos;
+		Point center = this->obb.pos;
 		std::vector<GraphVertex*> inset_arr{};
 
-		for (int i = 0; i < this->face.size(); i++) {
+		for (int i = 0; i < static_cast<int>(this->face.size()); i++) {
 			
-			float dist = FVector2D::Distance(FVector2D{ float(this->face[i]->position.x),
+			float dist = Math::length(Point{ float(this->face[i]->position.x),
 				float(this->face[i]->position.y) }, center);
 
 			float clamp_inset = std::min(inset, dist - limit); // this means dont get closer than the limit
@@ -307,75 +322,61 @@ public:
 			int prev = i == 0 ? this->face.size() - 1 : (i - 1);
 			int next = (i + 1) % this->face.size();
 
-			FVector zAxis{ 0.0,0.0,-1.0 };
+			// the edges lie in the xy plane, crossing them with the -z axis gives their perpendicular
+			const double zAxis = -1.0;
 
 			// get the perpendicular directions for inset
 			Point prevEdgePoint = this->face[i]->position - this->face[prev]->position;
-			FVector prevEdge{ float(prevEdgePoint.x), float(prevEdgePoint.y), 0.0 };
-			prevEdge.Normalize();
+			Point prevEdge = Point{ float(prevEdgePoint.x), float(prevEdgePoint.y) }.normalized();
 
-			FVector prevPerp = FVector::CrossProduct(prevEdge, zAxis);
-			prevPerp.Normalize();
+			Point prevPerp = Math::crossWithZ(prevEdge, zAxis).normalized();
 
 			//
 			Point nextEdgePoint = this->face[next]->position - this->face[i]->position;
-			FVector nextEdge{ float(nextEdgePoint.x), float(nextEdgePoint.y), 0.0 };
-			nextEdge.Normalize();
+			Point nextEdge = Point{ float(nextEdgePoint.x), float(nextEdgePoint.y) }.normalized();
 
-			FVector nextPerp = FVector::CrossProduct(nextEdge, zAxis);
-			nextPerp.Normalize();
+			Point nextPerp = Math::crossWithZ(nextEdge, zAxis).normalized();
 
 			//
 			float tol = 0.0;
 
 			Point p1 = this->face[prev]->position;
-			p1 = p1 + Point{prevPerp.X, prevPerp.Y} *(-clamp_inset);
-			p1 = p1 + Point{prevEdge.X, prevEdge.Y} *(-tol);
+			p1 = p1 + prevPerp *(-clamp_inset);
+			p1 = p1 + prevEdge *(-tol);
 
 
 			Point p2 = this->face[i]->position;
-			p2 = p2 + Point{prevPerp.X, prevPerp.Y} *(-clamp_inset);
-			p2 = p2 + Point{prevEdge.X, prevEdge.Y} *(tol);
+			p2 = p2 + prevPerp *(-clamp_inset);
+			p2 = p2 + prevEdge *(tol);
 
 
 			Point p3 = this->face[i]->position;
-			p3 = p3 + Point{nextPerp.X, nextPerp.Y} *(-clamp_inset);
-			p3 = p3 + Point{nextEdge.X, nextEdge.Y} *(-tol);
+			p3 = p3 + nextPerp *(-clamp_inset);
+			p3 = p3 + nextEdge *(-tol);
 
 
 			Point p4 = this->face[next]->position;
-			p4 = p4 + Point{nextPerp.X, nextPerp.Y} *(-clamp_inset);
-			p4 = p4 + Point{nextEdge.X, nextEdge.Y} *(+tol);
+			p4 = p4 + nextPerp *(-clamp_inset);
+			p4 = p4 + nextEdge *(+tol);
 
 
 			bool colinear = areFourPointsCollinear(p1, p2, p3, p4);
 
-			Segment* seg1 = new Segment(p1, p2);
-			Segment* seg2 = new Segment(p3, p4);
-
-			auto intersct = seg1->intersectWith(seg2);
+			auto intersct = Math::doLineSegmentsIntersect(p1, p2, p3, p4, true);
 			Point isect{};
-			if (intersct != nullptr) {
+			if (intersct) {
 				isect.x = intersct->x;
 				isect.y = intersct->y;
 			}
 
-			if (colinear) {
-				isect = this->face[i]->position + Point{prevPerp.X, prevPerp.Y} *(-clamp_inset);
-				intersct = new LineSegmentIntersection();
-			}
-			else {
-				if (intersct == nullptr) {
-					isect = this->face[i]->position + Point{prevPerp.X, prevPerp.Y} *(-clamp_inset);
-					intersct = new LineSegmentIntersection();
-				}
+			// parallel or non-intersecting edges are inset along the previous edge's normal
+			if (colinear || !intersct) {
+				isect = this->face[i]->position + prevPerp *(-clamp_inset);
 			}
 
-			if (intersct != nullptr) {
-				Intersection* temp = new Intersection(std::vector<Segment*>{}, isect);
-				inset_arr.push_back(new GraphVertex(temp->position, temp->ID));
-				UE_LOG(LogTemp, Warning, TEXT("Adding: #%d(%f,%f)"), temp->ID, temp->position.x, temp->position.y);
-			}
+			int id = vertexIDs->next();
+			inset_arr.push_back(new GraphVertex(isect, id));
+			PROCSIM_LOG(Verbose, "Adding: #%d(%f,%f)", id, isect.x, isect.y);
 		}
 
 		this->face = inset_arr;
@@ -384,11 +385,11 @@ public:
 
 	// w: pivot offset from midpoint at which to split; fraction of long axis length
 	void splitOBB(float w = 0.0) {
-		w *= std::max(this->obb.extents[0], this->obb.extents[1]);
+		w *= std::max(this->obb.extents.x, this->obb.extents.y);
 
-		FVector2D midpt{ this->obb.pos[0], this->obb.pos[1] };
-		FVector2D dir3{ this->obb.short_axis[0], this->obb.short_axis[1] };
-		FVector2D ortho3{ this->obb.long_axis[0], this->obb.long_axis[1] };
+		Point midpt = this->obb.pos;
+		Point dir3 = this->obb.short_axis;
+		Point ortho3 = this->obb.long_axis;
 
 		midpt = midpt + ortho3 * w;
 		this->splitAtPointAlong(midpt, dir3);
@@ -397,28 +398,25 @@ public:
 
 	// splitOBBSym
 	void splitOBBSym(float w = 0.0) {
-		w *= std::max(this->obb.extents[0], this->obb.extents[1]);
-		FVector2D midpt{ this->obb.pos[0], this->obb.pos[1] };
-		FVector2D dir3{ this->obb.short_axis[0], this->obb.short_axis[1] };
-		FVector2D ortho3{ this->obb.long_axis[0], this->obb.long_axis[1] };
+		w *= std::max(this->obb.extents.x, this->obb.extents.y);
+		Point midpt = this->obb.pos;
+		Point dir3 = this->obb.short_axis;
+		Point ortho3 = this->obb.long_axis;
 
-		FVector2D m1 = midpt + ortho3 * w;
+		Point m1 = midpt + ortho3 * w;
 		this->splitAtPointAlong(m1, dir3);
 
-		FVector2D m2 = midpt + ortho3 * (-w);
+		Point m2 = midpt + ortho3 * (-w);
 		this->splitAtPointAlong(m2, dir3);
 	}
 
 	// splitAtPointAlong
-	void splitAtPointAlong(FVector2D midpt, FVector2D dir) {
-		FVector2D m1 = midpt + dir * 100000.0;
-		FVector2D m2 = midpt + dir * -100000.0;
-
-		Intersection* temp1 = new Intersection(std::vector<Segment*>{}, Point{ m1.X, m1.Y });
-		Intersection* temp2 = new Intersection(std::vector<Segment*>{}, Point{ m2.X, m2.Y });
+	void splitAtPointAlong(Point midpt, Point dir) {
+		Point m1 = midpt + dir * 100000.0;
+		Point m2 = midpt + dir * -100000.0;
 
-		GraphVertex s1 = *(new GraphVertex(temp1->position, temp1->ID));
-		GraphVertex s2 = *(new GraphVertex(temp2->position, temp2->ID));
+		GraphVertex s1(m1, vertexIDs->next());
+		GraphVertex s2(m2, vertexIDs->next());
 
 		this->splitAlong(s1, s2);
 	}
@@ -439,16 +437,14 @@ public:
 			return;
 		}
 
-		for (int i = 0; i < isects.size() - 1; i += 2) {
+		for (int i = 0; i < static_cast<int>(isects.size()) - 1; i += 2) {
 			std::tuple<Point, GraphVertex*, GraphVertex*, float> i1 = isects[i];
 			std::tuple<Point, GraphVertex*, GraphVertex*, float> i2 = isects[i + 1];
 
-			Intersection* temp1 = new Intersection(std::vector<Segment*>{}, Point{ std::get<Point>(i1) });
-			GraphVertex* v1 = new GraphVertex(temp1->position, temp1->ID);
+			GraphVertex* v1 = new GraphVertex(std::get<Point>(i1), vertexIDs->next());
 			splitEdge(std::get<1>(i1), std::get<2>(i1), v1, this->graph);
 
-			Intersection* temp2 = new Intersection(std::vector<Segment*>{}, Point{ std::get<Point>(i2) });
-			GraphVertex* v2 = new GraphVertex(temp2->position, temp2->ID);
+			GraphVertex* v2 = new GraphVertex(std::get<Point>(i2), vertexIDs->next());
 			splitEdge(std::get<1>(i2), std::get<2>(i2), v2, this->graph);
 
 			this->graph->AddEdge(v1->ID, v2->ID);
@@ -457,14 +453,16 @@ public:
 
 	// hasStreetAccess
 	void hasStreetAccess(std::vector<GraphVertex*> streets) {
-		for (int j = 0; j < this->face.size(); j++) {
+		for (int j = 0; j < static_cast<int>(this->face.size()); j++) {
 			std::vector<GraphVertex*> f = this->face;
-			Segment* s1 = new Segment(f[j]->position, f[(j + 1) % f.size()]->position);
+			Point s1Start = f[j]->position;
+			Point s1End = f[(j + 1) % f.size()]->position;
 
-			for (int ff = 0; ff < streets.size(); ff++) {
-				Segment* s2 = new Segment(streets[ff]->position, streets[(ff + 1) % streets.size()]->position);
+			for (int ff = 0; ff < static_cast<int>(streets.size()); ff++) {
+				Point s2Start = streets[ff]->position;
+				Point s2End = streets[(ff + 1) % streets.size()]->position;
 
-				if (areFourPointsCollinear(s1->start, s1->end, s2->start, s2->end)) {
+				if (areFourPointsCollinear(s1Start, s1End, s2Start, s2End)) {
 					this->street_access = true;
 				}
 
@@ -494,11 +492,10 @@ public:
 		std::vector<GraphVertex*> original_face = this->parcels[0]->face;
 
 		int n = 0;
-		bool below_area = false;
 		while (n < iterations) {
 			n++;
 			std::vector<Parcel*> next_parcels;
-			for (int i = 0; i < this->parcels.size(); i++) {
+			for (int i = 0; i < static_cast<int>(this->parcels.size()); i++) {
 				Parcel* p = this->parcels[i];
 
 				// if larger than area limit, split again, otherwise keep
@@ -518,21 +515,20 @@ public:
 					}
 
 					p->graph->FindFaces();
-					for (int j = 0; j < p->graph->faces.size(); j++) {
+					for (int j = 0; j < static_cast<int>(p->graph->faces.size()); j++) {
 
 						std::vector<GraphVertex*> next_parc_verts{};
 						for (auto node : p->graph->faces[j]) {
 							next_parc_verts.push_back(p->graph->vertices[node]->data);
 						}
 
-						Parcel* next_parc = new Parcel(next_parc_verts);
+						Parcel* next_parc = new Parcel(next_parc_verts, *p->vertexIDs);
 						next_parc->flag = p->flag;
 						next_parcels.push_back(next_parc);
 
 					}
 				}
 				else {
-					below_area = true;
 					if (!p->flag) {
 						next_parcels.push_back(p);
 					}
@@ -542,7 +538,7 @@ public:
 			this->parcels = next_parcels;
 		}
 
-		for (int i = 0; i < this->parcels.size(); i++) {
+		for (int i = 0; i < static_cast<int>(this->parcels.size()); i++) {
 			this->parcels[i]->hasStreetAccess(original_face);
 		}
 	}
@@ -582,11 +578,8 @@ inline std::vector<std::tuple<Point, GraphVertex, GraphVertex, float>> getAllEdg
 			for (auto v2 : neighbors) {
 				if (v2.position.x != s1.position.x || v2.position.y != s1.position.y) {
 					if (!visited.count(v2)) {
-						Segment* seg1 = new Segment(s1.position, s2.position);
-						Segment* seg2 = new Segment(v1.position, v2.position);
-
-						auto intersct = seg1->intersectWith(seg2);
-						if (intersct != nullptr) {
+						auto intersct = Math::doLineSegmentsIntersect(s1.position, s2.position, v1.position, v2.position, true);
+						if (intersct) {
 							Point resPoint{ intersct->x, intersct->y };
 							float dist = sqrt((resPoint.x - s1.position.x)*(resPoint.x - s1.position.x) +
 								(resPoint.y - s1.position.y) * (resPoint.y - s1.position.y));
@@ -783,12 +776,9 @@ public:
 
 			bool colinear = areFourPointsCollinear(p1, p2, p3, p4);
 
-			Segment* seg1 = new Segment(p1, p2);
-			Segment* seg2 = new Segment(p3, p4);
-
-			auto intersct = seg1->intersectWith(seg2);
+			auto intersct = Math::doLineSegmentsIntersect(p1, p2, p3, p4, true);
 			Point isect{};
-			if (intersct != nullptr) {
+			if (intersct) {
 				isect.x = intersct->x;
 				isect.y = intersct->y;
 			}
@@ -797,7 +787,7 @@ public:
 				isect = this->face[i].position + Point{prevPerp.X, prevPerp.Y} *(-clamp_inset);
 			}
 			else {
-				if (intersct == nullptr) {
+				if (!intersct) {
 					isect = this->face[i].position + Point{prevPerp.X, prevPerp.Y} *(-clamp_inset);
 				}
 			}
@@ -807,8 +797,8 @@ public:
 
 			Point sc = this->face[i].position + Point{dir.X, dir.Y}*inset;
 
-			if (intersct != nullptr) {
-				inset_arr.push_back(*(new GraphVertex(isect)));
+			if (intersct) {
+				inset_arr.push_back(GraphVertex(isect));
 			}
 		}
 
@@ -853,7 +843,7 @@ public:
 
 	// getOBB
 	void getOBB() {
-		this->obb = *(new OrientedBoundingBox2D());
+		this->obb = OrientedBoundingBox2D();
 		if (this->face.size() > 0) {
 			TArray<FVector> faceVectors{};
 			for (int i = 0; i < this->face.size(); i++) {
@@ -968,11 +958,9 @@ public:
 			GraphVertex v1 = this->face[i];
 			GraphVertex v2 = this->face[(i + 1) % this->face.size()];
 
-			Segment* seg1 = new Segment(s1.position, s2.position);
-			Segment* seg2 = new Segment(v1.position, v2.position);
-			auto intersct = seg1->intersectWith(seg2);
+			auto intersct = Math::doLineSegmentsIntersect(s1.position, s2.position, v1.position, v2.position, true);
 
-			if (intersct != nullptr) {
+			if (intersct) {
 				float dist = sqrt(pow(s1.position.x - intersct->x, 2) + pow(s1.position.y - intersct->y, 2));
 				res.push_back(std::tuple<Point, GraphVertex, GraphVertex, float>(Point{ intersct->x, intersct->y },
 					v1, v2, dist));
@@ -986,12 +974,14 @@ public:
 	void hasStreetAccess(std::vector<GraphVertex> streets) {
 		for (int j = 0; j < this->face.size(); j++) {
 			std::vector<GraphVertex> f = this->face;
-			Segment* s1 = new Segment(f[j].position, f[(j + 1) % f.size()].position);
+			Point s1Start = f[j].position;
+			Point s1End = f[(j + 1) % f.size()].position;
 
 			for (int ff = 0; ff < streets.size(); ff++) {
-				Segment* s2 = new Segment(streets[ff].position, streets[(ff + 1) % streets.size()].position);
+				Point s2Start = streets[ff].position;
+				Point s2End = streets[(ff + 1) % streets.size()].position;
 
-				if (areFourPointsCollinear(s1->start, s1->end, s2->start, s2->end)) {
+				if (areFourPointsCollinear(s1Start, s1End, s2Start, s2End)) {
 					this->street_access = true;
 				}
 				
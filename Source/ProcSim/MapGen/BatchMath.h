@@ -0,0 +1,298 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Math.h"
+
+/*
+* The lanes the batch tests run on, picked at compile time: AVX (4 doubles), SSE2 (2 doubles, every x64 build) or NEON
+* (2 doubles, arm64). PROCSIM_NO_SIMD=1 forces the scalar fallback, which calls the Math functions one candidate at a time.
+*/
+#if defined(PROCSIM_NO_SIMD) && PROCSIM_NO_SIMD
+#define PROCSIM_BATCH_LANES 0
+#elif defined(__AVX__)
+#define PROCSIM_BATCH_LANES 4
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PROCSIM_BATCH_LANES 2
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define PROCSIM_BATCH_LANES 2
+#include <arm_neon.h>
+#else
+#define PROCSIM_BATCH_LANES 0
+#endif
+
+/**
+* The end points of the candidates one segment is tested against, one array per coordinate.
+*
+* The arrays are kept a multiple of PADDING long, the entries after the last candidate are left over from earlier
+* candidates or zero. The batch tests load whole registers from them and never need a scalar loop for the rest.
+*/
+struct CandidateBlock {
+    enum : size_t { PADDING = 4 };
+
+    std::vector<double> startX;
+    std::vector<double> startY;
+    std::vector<double> endX;
+    std::vector<double> endY;
+
+    /* removes every candidate. The memory is kept for reuse */
+    void clear() { count = 0; }
+
+    void push(const Point& start, const Point& end) {
+        if (count == startX.size()) {
+            const size_t padded = count + PADDING;
+            startX.resize(padded, 0.0);
+            startY.resize(padded, 0.0);
+            endX.resize(padded, 0.0);
+            endY.resize(padded, 0.0);
+        }
+        startX[count] = start.x;
+        startY[count] = start.y;
+        endX[count] = end.x;
+        endY[count] = end.y;
+        count++;
+    }
+
+    size_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    /* length of the arrays */
+    size_t paddedSize() const { return startX.size(); }
+
+private:
+    size_t count = 0;
+};
+
+/* what the batch tests found for every candidate of a block, in the order of the block. The arrays are as long as the padded block */
+struct CandidateTests {
+    /* Math::doLineSegmentsIntersect(start, end, candidate start, candidate end, true), x, y and t only if crosses is set */
+    std::vector<uint8_t> crosses;
+    std::vector<double> crossX;
+    std::vector<double> crossY;
+    std::vector<double> crossT;
+
+    /* Math::distanceToLine(point, candidate start, candidate end) */
+    std::vector<double> distance2;
+    std::vector<double> lineX;
+    std::vector<double> lineY;
+    std::vector<double> lineProj2;
+    std::vector<double> length2;
+};
+
+/**
+* Tests of one segment against a block of candidates, several candidates at a time.
+*
+* The lanes do the same operations in the same order as the Math functions, so every result has the same bits as the
+* scalar test (the build must not contract multiplications and additions into FMAs, which the default flags don't).
+* Without SIMD the Math functions are called one candidate at a time.
+*/
+class BatchMath {
+public:
+    /* name of the instruction set the lanes use */
+    static const char* instructionSet() {
+#if PROCSIM_BATCH_LANES == 4
+        return "AVX";
+#elif PROCSIM_BATCH_LANES == 2 && defined(__aarch64__)
+        return "NEON";
+#elif PROCSIM_BATCH_LANES == 2
+        return "SSE2";
+#else
+        return "scalar";
+#endif
+    }
+
+    /* crossings of start-end with every candidate, fills the cross* arrays of tests */
+    static void intersectAll(const Point& start, const Point& end, const CandidateBlock& block, CandidateTests& tests) {
+        const size_t padded = block.paddedSize();
+        tests.crosses.resize(padded);
+        tests.crossX.resize(padded);
+        tests.crossY.resize(padded);
+        tests.crossT.resize(padded);
+
+#if PROCSIM_BATCH_LANES > 0
+        intersectLanes(start, end, block, tests);
+#else
+        const size_t count = block.size();
+        for (size_t i = 0; i < count; i++) {
+            OptionalIntersection intersection = Math::doLineSegmentsIntersect(start, end,
+                Point{ block.startX[i], block.startY[i] }, Point{ block.endX[i], block.endY[i] }, true);
+            tests.crosses[i] = intersection ? 1 : 0;
+            tests.crossX[i] = intersection.value.x;
+            tests.crossY[i] = intersection.value.y;
+            tests.crossT[i] = intersection.value.t;
+        }
+#endif
+    }
+
+    /* distance from point to the line of every candidate, fills the distance and line arrays of tests */
+    static void distanceToLineAll(const Point& point, const CandidateBlock& block, CandidateTests& tests) {
+        const size_t padded = block.paddedSize();
+        tests.distance2.resize(padded);
+        tests.lineX.resize(padded);
+        tests.lineY.resize(padded);
+        tests.lineProj2.resize(padded);
+        tests.length2.resize(padded);
+
+#if PROCSIM_BATCH_LANES > 0
+        distanceLanes(point, block, tests);
+#else
+        const size_t count = block.size();
+        for (size_t i = 0; i < count; i++) {
+            Math::DistanceToLineResult result = Math::distanceToLine(point,
+                Point{ block.startX[i], block.startY[i] }, Point{ block.endX[i], block.endY[i] });
+            tests.distance2[i] = result.distance2;
+            tests.lineX[i] = result.pointOnLine.x;
+            tests.lineY[i] = result.pointOnLine.y;
+            tests.lineProj2[i] = result.lineProj2;
+            tests.length2[i] = result.length2;
+        }
+#endif
+    }
+
+    /* both tests in one call: the crossings with start-end and the distances from end, what localConstraints needs */
+    static void testAll(const Point& start, const Point& end, const CandidateBlock& block, CandidateTests& tests) {
+        intersectAll(start, end, block, tests);
+        distanceToLineAll(end, block, tests);
+    }
+
+private:
+#if PROCSIM_BATCH_LANES == 4
+    typedef __m256d Vec;
+    static Vec load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, Vec v) { _mm256_storeu_pd(p, v); }
+    static Vec set(double v) { return _mm256_set1_pd(v); }
+    static Vec add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm256_sub_pd(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm256_mul_pd(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm256_div_pd(a, b); }
+    static Vec less(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+    static Vec notEqual(Vec a, Vec b) { return _mm256_cmp_pd(a, b, _CMP_NEQ_OQ); }
+    static Vec both(Vec a, Vec b) { return _mm256_and_pd(a, b); }
+    static Vec select(Vec mask, Vec a, Vec b) { return _mm256_blendv_pd(b, a, mask); }
+    static int bits(Vec mask) { return _mm256_movemask_pd(mask); }
+#elif PROCSIM_BATCH_LANES == 2 && defined(__aarch64__)
+    typedef float64x2_t Vec;
+    static Vec load(const double* p) { return vld1q_f64(p); }
+    static void store(double* p, Vec v) { vst1q_f64(p, v); }
+    static Vec set(double v) { return vdupq_n_f64(v); }
+    static Vec add(Vec a, Vec b) { return vaddq_f64(a, b); }
+    static Vec sub(Vec a, Vec b) { return vsubq_f64(a, b); }
+    static Vec mul(Vec a, Vec b) { return vmulq_f64(a, b); }
+    static Vec div(Vec a, Vec b) { return vdivq_f64(a, b); }
+    // masks are kept in double registers like on x86, all bits of a lane set or none
+    static Vec less(Vec a, Vec b) { return vreinterpretq_f64_u64(vcltq_f64(a, b)); }
+    static Vec notEqual(Vec a, Vec b) {
+        return vreinterpretq_f64_u32(vmvnq_u32(vreinterpretq_u32_u64(vceqq_f64(a, b))));
+    }
+    static Vec both(Vec a, Vec b) {
+        return vreinterpretq_f64_u64(vandq_u64(vreinterpretq_u64_f64(a), vreinterpretq_u64_f64(b)));
+    }
+    static Vec select(Vec mask, Vec a, Vec b) { return vbslq_f64(vreinterpretq_u64_f64(mask), a, b); }
+    static int bits(Vec mask) {
+        uint64x2_t m = vreinterpretq_u64_f64(mask);
+        return static_cast<int>((vgetq_lane_u64(m, 0) & 1) | ((vgetq_lane_u64(m, 1) & 1) << 1));
+    }
+#elif PROCSIM_BATCH_LANES == 2
+    typedef __m128d Vec;
+    static Vec load(const double* p) { return _mm_loadu_pd(p); }
+    static void store(double* p, Vec v) { _mm_storeu_pd(p, v); }
+    static Vec set(double v) { return _mm_set1_pd(v); }
+    static Vec add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+    static Vec sub(Vec a, Vec b) { return _mm_sub_pd(a, b); }
+    static Vec mul(Vec a, Vec b) { return _mm_mul_pd(a, b); }
+    static Vec div(Vec a, Vec b) { return _mm_div_pd(a, b); }
+    static Vec less(Vec a, Vec b) { return _mm_cmplt_pd(a, b); }
+    static Vec notEqual(Vec a, Vec b) { return _mm_cmpneq_pd(a, b); }
+    static Vec both(Vec a, Vec b) { return _mm_and_pd(a, b); }
+    static Vec select(Vec mask, Vec a, Vec b) { return _mm_or_pd(_mm_and_pd(mask, a), _mm_andnot_pd(mask, b)); }
+    static int bits(Vec mask) { return _mm_movemask_pd(mask); }
+#endif
+
+#if PROCSIM_BATCH_LANES > 0
+    // the lanes of doLineSegmentsIntersect(a, b, p, d, true), the last register may take padding
+    static void intersectLanes(const Point& a, const Point& b, const CandidateBlock& block, CandidateTests& tests) {
+        const size_t lanes = PROCSIM_BATCH_LANES;
+        const size_t count = block.size();
+
+        const Vec ax = set(a.x), ay = set(a.y);
+        const Vec bbx = set(b.x - a.x), bby = set(b.y - a.y);
+        const Vec zero = set(0), low = set(0.001), high = set(0.999);
+
+        const double* startX = block.startX.data();
+        const double* startY = block.startY.data();
+        const double* endX = block.endX.data();
+        const double* endY = block.endY.data();
+        uint8_t* crosses = tests.crosses.data();
+        double* crossX = tests.crossX.data();
+        double* crossY = tests.crossY.data();
+        double* crossT = tests.crossT.data();
+
+        for (size_t i = 0; i < count; i += lanes) {
+            const Vec px = load(startX + i), py = load(startY + i);
+            const Vec ddx = sub(load(endX + i), px), ddy = sub(load(endY + i), py);
+            const Vec pax = sub(px, ax), pay = sub(py, ay);
+
+            const Vec k = sub(mul(bbx, ddy), mul(bby, ddx));
+            const Vec f = div(sub(mul(pax, bby), mul(pay, bbx)), k);
+            const Vec e = div(sub(mul(pax, ddy), mul(pay, ddx)), k);
+
+            // like the scalar test, parallel candidates (k == 0) never cross
+            Vec crossing = both(notEqual(k, zero), both(less(low, e), less(e, high)));
+            crossing = both(crossing, both(less(low, f), less(f, high)));
+
+            store(crossX + i, add(ax, mul(e, bbx)));
+            store(crossY + i, add(ay, mul(e, bby)));
+            store(crossT + i, e);
+            const int found = bits(crossing);
+            for (size_t l = 0; l < lanes; l++)
+                crosses[i + l] = static_cast<uint8_t>((found >> l) & 1);
+        }
+    }
+
+    // the lanes of distanceToLine(a, b, e), the last register may take padding
+    static void distanceLanes(const Point& a, const CandidateBlock& block, CandidateTests& tests) {
+        const size_t lanes = PROCSIM_BATCH_LANES;
+        const size_t count = block.size();
+
+        const Vec ax = set(a.x), ay = set(a.y);
+        const Vec zero = set(0), minusOne = set(-1);
+
+        const double* startX = block.startX.data();
+        const double* startY = block.startY.data();
+        const double* endX = block.endX.data();
+        const double* endY = block.endY.data();
+        double* distance2 = tests.distance2.data();
+        double* lineX = tests.lineX.data();
+        double* lineY = tests.lineY.data();
+        double* lineProj2 = tests.lineProj2.data();
+        double* length2 = tests.length2.data();
+
+        for (size_t i = 0; i < count; i += lanes) {
+            const Vec bx = load(startX + i), by = load(startY + i);
+            const Vec dx = sub(ax, bx), dy = sub(ay, by);
+            const Vec eex = sub(load(endX + i), bx), eey = sub(load(endY + i), by);
+
+            const Vec dot = add(mul(dx, eex), mul(dy, eey));
+            const Vec length = add(mul(eex, eex), mul(eey, eey));
+            const Vec scale = div(dot, length);
+            const Vec projX = mul(eex, scale), projY = mul(eey, scale);
+            const Vec onLineX = add(bx, projX), onLineY = add(by, projY);
+            const Vec toX = sub(ax, onLineX), toY = sub(ay, onLineY);
+            const Vec projected2 = add(mul(projX, projX), mul(projY, projY));
+
+            store(distance2 + i, add(mul(toX, toX), mul(toY, toY)));
+            store(lineX + i, onLineX);
+            store(lineY + i, onLineY);
+            // sign(dot) * projected2, with the sign as 1, -1 or 0
+            store(lineProj2 + i, select(less(zero, dot), projected2,
+                select(less(dot, zero), mul(minusOne, projected2), mul(zero, projected2))));
+            store(length2 + i, length);
+        }
+    }
+#endif
+};
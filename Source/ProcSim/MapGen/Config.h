@@ -1,5 +1,49 @@
 #pragma once
-#include "ProcSim/Utils/RoadData.h"
+
+#include <cfloat>
+#include <random>
+
+/* Determines how straight the roads are. The editor's ESTRAIGHTNESS is converted to this */
+enum class Straightness {
+    Curved,
+    Straight,
+    VeryStraight
+};
+
+/* Implementations of the priority queue used by the generation loop */
+enum class PriorityQueueType {
+    Linear,
+    BinaryHeap,
+    Bucket
+};
+
+/**
+* Settings chosen for one generation (region, size and shape of the road network). Config holds the constants
+* every generation shares. A GeneratorConfig is filled in before a generation starts and only read afterwards,
+* so several generations with different settings can run at the same time.
+*/
+struct GeneratorConfig {
+    /* mapsize */
+    float minx = -20000;
+    float miny = -20000;
+    float maxx = 20000;
+    float maxy = 20000;
+    /** stop generation after x segments */
+    int segmentCountLimit = 20000;
+    /* determines how curved we want our roads to be */
+    Straightness straightness = Straightness::Straight;
+    /* seed of the random numbers of the generation, the same seed and heatmap give the same road network */
+    unsigned int seed = 1;
+    /* roads only grow further from segments ending inside this area. Set to one tile by generateTiled */
+    float tileMinx = -FLT_MAX;
+    float tileMiny = -FLT_MAX;
+    float tileMaxx = FLT_MAX;
+    float tileMaxy = FLT_MAX;
+
+    bool insideTile(double x, double y) const {
+        return x >= tileMinx && x < tileMaxx && y >= tileMiny && y < tileMaxy;
+    }
+};
 
 class Config {
 public:
@@ -11,9 +55,9 @@ public:
     static const float DEFAULT_HEIGHT;
 
     /** branch with 90 angle + randomness */
-    static float RANDOM_BRANCH_ANGLE();
+    static float RANDOM_BRANCH_ANGLE(Straightness straightness, std::mt19937& random);
     /** sample possible highway continuation with this angle */
-    static float RANDOM_STRAIGHT_ANGLE();
+    static float RANDOM_STRAIGHT_ANGLE(Straightness straightness, std::mt19937& random);
     /** probability of branching normal streets (including from highways) */
     static const float DEFAULT_BRANCH_PROBABILITY;
     /** probability of branching from highways */
@@ -27,14 +71,18 @@ public:
     static const int HIGHWAY_POPULATION_SAMPLE_SIZE;
     /** ignore intersections with less than this degrees angle */
     static const int MINIMUM_INTERSECTION_DEVIATION;
-    /** stop generation after x steps */
-    static int SEGMENT_COUNT_LIMIT;
     /** maximum distance to connect roads */
     static const int ROAD_SNAP_DISTANCE;
+    /** segment ends closer than this are welded into one intersection */
+    static const double ENDPOINT_WELD_DISTANCE;
+    /** priority queue used to order segments by their time-step delay */
+    static const PriorityQueueType PRIORITY_QUEUE_TYPE;
 
     static const struct QuadTreeParams { float x4; float y; float width; float height; } QUADTREE_PARAMS;
     static const int QUADTREE_MAX_OBJECTS;
     static const int QUADTREE_MAX_LEVELS;
+    /** side of the cells of the hash grid, used instead of the quadtree if PROCSIM_HASH_GRID is defined to 1 */
+    static const double HASH_GRID_CELL_SIZE;
     /////////////////////////////////////static const bool DEBUG;
     /** disallow branching of normal streets from highways */
     static const bool ONLY_HIGHWAYS;
@@ -46,17 +94,8 @@ public:
     static const bool TWO_SEGMENTS_INITIALLY;
     /** instead of starting with highways */
     static const bool START_WITH_NORMAL_STREETS;
-    /* mapsize */
-    static float minx;
-    static float miny;
-    static float maxx;
-    static float maxy;
 
     /* Code Configurations added by Navid*/
-    /* if true, the heatmap will be very noisy and random*/
-    static bool COMPLETELYRANDOM;
-    /* determines how curved we want our roads to be*/
-    static ESTRAIGHTNESS STRAIGHTNESS;
     /* path to input image, no image is used if empty*/
     static const char* IMGPATH;
     /* show segments colored */
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+* Owns every object created during one road generation (segments, intersections and temporaries).
+* Objects are bump-allocated from large blocks, so they are never freed one by one: reset() drops everything
+* at once and the next generation starts from an empty arena.
+*
+* Trivially destructible objects cost nothing to free. Objects with a destructor (e.g. Segment, which holds
+* its link vectors) are recorded once on creation and destroyed on reset.
+*/
+class GenerationArena {
+public:
+	struct Stats {
+		/* bytes handed out since the last reset, including alignment padding */
+		size_t bytesInUse;
+		/* highest bytesInUse seen since the arena was created */
+		size_t peakBytes;
+		/* bytes held in blocks */
+		size_t bytesReserved;
+		/* number of objects allocated since the last reset */
+		size_t allocations;
+		/* number of objects allocated since the arena was created */
+		size_t totalAllocations;
+	};
+
+	explicit GenerationArena(size_t blockSize = 64 * 1024) : blockSize(blockSize) {}
+
+	GenerationArena(const GenerationArena&) = delete;
+	GenerationArena& operator=(const GenerationArena&) = delete;
+
+	~GenerationArena() {
+		reset();
+	}
+
+	void* allocate(size_t size, size_t alignment = alignof(std::max_align_t)) {
+		size_t offset = alignUp(used, alignment);
+
+		if (blocks.empty() || offset + size > currentBlockSize) {
+			newBlock(size + alignment);
+			offset = alignUp(used, alignment);
+		}
+
+		void* memory = blocks.back().get() + offset;
+		stats.bytesInUse += (offset + size) - used;
+		used = offset + size;
+
+		stats.allocations++;
+		stats.totalAllocations++;
+		if (stats.bytesInUse > stats.peakBytes)
+			stats.peakBytes = stats.bytesInUse;
+
+		return memory;
+	}
+
+	/* constructs T inside the arena, the arena owns it until the next reset */
+	template<typename T, typename... Args>
+	T* create(Args&&... args) {
+		void* memory = allocate(sizeof(T), alignof(T));
+		T* object = new (memory) T(std::forward<Args>(args)...);
+
+		if (!std::is_trivially_destructible<T>::value)
+			destructors.push_back({ object, [](void* p) { static_cast<T*>(p)->~T(); } });
+
+		return object;
+	}
+
+	/* destroys every object and frees all blocks except the first one, which is kept for the next generation */
+	void reset() {
+		for (auto it = destructors.rbegin(); it != destructors.rend(); ++it)
+			it->destroy(it->object);
+		destructors.clear();
+
+		if (blocks.size() > 1) {
+			size_t firstSize = blockSizes.front();
+			blocks.erase(blocks.begin() + 1, blocks.end());
+			blockSizes.erase(blockSizes.begin() + 1, blockSizes.end());
+			stats.bytesReserved = firstSize;
+			currentBlockSize = firstSize;
+		}
+
+		used = 0;
+		stats.bytesInUse = 0;
+		stats.allocations = 0;
+	}
+
+	Stats getStats() const {
+		return stats;
+	}
+
+private:
+	struct Destructor {
+		void* object;
+		void (*destroy)(void*);
+	};
+
+	static size_t alignUp(size_t value, size_t alignment) {
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+
+	void newBlock(size_t minimumSize) {
+		size_t size = minimumSize > blockSize ? minimumSize : blockSize;
+		blocks.emplace_back(new unsigned char[size]);
+		blockSizes.push_back(size);
+		currentBlockSize = size;
+		used = 0;
+		stats.bytesReserved += size;
+	}
+
+	size_t blockSize;
+	std::vector<std::unique_ptr<unsigned char[]>> blocks;
+	std::vector<size_t> blockSizes;
+	size_t currentBlockSize = 0;
+	/* bytes used in the current (last) block */
+	size_t used = 0;
+	std::vector<Destructor> destructors;
+	Stats stats{};
+};
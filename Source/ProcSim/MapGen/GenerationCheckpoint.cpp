@@ -0,0 +1,461 @@
+#include "GenerationCheckpoint.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <utility>
+
+static const char CHECKPOINT_MAGIC[4] = { 'P', 'S', 'G', 'C' };
+static const uint32_t CHECKPOINT_VERSION = 3;
+/* written before the spatial index, a checkpoint can only be loaded into the same kind of index */
+static const uint8_t QUADTREE_INDEX = 0;
+static const uint8_t HASH_GRID_INDEX = 1;
+/* written instead of a segment index for null pointers */
+static const uint32_t NO_SEGMENT = UINT32_MAX;
+/* the text form of the random engine is a few KB, anything longer is not a checkpoint */
+static const uint32_t MAX_RANDOM_STATE_SIZE = 1 << 16;
+/* delays far below the range of the int priorities of the queues */
+static const double MAX_DELAY = 1 << 30;
+
+// Segments are written as indices into the table of every segment of the checkpoint.
+// The callbacks for Quadtree::save and HashGrid::save are part of the writer
+class CheckpointWriter {
+public:
+	explicit CheckpointWriter(std::ostream& out) : out(out) {}
+
+	std::unordered_map<const Segment*, uint32_t> index;
+
+	template<typename T>
+	void value(const T& v) {
+		out.write(reinterpret_cast<const char*>(&v), sizeof(T));
+	}
+
+	void segment(const Segment* s) {
+		value<uint32_t>(s == nullptr ? NO_SEGMENT : index.at(s));
+	}
+
+	void segments(const std::vector<Segment*>& list) {
+		value<uint32_t>(static_cast<uint32_t>(list.size()));
+		for (auto s : list)
+			segment(s);
+	}
+
+	void tree(const Bounds& bounds, int maxObjects, int maxLevels) {
+		value(QUADTREE_INDEX);
+		value(bounds);
+		value<int32_t>(maxObjects);
+		value<int32_t>(maxLevels);
+	}
+
+	void grid(const Bounds& bounds, double cellSize, size_t cellCount) {
+		value(HASH_GRID_INDEX);
+		value(bounds);
+		value(cellSize);
+		value<uint32_t>(static_cast<uint32_t>(cellCount));
+	}
+
+	void cell(int32_t x, int32_t y, size_t objectCount) {
+		value(x);
+		value(y);
+		value<uint32_t>(static_cast<uint32_t>(objectCount));
+	}
+
+	void node(bool inner, size_t objectCount) {
+		value<uint8_t>(inner);
+		value<uint32_t>(static_cast<uint32_t>(objectCount));
+	}
+
+	void object(SpatialHandle handle, const Bounds& bounds, const Segment* s) {
+		value<uint32_t>(handle);
+		value(bounds);
+		segment(s);
+	}
+
+private:
+	std::ostream& out;
+};
+
+class CheckpointReader {
+public:
+	explicit CheckpointReader(std::istream& in) : in(in) {}
+
+	std::vector<Segment*> table;
+	/* the handle of every segment read with the spatial index */
+	std::vector<std::pair<Segment*, SpatialHandle>> treeEntries;
+	/* the segment of every handle read so far, an object in several cells must have the same one each time */
+	std::vector<Segment*> handleSegments;
+
+	template<typename T>
+	bool value(T& v) {
+		in.read(reinterpret_cast<char*>(&v), sizeof(T));
+		return static_cast<bool>(in);
+	}
+
+	bool segment(Segment*& s) {
+		uint32_t i = 0;
+		return value(i) && segmentAt(i, s);
+	}
+
+	/* the segment at index i of the table, null for NO_SEGMENT */
+	bool segmentAt(uint32_t i, Segment*& s) const {
+		if (i == NO_SEGMENT) {
+			s = nullptr;
+			return true;
+		}
+		if (i >= table.size())
+			return false;
+		s = table[i];
+		return true;
+	}
+
+	bool segments(std::vector<Segment*>& list) {
+		uint32_t count = 0;
+		if (!value(count))
+			return false;
+		list.clear();
+		for (uint32_t i = 0; i < count; i++) {
+			Segment* s = nullptr;
+			if (!segment(s) || s == nullptr)
+				return false;
+			list.push_back(s);
+		}
+		return true;
+	}
+
+	/* appends a list written by CheckpointWriter::segments to indices as it is, its length first */
+	bool segmentIndices(std::vector<uint32_t>& indices) {
+		uint32_t count = 0;
+		if (!value(count))
+			return false;
+		indices.push_back(count);
+		for (uint32_t i = 0; i < count; i++) {
+			uint32_t s = 0;
+			if (!value(s))
+				return false;
+			indices.push_back(s);
+		}
+		return true;
+	}
+
+	/* the list segmentIndices appended at indices[next], next is moved past it */
+	bool segmentsAt(const std::vector<uint32_t>& indices, size_t& next, std::vector<Segment*>& list) const {
+		const uint32_t count = indices[next++];
+		list.clear();
+		for (uint32_t i = 0; i < count; i++) {
+			Segment* s = nullptr;
+			if (!segmentAt(indices[next++], s) || s == nullptr)
+				return false;
+			list.push_back(s);
+		}
+		return true;
+	}
+
+	bool tree(Bounds& bounds, int& maxObjects, int& maxLevels) {
+		uint8_t index = 0;
+		int32_t objects = 0, levels = 0;
+		if (!value(index) || index != QUADTREE_INDEX || !value(bounds) || !value(objects) || !value(levels))
+			return false;
+		// the level of a node is kept in a byte
+		if (objects <= 0 || levels < 0 || levels > UINT8_MAX)
+			return false;
+		maxObjects = objects;
+		maxLevels = levels;
+		return true;
+	}
+
+	bool grid(Bounds& bounds, double& cellSize, size_t& cellCount) {
+		uint8_t index = 0;
+		uint32_t count = 0;
+		if (!value(index) || index != HASH_GRID_INDEX || !value(bounds) || !value(cellSize) || !value(count))
+			return false;
+		cellCount = count;
+		return true;
+	}
+
+	bool cell(int32_t& x, int32_t& y, size_t& objectCount) {
+		uint32_t count = 0;
+		if (!value(x) || !value(y) || !value(count))
+			return false;
+		objectCount = count;
+		return true;
+	}
+
+	bool node(bool& inner, size_t& objectCount) {
+		uint8_t isInner = 0;
+		uint32_t count = 0;
+		if (!value(isInner) || !value(count))
+			return false;
+		inner = isInner != 0;
+		objectCount = count;
+		return true;
+	}
+
+	bool object(SpatialHandle& handle, Bounds& bounds, Segment*& s) {
+		uint32_t h = 0;
+		if (!value(h) || !value(bounds) || !segment(s) || s == nullptr)
+			return false;
+
+		// checkpoints are saved while generating, when nothing leaves the index: its handles are below the number of
+		// segments it was given, which are all in the table
+		if (h >= table.size())
+			return false;
+		if (handleSegments.empty())
+			handleSegments.resize(table.size(), nullptr);
+		if (handleSegments[h] != nullptr && handleSegments[h] != s)
+			return false;
+		handleSegments[h] = s;
+
+		handle = h;
+		treeEntries.emplace_back(s, handle);
+		return true;
+	}
+
+private:
+	std::istream& in;
+};
+
+// Collects the segments the spatial index holds, in the order its save visits them
+struct TreeSegmentCollector {
+	std::vector<Segment*> found;
+
+	void tree(const Bounds&, int, int) {}
+	void node(bool, size_t) {}
+	void grid(const Bounds&, double, size_t) {}
+	void cell(int32_t, int32_t, size_t) {}
+	void object(SpatialHandle, const Bounds&, Segment* s) { found.push_back(s); }
+};
+
+static void addToTable(Segment* segment, std::vector<Segment*>& table, std::unordered_map<const Segment*, uint32_t>& index) {
+	if (segment == nullptr || index.count(segment) != 0)
+		return;
+	index[segment] = static_cast<uint32_t>(table.size());
+	table.push_back(segment);
+}
+
+void saveGenerationCheckpoint(std::ostream& out, PriorityQueue<Segment*>& priorityQ, const SegmentStore& segments,
+	const SpatialIndex<Segment*>& qTree, const GenerationContext& context) {
+
+	std::vector<Segment*> queued;
+	queued.reserve(priorityQ.size());
+	while (!priorityQ.empty())
+		queued.push_back(priorityQ.dequeue());
+	for (auto segment : queued)
+		priorityQ.enqueue(segment);
+
+	// the stored segments come first so that loading can add table[0..stored) to the store in order.
+	// Links, prev and the spatial index can only point to segments of the generation, but they are added too if they aren't stored
+	CheckpointWriter writer(out);
+	std::vector<Segment*> table;
+	for (auto segment : segments)
+		addToTable(segment, table, writer.index);
+	for (auto segment : queued)
+		addToTable(segment, table, writer.index);
+
+	TreeSegmentCollector inTree;
+	qTree.save(inTree);
+	for (auto segment : inTree.found)
+		addToTable(segment, table, writer.index);
+
+	for (size_t i = 0; i < table.size(); i++) {
+		addToTable(table[i]->prev, table, writer.index);
+		for (auto link : table[i]->links_b)
+			addToTable(link, table, writer.index);
+		for (auto link : table[i]->links_f)
+			addToTable(link, table, writer.index);
+	}
+
+	out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	writer.value(CHECKPOINT_VERSION);
+
+	const GeneratorConfig& config = context.config();
+	writer.value(config.minx);
+	writer.value(config.miny);
+	writer.value(config.maxx);
+	writer.value(config.maxy);
+	writer.value<int32_t>(config.segmentCountLimit);
+	writer.value<int32_t>(static_cast<int32_t>(config.straightness));
+	writer.value<uint32_t>(config.seed);
+	writer.value(config.tileMinx);
+	writer.value(config.tileMiny);
+	writer.value(config.tileMaxx);
+	writer.value(config.tileMaxy);
+
+	writer.value<int32_t>(context.segmentIDs.peek());
+	writer.value<int32_t>(context.intersectionIDs.peek());
+
+	// the standard text form of the engine state is exact and the same on every platform
+	std::ostringstream randomState;
+	randomState << context.random;
+	std::string state = randomState.str();
+	writer.value<uint32_t>(static_cast<uint32_t>(state.size()));
+	out.write(state.data(), state.size());
+
+	writer.value<uint32_t>(static_cast<uint32_t>(table.size()));
+	for (auto segment : table) {
+		writer.value<int32_t>(segment->ID);
+		writer.value(segment->start);
+		writer.value(segment->end);
+		writer.value(segment->t);
+		writer.value(segment->width);
+		writer.value<uint8_t>(segment->q.highway);
+		writer.value<int32_t>(segment->q.color);
+		writer.value<uint8_t>(segment->q.severed);
+		writer.value(segment->startOrder);
+		writer.value(segment->endOrder);
+		writer.value<int32_t>(segment->startIntersectionID);
+		writer.value<int32_t>(segment->endIntersectionID);
+		writer.value<int32_t>(segment->startPointID);
+		writer.value<int32_t>(segment->endPointID);
+		writer.segment(segment->prev);
+		writer.value<uint8_t>(segment->branchLinksPending);
+		writer.segments(segment->links_b);
+		writer.segments(segment->links_f);
+	}
+
+	writer.value<uint32_t>(static_cast<uint32_t>(segments.size()));
+	writer.segments(queued);
+	qTree.save(writer);
+}
+
+static bool readCheckpoint(CheckpointReader& reader, std::istream& in, PriorityQueue<Segment*>& priorityQ,
+	SegmentStore& segments, SpatialIndex<Segment*>& qTree, GenerationContext& context) {
+
+	char magic[sizeof(CHECKPOINT_MAGIC)] = {};
+	uint32_t version = 0;
+	if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), CHECKPOINT_MAGIC))
+		return false;
+	if (!reader.value(version) || version != CHECKPOINT_VERSION)
+		return false;
+
+	GeneratorConfig config;
+	int32_t segmentCountLimit = 0, straightness = 0;
+	uint32_t seed = 0;
+	if (!reader.value(config.minx) || !reader.value(config.miny) || !reader.value(config.maxx) || !reader.value(config.maxy) ||
+		!reader.value(segmentCountLimit) || !reader.value(straightness) || !reader.value(seed) ||
+		!reader.value(config.tileMinx) || !reader.value(config.tileMiny) || !reader.value(config.tileMaxx) || !reader.value(config.tileMaxy))
+		return false;
+	if (straightness < static_cast<int32_t>(Straightness::Curved) || straightness > static_cast<int32_t>(Straightness::VeryStraight))
+		return false;
+	config.segmentCountLimit = segmentCountLimit;
+	config.straightness = static_cast<Straightness>(straightness);
+	config.seed = seed;
+
+	context.reset(config);
+
+	int32_t nextSegmentID = 0, nextIntersectionID = 0;
+	if (!reader.value(nextSegmentID) || !reader.value(nextIntersectionID))
+		return false;
+	context.segmentIDs.reset(nextSegmentID);
+	context.intersectionIDs.reset(nextIntersectionID);
+
+	uint32_t stateSize = 0;
+	if (!reader.value(stateSize) || stateSize > MAX_RANDOM_STATE_SIZE)
+		return false;
+	std::string state(stateSize, '\0');
+	if (!in.read(&state[0], stateSize))
+		return false;
+	std::istringstream randomState(state);
+	randomState >> context.random;
+	if (randomState.fail())
+		return false;
+
+	// every segment is made when its record has been read, so a table size the data doesn't back allocates nothing.
+	// prev and the links can point further down the table, they are kept as indices until the table is complete
+	uint32_t tableSize = 0;
+	if (!reader.value(tableSize))
+		return false;
+	std::vector<uint32_t> prevIndices;
+	std::vector<uint8_t> branchLinksPending;
+	std::vector<uint32_t> linkIndices;
+	for (uint32_t i = 0; i < tableSize; i++) {
+		int32_t ID = 0, startIntersectionID = 0, endIntersectionID = 0, startPointID = 0, endPointID = 0, color = 0;
+		uint8_t highway = 0, severed = 0, hasBranchLinks = 0;
+		uint32_t prev = NO_SEGMENT;
+		Segment* segment = context.arena.create<Segment>(0, Point{}, Point{});
+		reader.table.push_back(segment);
+
+		if (!reader.value(ID) || !reader.value(segment->start) || !reader.value(segment->end) ||
+			!reader.value(segment->t) || !reader.value(segment->width) ||
+			!reader.value(highway) || !reader.value(color) || !reader.value(severed) ||
+			!reader.value(segment->startOrder) || !reader.value(segment->endOrder) ||
+			!reader.value(startIntersectionID) || !reader.value(endIntersectionID) ||
+			!reader.value(startPointID) || !reader.value(endPointID) ||
+			!reader.value(prev) || !reader.value(hasBranchLinks) ||
+			!reader.segmentIndices(linkIndices) || !reader.segmentIndices(linkIndices))
+			return false;
+
+		segment->ID = ID;
+		segment->q = MetaInfo{ highway != 0, color, severed != 0 };
+		segment->startIntersectionID = startIntersectionID;
+		segment->endIntersectionID = endIntersectionID;
+		segment->startPointID = startPointID;
+		segment->endPointID = endPointID;
+
+		prevIndices.push_back(prev);
+		branchLinksPending.push_back(hasBranchLinks);
+	}
+
+	size_t nextLink = 0;
+	for (uint32_t i = 0; i < tableSize; i++) {
+		Segment* segment = reader.table[i];
+		if (!reader.segmentAt(prevIndices[i], segment->prev) ||
+			!reader.segmentsAt(linkIndices, nextLink, segment->links_b) || !reader.segmentsAt(linkIndices, nextLink, segment->links_f))
+			return false;
+
+		if (branchLinksPending[i] && segment->prev == nullptr)
+			return false;
+		segment->branchLinksPending = branchLinksPending[i] != 0;
+	}
+
+	uint32_t storedCount = 0;
+	if (!reader.value(storedCount) || storedCount > tableSize)
+		return false;
+	for (uint32_t i = 0; i < storedCount; i++)
+		segments.push_back(reader.table[i]);
+
+	std::vector<Segment*> queued;
+	if (!reader.segments(queued))
+		return false;
+	// the bucket queue spans the delays of its segments, a broken delay would make it allocate a bucket for every step.
+	// A segment is queued at most a step and a branch delay after the one it grows from, the earliest one queued
+	for (auto segment : queued)
+		if (!std::isfinite(segment->t) || std::abs(segment->t) > MAX_DELAY)
+			return false;
+	auto byDelay = [](const Segment* a, const Segment* b) { return a->t < b->t; };
+	auto delays = std::minmax_element(queued.begin(), queued.end(), byDelay);
+	if (!queued.empty() && (*delays.second)->t - (*delays.first)->t > 1 + Config::NORMAL_BRANCH_TIME_DELAY_FROM_HIGHWAY)
+		return false;
+	for (auto segment : queued)
+		priorityQ.enqueue(segment);
+
+	if (!qTree.load(reader))
+		return false;
+
+	// the store keeps the handle of its segments in the tree, the tree may also hold segments that aren't stored
+	for (auto& entry : reader.treeEntries)
+		if (entry.first->handle < segments.size() && segments[entry.first->handle] == entry.first)
+			segments.treeEntry[entry.first->handle] = entry.second;
+	return true;
+}
+
+bool loadGenerationCheckpoint(std::istream& in, PriorityQueue<Segment*>& priorityQ, SegmentStore& segments,
+	SpatialIndex<Segment*>& qTree, GenerationContext& context) {
+
+	auto clearGeneration = [&]() {
+		segments.clear();
+		while (!priorityQ.empty())
+			priorityQ.dequeue();
+		qTree.clear();
+	};
+
+	clearGeneration();
+
+	CheckpointReader reader(in);
+	if (readCheckpoint(reader, in, priorityQ, segments, qTree, context))
+		return true;
+
+	clearGeneration();
+	context.reset(GeneratorConfig());
+	return false;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <istream>
+#include <ostream>
+
+#include "MapGen.h"
+
+/**
+* Binary checkpoint of the serial generation loop (the generationStep loop), so a generation can be continued later,
+* or in another session, instead of being started again with a higher segment limit.
+*
+* It holds the config, IDs and random engine of the context, every accepted and queued segment with its links,
+* the queue order and the spatial index. Loading a checkpoint and continuing the loop gives exactly the same network
+* as never stopping. Debug data and intersections are not part of it, intersections are only made after the loop.
+*
+* The format is the in-memory layout of the values (native byte order), it is meant for the machine that wrote it.
+*/
+
+/* the queue is drained and refilled in the same order while saving, nothing else is changed */
+void saveGenerationCheckpoint(std::ostream& out, PriorityQueue<Segment*>& priorityQ, const SegmentStore& segments,
+	const SpatialIndex<Segment*>& qTree, const GenerationContext& context);
+
+/**
+* Replaces the generation in priorityQ, segments, qTree and context (which is reset) with the one in the checkpoint.
+* Returns false if the data is not a checkpoint of this version or is cut off, the generation is empty then.
+*/
+bool loadGenerationCheckpoint(std::istream& in, PriorityQueue<Segment*>& priorityQ, SegmentStore& segments,
+	SpatialIndex<Segment*>& qTree, GenerationContext& context);
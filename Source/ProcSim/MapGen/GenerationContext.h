@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "BatchMath.h"
+#include "Config.h"
+#include "GenerationArena.h"
+
+class Segment;
+
+/**
+* Hands out consecutive IDs. Every generation has its own allocators, so IDs are only unique within one generation
+* and no counter is shared between generations running at the same time.
+*/
+class IdAllocator {
+public:
+	explicit IdAllocator(int first = 0) : nextID(first) {}
+
+	int next() { return nextID++; }
+
+	/* the ID the next call to next() returns */
+	int peek() const { return nextID; }
+
+	void reset(int first = 0) { nextID = first; }
+
+private:
+	int nextID;
+};
+
+/**
+* Finds objects by the IDs an IdAllocator hands out. The IDs are small and consecutive, so the index of every object
+* in its container is kept in an array indexed by ID instead of a hash map. Removing an object leaves a tombstone,
+* which tells removed IDs apart from IDs that never had an object.
+*/
+class IdTable {
+public:
+	enum : uint32_t {
+		ABSENT = UINT32_MAX,
+		REMOVED = UINT32_MAX - 1
+	};
+
+	void clear() { table.clear(); }
+
+	/* the object with this ID is at index. If the ID already has an object it is kept, like a search from the front would find it */
+	void insert(int ID, uint32_t index) {
+		if (ID < 0)
+			return;
+		if (static_cast<size_t>(ID) >= table.size())
+			table.resize(static_cast<size_t>(ID) + 1, ABSENT);
+		if (table[ID] >= REMOVED)
+			table[ID] = index;
+	}
+
+	/* leaves a tombstone at the ID */
+	void remove(int ID) {
+		if (ID >= 0 && static_cast<size_t>(ID) < table.size())
+			table[ID] = REMOVED;
+	}
+
+	/* index of the object with this ID, ABSENT or REMOVED if there is none */
+	uint32_t find(int ID) const {
+		return ID >= 0 && static_cast<size_t>(ID) < table.size() ? table[ID] : static_cast<uint32_t>(ABSENT);
+	}
+
+	bool contains(int ID) const { return find(ID) < REMOVED; }
+
+	bool wasRemoved(int ID) const { return find(ID) == REMOVED; }
+
+private:
+	std::vector<uint32_t> table;
+};
+
+/* the candidates localConstraints tests a segment against, kept by the context so that their memory is reused */
+struct ConstraintCandidates {
+	enum : uint8_t {
+		/* the bounds of the candidate overlap the segment, it may cross it */
+		NEAR_SEGMENT = 1,
+		/* the bounds of the candidate are within snap distance of the end of the segment */
+		NEAR_END = 2
+	};
+
+	std::vector<Segment*> segments;
+	/* NEAR_SEGMENT and NEAR_END of every candidate */
+	std::vector<uint8_t> near;
+	CandidateBlock block;
+	CandidateTests tests;
+
+	void clear() {
+		segments.clear();
+		near.clear();
+		block.clear();
+	}
+};
+
+/**
+* Everything a single generation owns besides its results: the settings it was started with, the arena its segments
+* and intersections live in, their ID allocators and the random number engine.
+*
+* The generation functions only touch the context they are given and the immutable Config constants, so generations
+* with separate contexts can run on different threads. One context must not be used by two threads at once.
+*/
+class GenerationContext {
+public:
+	explicit GenerationContext(const GeneratorConfig& config = GeneratorConfig()) : random(config.seed), generatorConfig(config) {}
+
+	GenerationContext(const GenerationContext&) = delete;
+	GenerationContext& operator=(const GenerationContext&) = delete;
+
+	const GeneratorConfig& config() const { return generatorConfig; }
+
+	/* frees everything of the previous generation and prepares for a new one with the given settings */
+	void reset(const GeneratorConfig& config) {
+		tiles.clear();
+		arena.reset();
+		segmentIDs.reset();
+		intersectionIDs.reset();
+		generatorConfig = config;
+		random.seed(config.seed);
+	}
+
+	/* owns every segment and intersection of the generation */
+	GenerationArena arena;
+	IdAllocator segmentIDs;
+	IdAllocator intersectionIDs;
+	/* the only source of randomness of the generation */
+	std::mt19937 random;
+	/* contexts of the tiles of a tiled generation, their arenas own the segments grown in the tiles */
+	std::vector<std::unique_ptr<GenerationContext>> tiles;
+	/* scratch of localConstraints */
+	ConstraintCandidates candidates;
+
+private:
+	GeneratorConfig generatorConfig;
+};
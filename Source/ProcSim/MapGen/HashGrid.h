@@ -0,0 +1,359 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "Math.h"
+#include "SpatialEntries.h"
+
+/**
+* Uniform grid of square cells with the same interface as Quadtree. Only the cells that hold objects exist, they are
+* found through a hash table of their coordinates, so the grid has no edge: the bounds only place the origin of the
+* cells, objects outside of them are stored like every other object.
+*
+* An object is stored in every cell its bounds overlap, which suits objects that are about as big as a cell or smaller,
+* like road segments. The objects of the cells are stored inline in the shared pools of SpatialEntries.
+* Emptied cells are kept until clear.
+*/
+template<typename T>
+class HashGrid {
+private:
+    typedef SpatialEntries<T> Entries;
+    typedef typename Entries::Entry Entry;
+    typedef typename Entries::Run Run;
+    static const uint32_t NONE = Entries::NONE;
+    /* entries of the first run of a cell */
+    static const uint32_t CELL_RUN_LENGTH = 2;
+
+    struct Cell {
+        int32_t x;
+        int32_t y;
+        Run run;
+    };
+
+    /* the cells an area overlaps, inclusive */
+    struct CellRange {
+        int32_t minX;
+        int32_t minY;
+        int32_t maxX;
+        int32_t maxY;
+
+        bool contains(int32_t x, int32_t y) const { return x >= minX && x <= maxX && y >= minY && y <= maxY; }
+
+        double cellCount() const { return (static_cast<double>(maxX) - minX + 1) * (static_cast<double>(maxY) - minY + 1); }
+    };
+
+    Bounds bounds;
+    double cellSize;
+    /* in the order they were made, which is the order save writes them */
+    std::vector<Cell> cells;
+    /* open addressing with linear probing, indices into cells. The size is a power of two, at most half of it is used */
+    std::vector<uint32_t> table;
+    Entries entries;
+
+public:
+    HashGrid(const Bounds bounds, double cellSize) : bounds(bounds), cellSize(cellSize), entries(CELL_RUN_LENGTH) {}
+
+    HashGrid(const HashGrid&) = delete;
+    HashGrid& operator=(const HashGrid&) = delete;
+
+    /**
+    * Calls visit(obj) once for every object whose bounds overlap rect (touching edges count), without allocating.
+    * An object lying in several cells is only reported by the cell holding the top left corner of its overlap with rect.
+    */
+    template<typename Visitor>
+    void query(const Bounds& rect, Visitor&& visit) const {
+        queryCells(rect, [&visit](const Bounds&, const T& obj) { visit(obj); });
+    }
+
+    /* Like query, for the objects whose bounds are at most radius away from center */
+    template<typename Visitor>
+    void queryRadius(Point center, double radius, Visitor&& visit) const {
+        const double radius2 = radius * radius;
+        Bounds rect{ center.x - radius, center.y - radius, 2 * radius, 2 * radius };
+
+        queryCells(rect, [&visit, center, radius2](const Bounds& b, const T& obj) {
+            double dx = std::max({ b.x - center.x, 0.0, center.x - (b.x + b.width) });
+            double dy = std::max({ b.y - center.y, 0.0, center.y - (b.y + b.height) });
+            if (dx * dx + dy * dy <= radius2)
+                visit(obj);
+        });
+    }
+
+    /* removes every object, the bounds and cell size stay. Handles start from 0 again. The memory is kept for reuse */
+    void clear() {
+        cells.clear();
+        std::fill(table.begin(), table.end(), NONE);
+        entries.clear();
+    }
+
+    /**
+    * removes every object and moves the grid to new bounds. The cells are scaled with the width of the bounds, like
+    * the nodes of a Quadtree, so objects moved along with the bounds take as many cells as before
+    */
+    void reset(const Bounds newBounds) {
+        clear();
+        if (bounds.width > 0 && newBounds.width > 0)
+            cellSize *= newBounds.width / bounds.width;
+        bounds = newBounds;
+    }
+
+    const Bounds& getBounds() const { return bounds; }
+
+    /* number of objects in the grid */
+    size_t size() const { return entries.size(); }
+
+    /**
+    * Writes the whole grid: writer.grid(bounds, cellSize, cellCount) once, then writer.cell(x, y, objectCount) for every
+    * cell followed by writer.object(handle, bounds, obj) for each of its objects.
+    * load gives back exactly the same grid, with the cells in the same order and the objects in the same order in every cell.
+    */
+    template<typename Writer>
+    void save(Writer& writer) const {
+        writer.grid(bounds, cellSize, cells.size());
+        for (const Cell& cell : cells) {
+            writer.cell(cell.x, cell.y, cell.run.count);
+            for (uint32_t i = cell.run.first; i < cell.run.first + cell.run.count; i++)
+                writer.object(entries.handles[i], entries.rects[i], entries.objects[i]);
+        }
+    }
+
+    /**
+    * Replaces the content of this grid, including its bounds and cell size, with a grid written by save.
+    * Returns false if the reader fails, the grid is left empty then.
+    */
+    template<typename Reader>
+    bool load(Reader& reader) {
+        clear();
+        size_t cellCount = 0;
+        if (!reader.grid(bounds, cellSize, cellCount) || !(cellSize > 0)) {
+            clear();
+            return false;
+        }
+
+        for (size_t c = 0; c < cellCount; c++) {
+            int32_t x = 0, y = 0;
+            size_t count = 0;
+            if (!reader.cell(x, y, count) || findCell(x, y) != NONE) {
+                clear();
+                return false;
+            }
+
+            uint32_t cell = makeCell(x, y);
+            for (size_t i = 0; i < count; i++) {
+                Entry entry{ Bounds{}, T{}, INVALID_SPATIAL_HANDLE };
+                // a cell holds an object once
+                if (!reader.object(entry.handle, entry.bounds, entry.obj) || entry.handle == INVALID_SPATIAL_HANDLE ||
+                    entries.find(cells[cell].run, entry.handle) >= 0 || !entries.restoreHandle(entry.handle, entry.bounds)) {
+                    clear();
+                    return false;
+                }
+                entries.push(cells[cell].run, entry);
+            }
+        }
+
+        entries.restoreFreeHandles();
+        return true;
+    }
+
+    /* Adds obj with the given bounds. The returned handle stays valid until the object is removed */
+    SpatialHandle insert(const Bounds pRect, const T obj) {
+        SpatialHandle handle = entries.addHandle(pRect);
+        const Entry entry{ pRect, obj, handle };
+
+        CellRange range = rangeOf(pRect);
+        for (int32_t y = range.minY; y <= range.maxY; y++) {
+            for (int32_t x = range.minX; x <= range.maxX; x++) {
+                uint32_t cell = cellAt(x, y);
+                entries.push(cells[cell].run, entry);
+            }
+        }
+        return handle;
+    }
+
+    /**
+    * Moves an object to new bounds. Cells that hold the object before and after keep it at its place, so objects
+    * that only shrink (segments being split) are found in the same order as before.
+    */
+    void update(SpatialHandle handle, const Bounds newBounds) {
+        if (!entries.contains(handle))
+            return;
+
+        const CellRange oldRange = rangeOf(entries.boundsOf(handle));
+        const CellRange newRange = rangeOf(newBounds);
+
+        T obj{};
+        uint32_t first = findCell(oldRange.minX, oldRange.minY);
+        int found = first == NONE ? -1 : entries.find(cells[first].run, handle);
+        if (found < 0)
+            return;
+        obj = entries.objects[cells[first].run.first + found];
+
+        entries.setBounds(handle, newBounds);
+
+        for (int32_t y = oldRange.minY; y <= oldRange.maxY; y++) {
+            for (int32_t x = oldRange.minX; x <= oldRange.maxX; x++) {
+                uint32_t cell = findCell(x, y);
+                if (cell == NONE)
+                    continue;
+                int i = entries.find(cells[cell].run, handle);
+                if (i < 0)
+                    continue;
+                if (newRange.contains(x, y))
+                    entries.rects[cells[cell].run.first + i] = newBounds;
+                else
+                    entries.erase(cells[cell].run, i);
+            }
+        }
+
+        const Entry entry{ newBounds, obj, handle };
+        for (int32_t y = newRange.minY; y <= newRange.maxY; y++) {
+            for (int32_t x = newRange.minX; x <= newRange.maxX; x++) {
+                if (oldRange.contains(x, y))
+                    continue;
+                uint32_t cell = cellAt(x, y);
+                entries.push(cells[cell].run, entry);
+            }
+        }
+    }
+
+    /* Removes an object, its handle may be handed out again. Emptied cells are kept */
+    void remove(SpatialHandle handle) {
+        if (!entries.contains(handle))
+            return;
+
+        const CellRange range = rangeOf(entries.boundsOf(handle));
+        bool removed = false;
+        for (int32_t y = range.minY; y <= range.maxY; y++) {
+            for (int32_t x = range.minX; x <= range.maxX; x++) {
+                uint32_t cell = findCell(x, y);
+                if (cell == NONE)
+                    continue;
+                int i = entries.find(cells[cell].run, handle);
+                if (i < 0)
+                    continue;
+                entries.erase(cells[cell].run, i);
+                removed = true;
+            }
+        }
+        if (removed)
+            entries.freeHandle(handle);
+    }
+
+    /* every object of the cells pRect touches, objects in several of them more than once */
+    std::vector<T> retrieve(const Bounds pRect) const {
+        std::vector<T> relevant;
+        forCellsIn(rangeOf(pRect), [&](const Cell& cell) {
+            for (uint32_t i = 0; i < cell.run.count; i++)
+                relevant.push_back(entries.objects[cell.run.first + i]);
+        });
+        return relevant;
+    }
+
+private:
+    // cell coordinate of a position, clamped so that ranges of cells can't overflow
+    int32_t cellOf(double v, double origin) const {
+        const double limit = 1 << 30;
+        double c = std::floor((v - origin) / cellSize);
+        return static_cast<int32_t>(std::max(-limit, std::min(limit, c)));
+    }
+
+    CellRange rangeOf(const Bounds& r) const {
+        return CellRange{ cellOf(r.x, bounds.x), cellOf(r.y, bounds.y),
+            cellOf(r.x + r.width, bounds.x), cellOf(r.y + r.height, bounds.y) };
+    }
+
+    static uint32_t hash(int32_t x, int32_t y) {
+        uint64_t key = (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+        key *= 0x9E3779B97F4A7C15ull;
+        return static_cast<uint32_t>(key >> 32);
+    }
+
+    uint32_t findCell(int32_t x, int32_t y) const {
+        if (table.empty())
+            return NONE;
+        const uint32_t mask = static_cast<uint32_t>(table.size()) - 1;
+        for (uint32_t slot = hash(x, y) & mask;; slot = (slot + 1) & mask) {
+            uint32_t cell = table[slot];
+            if (cell == NONE || (cells[cell].x == x && cells[cell].y == y))
+                return cell;
+        }
+    }
+
+    // the cell at x, y, made if there is none
+    uint32_t cellAt(int32_t x, int32_t y) {
+        uint32_t cell = findCell(x, y);
+        return cell != NONE ? cell : makeCell(x, y);
+    }
+
+    uint32_t makeCell(int32_t x, int32_t y) {
+        if ((cells.size() + 1) * 2 > table.size())
+            growTable();
+
+        uint32_t cell = static_cast<uint32_t>(cells.size());
+        cells.push_back(Cell{ x, y, Entries::emptyRun() });
+        placeInTable(cell);
+        return cell;
+    }
+
+    void placeInTable(uint32_t cell) {
+        const uint32_t mask = static_cast<uint32_t>(table.size()) - 1;
+        uint32_t slot = hash(cells[cell].x, cells[cell].y) & mask;
+        while (table[slot] != NONE)
+            slot = (slot + 1) & mask;
+        table[slot] = cell;
+    }
+
+    void growTable() {
+        table.assign(std::max<size_t>(64, table.size() * 2), NONE);
+        for (uint32_t cell = 0; cell < cells.size(); cell++)
+            placeInTable(cell);
+    }
+
+    // the existing cells of a range, row by row. If the range has more cells than the grid, the grid is walked instead
+    template<typename F>
+    void forCellsIn(const CellRange& range, F&& f) const {
+        if (range.cellCount() > static_cast<double>(cells.size())) {
+            for (const Cell& cell : cells) {
+                if (range.contains(cell.x, cell.y))
+                    f(cell);
+            }
+            return;
+        }
+
+        for (int32_t y = range.minY; y <= range.maxY; y++) {
+            for (int32_t x = range.minX; x <= range.maxX; x++) {
+                uint32_t cell = findCell(x, y);
+                if (cell != NONE)
+                    f(cells[cell]);
+            }
+        }
+    }
+
+    static bool overlaps(const Bounds& a, const Bounds& b) {
+        return a.x <= b.x + b.width && b.x <= a.x + a.width && a.y <= b.y + b.height && b.y <= a.y + a.height;
+    }
+
+    template<typename Visitor>
+    void queryCells(const Bounds& rect, const Visitor& visit) const {
+        forCellsIn(rangeOf(rect), [&](const Cell& cell) {
+            const Bounds* run = entries.rects.data() + cell.run.first;
+            for (uint32_t i = 0; i < cell.run.count; i++) {
+                const Bounds& b = run[i];
+                if (!overlaps(b, rect))
+                    continue;
+
+                // the corner lies in every cell of the object and of rect, exactly one cell reports it
+                double cornerX = std::max(b.x, rect.x);
+                double cornerY = std::max(b.y, rect.y);
+                if (cellOf(cornerX, bounds.x) == cell.x && cellOf(cornerY, bounds.y) == cell.y)
+                    visit(b, entries.objects[cell.run.first + i]);
+            }
+        });
+    }
+};
+
+template<typename T>
+const uint32_t HashGrid<T>::NONE;
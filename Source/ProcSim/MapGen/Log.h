@@ -0,0 +1,30 @@
+#pragma once
+
+/**
+* Logging for the generation code, so that it doesn't depend on the engine.
+* Inside Unreal it forwards to UE_LOG on LogTemp, in the headless build (PROCSIM_HEADLESS) it prints to stderr.
+* Verbosity is one of the UE verbosities: Verbose, Log, Warning or Error. The headless build drops Verbose, which
+* is meant for tracing single shapes and would bury the bench output.
+*/
+#ifdef PROCSIM_HEADLESS
+
+#include <cstdio>
+
+#define PROCSIM_LOG_ENABLED_Verbose 0
+#define PROCSIM_LOG_ENABLED_Log 1
+#define PROCSIM_LOG_ENABLED_Warning 1
+#define PROCSIM_LOG_ENABLED_Error 1
+
+#define PROCSIM_LOG(Verbosity, Format, ...) \
+	do { \
+		if (PROCSIM_LOG_ENABLED_##Verbosity) \
+			std::fprintf(stderr, #Verbosity ": " Format "\n", ##__VA_ARGS__); \
+	} while (0)
+
+#else
+
+#include "CoreMinimal.h"
+
+#define PROCSIM_LOG(Verbosity, Format, ...) UE_LOG(LogTemp, Verbosity, TEXT(Format), ##__VA_ARGS__)
+
+#endif
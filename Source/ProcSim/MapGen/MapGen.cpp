@@ -1,176 +1,302 @@
 #include "MapGen.h"
 
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <exception>
+#include <limits>
+#include <thread>
 
-bool localConstraints(Segment* segment, std::vector<Segment*>& segments, Quadtree<Segment*>& qTree,
-	DebugData& debugData, std::vector<Intersection*>& intersections) {
+// sine of Config::MINIMUM_INTERSECTION_DEVIATION, so that the angles of crossings are compared without trigonometry
+static const double MINIMUM_INTERSECTION_SINE = std::sin((Config::MINIMUM_INTERSECTION_DEVIATION * M_PI) / 180);
+
+bool localConstraints(Segment* segment, SegmentStore& segments, SpatialIndex<Segment*>& qTree,
+	DebugData& debugData, std::vector<Intersection*>& intersections, GenerationContext& context) {
 
 	if (Config::IGNORE_CONFLICTS) return true;
 
-	Action action = { 0, nullptr, 0.0 };
+	const Bounds limits = segment->limits();
+	const Point end = segment->end;
+	const double snapDistance = Config::ROAD_SNAP_DISTANCE;
+	const double snapDistance2 = snapDistance * snapDistance;
+
+	// One query over the segment and the snap area around its end. Crossings win, the one closest to the start of
+	// the segment. Otherwise the last end within snap distance of the end, otherwise the last segment passing there
+	const double minX = std::min(limits.x, end.x - snapDistance);
+	const double minY = std::min(limits.y, end.y - snapDistance);
+	const double maxX = std::max(limits.x + limits.width, end.x + snapDistance);
+	const double maxY = std::max(limits.y + limits.height, end.y + snapDistance);
+
+	// broadphase: the bounds of every candidate decide which of the exact tests it gets
+	ConstraintCandidates& candidates = context.candidates;
+	candidates.clear();
+	qTree.query(Bounds{ minX, minY, maxX - minX, maxY - minY }, [&](Segment* other) {
+		const double otherMinX = std::min(other->start.x, other->end.x);
+		const double otherMaxX = std::max(other->start.x, other->end.x);
+		const double otherMinY = std::min(other->start.y, other->end.y);
+		const double otherMaxY = std::max(other->start.y, other->end.y);
+
+		uint8_t near = 0;
+		if (otherMinX <= limits.x + limits.width && limits.x <= otherMaxX &&
+			otherMinY <= limits.y + limits.height && limits.y <= otherMaxY)
+			near |= ConstraintCandidates::NEAR_SEGMENT;
+
+		double dx = std::max({ otherMinX - end.x, 0.0, end.x - otherMaxX });
+		double dy = std::max({ otherMinY - end.y, 0.0, end.y - otherMaxY });
+		if (dx * dx + dy * dy <= snapDistance2)
+			near |= ConstraintCandidates::NEAR_END;
+
+		if (near != 0) {
+			candidates.segments.push_back(other);
+			candidates.near.push_back(near);
+			candidates.block.push(other->start, other->end);
+		}
+	});
+
+	// the exact tests of all candidates at once, then the candidates in query order
+	const CandidateTests& tests = candidates.tests;
+	BatchMath::testAll(segment->start, end, candidates.block, candidates.tests);
 
-	for (auto other : qTree.retrieve(segment->limits())) {
+	Action action;
+	for (size_t i = 0; i < candidates.segments.size(); i++) {
+		Segment* other = candidates.segments[i];
+		const uint8_t near = candidates.near[i];
 
 		// Intersection check
-		if (action.priority <= 4) {
+		if ((near & ConstraintCandidates::NEAR_SEGMENT) && tests.crosses[i] &&
+			(action.kind != Action::CROSS || tests.crossT[i] < action.t)) {
+			action.kind = Action::CROSS;
+			action.other = other;
+			action.point = Point{ tests.crossX[i], tests.crossY[i] };
+			action.t = tests.crossT[i];
+		}
 
-			LineSegmentIntersection* intersection = segment->intersectWith(other);
+		if (action.kind > Action::SNAP_TO_END || !(near & ConstraintCandidates::NEAR_END))
+			continue;
 
+		// Snap to crossing within radius check
+		if (Math::length(end, other->end) <= snapDistance) {
+			action.kind = Action::SNAP_TO_END;
+			action.other = other;
+			action.point = other->end;
+			continue;
+		}
 
-			if (intersection != nullptr) {
-				if (action.func == nullptr || intersection->t < action.t) {
-					action.t = intersection->t;
-					action.priority = 4;
+		//  intersection within radius check
+		if (action.kind <= Action::SNAP_TO_LINE &&
+			tests.distance2[i] < snapDistance2 &&
+			tests.lineProj2[i] >= 0 &&
+			tests.lineProj2[i] <= tests.length2[i]) {
+
+			action.kind = Action::SNAP_TO_LINE;
+			action.other = other;
+			action.point = Point{ tests.lineX[i], tests.lineY[i] };
+		}
+	}
 
-					action.func = [other, segment, &segments, &qTree, intersection, &debugData, &intersections]() -> bool {
+	Segment* other = action.other;
+	const Point point = action.point;
 
+	switch (action.kind) {
+	case Action::CROSS: {
+		// If intersecting lines are too similar, don't continue
+		if (Math::linesCloserThan(other->end - other->start, segment->end - segment->start, MINIMUM_INTERSECTION_SINE)) {
+			return false;
+		}
+		other->split(point, segment, segments, qTree, intersections, context);
+		segment->end = point;
+		segment->q.severed = true;
+		debugData.intersections.push_back(LineSegmentIntersection{ point.x, point.y, action.t });
+		return true;
+	}
 
+	case Action::SNAP_TO_END: {
+		segment->end = point;
+		segment->q.severed = true;
+		const std::vector<Segment*>& links = other->startIsBackwards() ? other->links_f : other->links_b;
 
-						// If intersecting lines are too similar, don't continue
-						if (Math::minDegreeDifference(other->dir(), segment->dir()) < Config::MINIMUM_INTERSECTION_DEVIATION) {
-							return false;
-						}
-						Point intersectionPoint{ intersection->x, intersection->y };
-						other->split(intersectionPoint, segment, segments, qTree, intersections);
-						segment->end = Point{ intersection->x, intersection->y };
-						segment->q.severed = true;
-						(debugData).intersections.push_back(*intersection);
-
-						return true;
-					};
-				}
+		if (std::any_of(links.begin(), links.end(), [segment](const Segment* link) {
+			return (Math::equalV(link->start, segment->end) && Math::equalV(link->end, segment->start)) ||
+				(Math::equalV(link->start, segment->start) && Math::equalV(link->end, segment->end));
+		})) {
+			return false;
+		}
+
+		for (auto link : links) {
+			bool front = false;
+			link->linksForEndContaining(other, front);
+
+			if (!front)
+			{
+				link->links_b.push_back(segment);
 			}
+			else {
+				link->links_f.push_back(segment);
+			}
+
+			segment->links_f.push_back(link);
 		}
 
-		// Snap to crossing within radius check
-		if (action.priority <= 3) {
-			if (Math::length(segment->end, other->end) <= Config::ROAD_SNAP_DISTANCE) {
-				Point point = other->end;
-				action.priority = 3;
-
-				action.func = [point, other, segment, &segments, &qTree, &debugData, &intersections]() {
-					segment->end = point;
-					segment->q.severed = true;
-					auto links = other->startIsBackwards() ? other->links_f : other->links_b;
-
-					for (auto ll : links) {
-						if ((Math::equalV(ll->start, segment->end) && Math::equalV(ll->end, segment->start)) ||
-							(Math::equalV(ll->start, segment->start) && Math::equalV(ll->end, segment->end))) {
-						}
-					}
+		segment->links_f.push_back(other);
+		debugData.snaps.push_back({ point.x, point.y });
 
-					if (std::any_of(links.begin(), links.end(), [segment](const auto link) {
-						return (Math::equalV(link->start, segment->end) && Math::equalV(link->end, segment->start)) ||
-							(Math::equalV(link->start, segment->start) && Math::equalV(link->end, segment->end));
-					})) {
-						return false;
-					}
+		// the end now meets the end of other, the topology of segments joins them when segment is added
+		return true;
+	}
 
-					for (auto link : links) {
-						bool front = false;
-						auto containing = link->linksForEndContaining(other, front);
+	case Action::SNAP_TO_LINE: {
+		segment->end = point;
+		segment->q.severed = true;
+		// if intersecting lines are too closely aligned don't continue
+		if (Math::linesCloserThan(other->end - other->start, segment->end - segment->start, MINIMUM_INTERSECTION_SINE)) {
+			return false;
+		}
 
-						if (!front)
-						{
-							link->links_b.push_back(segment);
-						}
-						else {
-							link->links_f.push_back(segment);
-						}
+		other->split(point, segment, segments, qTree, intersections, context);
+		debugData.intersectionsRadius.push_back(point);
+		return true;
+	}
 
-						segment->links_f.push_back(link);
-					}
+	default:
+		return true;
+	}
+}
 
+void branchFrom(Segment* branch, Segment* previousSegment) {
+	branch->prev = previousSegment;
+	branch->branchLinksPending = true;
+}
 
-					links.push_back(segment);
-					segment->links_f.push_back(other);
-					(debugData).snaps.push_back({ point.x, point.y });
+void linkBranch(Segment* branch) {
+	if (!branch->branchLinksPending)
+		return;
+	branch->branchLinksPending = false;
 
-					// TODO: fix
-					/* adding the newly created segment to the previously created intersection*/
-					//for (auto intersection : intersections) {
-						
-						//if (intersection->IsAtQueriedPosition(point)) {
-						//	intersection->branches.push_back(segment);
-						//	bool isStart = ((segment->start - intersection->position).length() < (segment->end - intersection->position).length());
-						//	if (isStart)
-						//		segment->startIntersectionID = intersection->ID;
-						//	else
-						//		segment->endIntersectionID = intersection->ID;
-						//	break;
-						//}
-					//}
-
-
-					return true;
-				};
-			}
-		}
+	// setup links between the branch and each existing branch stemming from the previous segment
+	Segment* prevSegment = branch->prev;
+	for (auto link : prevSegment->links_f) {
+		branch->links_b.push_back(link);
 
-		//  intersection within radius check
-		if (action.priority <= 2) {
-			Math::DistanceToLineResult distanceToLineResult = Math::distanceToLine(segment->end, other->start, other->end);
-			if (distanceToLineResult.distance2 < Config::ROAD_SNAP_DISTANCE * Config::ROAD_SNAP_DISTANCE &&
-				distanceToLineResult.lineProj2 >= 0 &&
-				distanceToLineResult.lineProj2 <= distanceToLineResult.length2) {
-
-				Point point = distanceToLineResult.pointOnLine;
-				action.priority = 2;
-
-				action.func = [segment, point, other, &segments, &qTree, &debugData, &intersections]() {
-					segment->end = point;
-					segment->q.severed = true;
-					// if intersecting lines are too closely aligned don't continue
-					if (Math::minDegreeDifference(other->dir(), segment->dir()) < Config::MINIMUM_INTERSECTION_DEVIATION) {
-						return false;
-					}
+		bool front = false;
+		auto containing = link->linksForEndContaining(prevSegment, front);
+
+		if (containing == std::vector<Segment*> {}) throw std::runtime_error("Impossible");
 
-					other->split(point, segment, segments, qTree, intersections);
-					(debugData).intersectionsRadius.push_back(Point{ point.x, point.y });
-					return true;
-				};
+		if (!front)
+			link->links_b.push_back(branch);
+		else
+			link->links_f.push_back(branch);
 
+	}
+
+	prevSegment->links_f.push_back(branch);
+	branch->links_b.push_back(prevSegment);
+}
 
+HeatmapNoise HeatmapNoise::random(int patternWidth, int patternHeight, bool completelyRandom, unsigned int seed) {
+	std::mt19937 generator(seed);
+	std::uniform_real_distribution<double> distribution(0.0, 300.0);
+	std::uniform_real_distribution<double> distribution2(50.0, 300.0);
+
+	HeatmapNoise noise;
+	noise.patternWidth = patternWidth;
+	noise.patternHeight = patternHeight;
+	noise.completelyRandom = completelyRandom;
+	noise.offsetX1 = distribution(generator);
+	noise.offsetX2 = distribution(generator);
+	noise.offsetY1 = distribution(generator);
+	noise.offsetY2 = distribution(generator);
+	noise.denominator = distribution2(generator);
+
+	/* This changes the scale. If not set to random, the noise will be zoomed in and appear less noisy*/
+	if (completelyRandom)
+		noise.denominator /= 10;
+
+	return noise;
+}
+
+unsigned char HeatmapNoise::pixelAt(double x, double y) const {
+	double value1 = (SimplexNoise::noise(x / denominator, y / denominator) + 1) / 2.0;
+	double value2 = (SimplexNoise::noise(x / (denominator * 2) + offsetX1, y / (denominator * 2) + offsetY1) + 1) / 2.0;
+	double value3 = (SimplexNoise::noise(x / (denominator * 2) + offsetX2, y / (denominator * 2) + offsetY2) + 1) / 2.0;
+
+	return static_cast<unsigned char>(255 * pow((value1 * value2 + value3) / 2, 2));
+}
+
+Heatmap::Heatmap(const HeatmapNoise& noise, int width, int height, int threadCount) :
+	completely_random(noise.completelyRandom), width(width), height(height) {
+
+	unsigned char* pixels = new unsigned char[static_cast<size_t>(width) * height];
+	image = std::shared_ptr<const unsigned char>(pixels, std::default_delete<unsigned char[]>());
+
+	// pixel (x, y) of the image samples the pattern at (x * scaleX, y * scaleY), the scales are 1 if the sizes match
+	const double scaleX = static_cast<double>(noise.patternWidth) / width;
+	const double scaleY = static_cast<double>(noise.patternHeight) / height;
+
+	/*
+	* Every pixel only depends on its position, so the rows are handed out in chunks to whichever thread is free and
+	* the image doesn't depend on the thread count.
+	*/
+	const int chunkRows = 16;
+	const int chunkCount = (height + chunkRows - 1) / chunkRows;
+	if (threadCount <= 0)
+		threadCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+	threadCount = std::min(threadCount, std::max(chunkCount, 1));
+
+	std::atomic<int> nextChunk{ 0 };
+	auto worker = [&]() {
+		for (int c = nextChunk++; c < chunkCount; c = nextChunk++) {
+			const int last = std::min((c + 1) * chunkRows, height);
+			for (int y = c * chunkRows; y < last; y++) {
+				unsigned char* row = pixels + static_cast<size_t>(y) * width;
+				for (int x = 0; x < width; x++)
+					row[x] = noise.pixelAt(x * scaleX, y * scaleY);
 			}
 		}
-	}
+	};
 
-	if (action.func != nullptr)
-	{
-		return action.func();
-	}
-	return true;
+	std::vector<std::thread> threads;
+	for (int t = 1; t < threadCount; t++)
+		threads.emplace_back(worker);
+	worker();
+	for (auto& thread : threads)
+		thread.join();
 }
 
-std::vector<Segment*> globalGoalsGenerate(Segment* previousSegment, Heatmap heatmap) {
+std::vector<Segment*> globalGoalsGenerate(Segment* previousSegment, const HeatmapView& heatmap, GenerationContext& context) {
 	std::vector<Segment*> newBranches;
+	const GeneratorConfig& config = context.config();
+	std::mt19937& random = context.random;
 
 	if (!previousSegment->q.severed) {
-		auto templateFunc = [=](
-			double direction, double length, double t, MetaInfo* q = nullptr) {
-			return Segment::usingDirection(previousSegment->end, t, *q, previousSegment->dir() + direction, length);
+		// new segments turn away from the heading of the previous one by direction degrees
+		const Point heading = previousSegment->heading();
+		auto templateFunc = [=, &context](
+			double direction, double length, double t, const MetaInfo& q) {
+			return Segment::usingHeading(context, previousSegment->end, t, q, Math::turn(heading, direction), length);
 		};
 
 		auto templateContinue = [=](double direction) {
-			return templateFunc(direction, previousSegment->length(), 0.0, &previousSegment->q);
+			return templateFunc(direction, previousSegment->length(), 0.0, previousSegment->q);
 		};
 
 		auto templateBranch = [=](double direction) {
 			return templateFunc(direction, Config::DEFAULT_SEGMENT_LENGTH,
 				previousSegment->q.highway ? Config::NORMAL_BRANCH_TIME_DELAY_FROM_HIGHWAY : 0,
-				new MetaInfo{ 0, previousSegment->q.color, previousSegment->q.severed });
+				MetaInfo{ 0, previousSegment->q.color, previousSegment->q.severed });
 		};
 
 		Segment* continueStraight = templateContinue(0);
 
-		double straightPop = heatmap.popOnRoad(*continueStraight);
+		double straightPop = heatmap.popOnRoad(*continueStraight, config);
 
 		if (previousSegment->q.highway) {
 			double maxPop = straightPop;
 			Segment* bestSegment = continueStraight;
 
 			for (int i = 0; i < Config::HIGHWAY_POPULATION_SAMPLE_SIZE; i++) {
-				Segment* curSegment = templateContinue(Config::RANDOM_STRAIGHT_ANGLE());
-				double curPop = heatmap.popOnRoad(*curSegment);
+				Segment* curSegment = templateContinue(Config::RANDOM_STRAIGHT_ANGLE(config.straightness, random));
+				double curPop = heatmap.popOnRoad(*curSegment, config);
 
 				if (curPop > maxPop) {
 					maxPop = curPop;
@@ -181,12 +307,12 @@ std::vector<Segment*> globalGoalsGenerate(Segment* previousSegment, Heatmap heat
 			newBranches.push_back(bestSegment);
 
 			if (maxPop > Config::HIGHWAY_BRANCH_POPULATION_THRESHOLD) {
-				if (std::rand() / static_cast<double>(RAND_MAX) < Config::HIGHWAY_BRANCH_PROBABILITY) {
-					newBranches.push_back(templateContinue(-90 + Config::RANDOM_BRANCH_ANGLE()));
+				if (Math::random01(random) < Config::HIGHWAY_BRANCH_PROBABILITY) {
+					newBranches.push_back(templateContinue(-90 + Config::RANDOM_BRANCH_ANGLE(config.straightness, random)));
 				}
 				else {
-					if (std::rand() / static_cast<double>(RAND_MAX) < Config::HIGHWAY_BRANCH_PROBABILITY) {
-						newBranches.push_back(templateContinue(+90 + Config::RANDOM_BRANCH_ANGLE()));
+					if (Math::random01(random) < Config::HIGHWAY_BRANCH_PROBABILITY) {
+						newBranches.push_back(templateContinue(+90 + Config::RANDOM_BRANCH_ANGLE(config.straightness, random)));
 						
 					}
 				}
@@ -197,48 +323,19 @@ std::vector<Segment*> globalGoalsGenerate(Segment* previousSegment, Heatmap heat
 		}
 
 		if (!Config::ONLY_HIGHWAYS && straightPop > Config::NORMAL_BRANCH_POPULATION_THRESHOLD) {
-			if (std::rand() / static_cast<double>(RAND_MAX) < Config::DEFAULT_BRANCH_PROBABILITY) {
-				newBranches.push_back(templateBranch(-90 + Config::RANDOM_BRANCH_ANGLE()));
+			if (Math::random01(random) < Config::DEFAULT_BRANCH_PROBABILITY) {
+				newBranches.push_back(templateBranch(-90 + Config::RANDOM_BRANCH_ANGLE(config.straightness, random)));
 			}
 			else {
-				if (std::rand() / static_cast<double>(RAND_MAX) < Config::DEFAULT_BRANCH_PROBABILITY) {
-					newBranches.push_back(templateBranch(+90 + Config::RANDOM_BRANCH_ANGLE()));
+				if (Math::random01(random) < Config::DEFAULT_BRANCH_PROBABILITY) {
+					newBranches.push_back(templateBranch(+90 + Config::RANDOM_BRANCH_ANGLE(config.straightness, random)));
 				}
 			}
 		}
 	}
 
 	for (auto branch : newBranches) {
-
-		// setup links between each current branch and each existing branch stemming from the previous segment
-
-		branch->setupBranchLinks = [branchPtr = std::shared_ptr<Segment>(branch), previousSegmentPtr = std::shared_ptr<Segment>(previousSegment)]() {
-			Segment* currentBranch = branchPtr.get();
-			Segment* prevSegment = previousSegmentPtr.get();
-
-			for (auto link : prevSegment->links_f) {
-				currentBranch->links_b.push_back(link);
-
-				bool front = false;
-				auto containing = link->linksForEndContaining(prevSegment, front);
-
-				if (containing == std::vector<Segment*> {}) throw std::runtime_error("Impossible");
-
-				if (!front)
-					link->links_b.push_back(currentBranch);
-				else
-					link->links_f.push_back(currentBranch);
-
-			}
-
-			prevSegment->links_f.push_back(currentBranch);
-			currentBranch->links_b.push_back(prevSegment);
-
-
-
-
-		};
-
+		branchFrom(branch, previousSegment);
 	}
 
 	return newBranches;
@@ -246,22 +343,22 @@ std::vector<Segment*> globalGoalsGenerate(Segment* previousSegment, Heatmap heat
 
 
 
-std::vector<Segment*> makeInitialSegments() {
+std::vector<Segment*> makeInitialSegments(GenerationContext& context, Point origin) {
 	std::vector<Segment*> segments;
 
 	// Setup first segments in queue
 
 	MetaInfo q{};
 	q.highway = !Config::START_WITH_NORMAL_STREETS;
-	Segment* rootSegment = new Segment(*(new Point{ 0,0 }), *(new Point{ Config::HIGHWAY_SEGMENT_LENGTH, 0 }), 0.0, q);
+	Segment* rootSegment = Segment::create(context, origin, Point{ origin.x + Config::HIGHWAY_SEGMENT_LENGTH, origin.y }, 0.0, q);
 
 	if (!Config::TWO_SEGMENTS_INITIALLY) {
 		segments.push_back(rootSegment);
 		return segments;
 	}
 
-	Segment* oppositeDirection = new Segment(rootSegment->start,
-		{ rootSegment->start.x - Config::HIGHWAY_SEGMENT_LENGTH, rootSegment->end.y },
+	Segment* oppositeDirection = Segment::create(context, rootSegment->start,
+		Point{ rootSegment->start.x - Config::HIGHWAY_SEGMENT_LENGTH, rootSegment->end.y },
 		0.0,
 		q);
 
@@ -276,67 +373,491 @@ std::vector<Segment*> makeInitialSegments() {
 }
 
 
-void generationStep(
+// Runs the local constraints on a segment taken from the queue and, if it is accepted, adds it to the network
+// and queues the segments growing from it. If leaving is given, accepted segments ending outside the tile of the
+// context are put there instead, generateTiled stitches them in later
+static void evaluateSegment(
+	Segment* segment,
 	PriorityQueue<Segment*>& priorityQ,
-	std::vector<Segment*>& segments,
-	Quadtree<Segment*>& qTree,
+	SegmentStore& segments,
+	SpatialIndex<Segment*>& qTree,
 	DebugData& debugData,
 	std::vector<Intersection*>& intersections,
-	Heatmap heatmap
+	const HeatmapView& heatmap,
+	GenerationContext& context,
+	std::vector<Segment*>* leaving = nullptr
 ) {
-	Segment* minSegment = priorityQ.dequeue();
-
-	if (minSegment == nullptr) throw std::runtime_error("no segment remaining");
-	bool accepted = localConstraints(minSegment, segments, qTree, debugData, intersections);
+	bool accepted = localConstraints(segment, segments, qTree, debugData, intersections, context);
 
 	if (accepted) {
 
-		if (minSegment->setupBranchLinks != nullptr) {
-			minSegment->setupBranchLinks();
-		};
+		// no action was taken for a segment still ending outside the tile, so nothing has changed yet
+		if (leaving != nullptr && !context.config().insideTile(segment->end.x, segment->end.y)) {
+			leaving->push_back(segment);
+			return;
+		}
+
+		linkBranch(segment);
 
-		segments.push_back(minSegment);
-		Bounds minSegmentLimits = minSegment->limits();
-		qTree.insert(minSegmentLimits, minSegment);
-		std::vector<Segment*> newSegments = globalGoalsGenerate(minSegment, heatmap);
+		segments.add(segment, qTree);
+		std::vector<Segment*> newSegments = globalGoalsGenerate(segment, heatmap, context);
 		for (auto newSegment : newSegments) {
 			//smth about inersections here
-			newSegment->t = minSegment->t + 1 + newSegment->t;
+			newSegment->t = segment->t + 1 + newSegment->t;
 			priorityQ.enqueue(newSegment);
 		}
 	}
 }
 
-// If there are segments intersecting they should be removed
-void removeConflictingSegments(std::vector<Segment*>& segments, Quadtree<Segment*> qTree)
-{
-	std::vector<Segment*> to_erase;
+void generationStep(
+	PriorityQueue<Segment*>& priorityQ,
+	SegmentStore& segments,
+	SpatialIndex<Segment*>& qTree,
+	DebugData& debugData,
+	std::vector<Intersection*>& intersections,
+	const HeatmapView& heatmap,
+	GenerationContext& context
+) {
+	Segment* minSegment = priorityQ.dequeue();
 
-	for (auto it = segments.begin(); it != segments.end(); ++it) {
-		Segment* segment = *it;
-		for (auto other : qTree.retrieve(segment->limits())) {
-			if (segment == other) continue;  // Ensure the segment doesn't intersect with itself
+	if (minSegment == nullptr) throw std::runtime_error("no segment remaining");
+	evaluateSegment(minSegment, priorityQ, segments, qTree, debugData, intersections, heatmap, context);
+}
 
-			auto in = segment->intersectWith(other);
-			if (in != nullptr) {
-				to_erase.push_back(segment);
-				to_erase.push_back(other);
+GenerationProgress advanceGeneration(
+	PriorityQueue<Segment*>& priorityQ,
+	SegmentStore& segments,
+	SpatialIndex<Segment*>& qTree,
+	DebugData& debugData,
+	std::vector<Intersection*>& intersections,
+	const HeatmapView& heatmap,
+	GenerationContext& context,
+	size_t segmentLimit,
+	double budgetSeconds
+) {
+	typedef std::chrono::steady_clock Clock;
+	const Clock::time_point start = Clock::now();
+
+	// a step takes a few microseconds, reading the clock after each one is cheap enough
+	while (!priorityQ.empty() && segments.size() < segmentLimit) {
+		generationStep(priorityQ, segments, qTree, debugData, intersections, heatmap, context);
+
+		if (std::chrono::duration<double>(Clock::now() - start).count() >= budgetSeconds)
+			break;
+	}
+
+	GenerationProgress progress;
+	progress.segments = segments.size();
+	progress.queued = priorityQ.size();
+	progress.finished = priorityQ.empty() || segments.size() >= segmentLimit;
+	return progress;
+}
+
+// One tile of generateTiled. Everything in here is only touched by the thread growing the tile, or between rounds
+struct GenerationTile {
+	GenerationContext* context = nullptr;
+	std::unique_ptr<PriorityQueue<Segment*>> priorityQ;
+	std::unique_ptr<SpatialIndex<Segment*>> qTree;
+	/* every segment lying in the tile */
+	SegmentStore segments;
+	/* segments before this index are in the quadtree of the whole map */
+	size_t published = 0;
+	/* accepted segments ending in another tile, waiting to be stitched in */
+	std::vector<Segment*> leaving;
+	DebugData debugData;
+	std::vector<Intersection*> intersections;
+};
+
+// The serial generation loop, restricted to one tile
+static void growTile(GenerationTile& tile, const HeatmapView& heatmap, size_t segmentLimit) {
+	while (!tile.priorityQ->empty() && tile.segments.size() < segmentLimit) {
+		Segment* segment = tile.priorityQ->dequeue();
+		evaluateSegment(segment, *tile.priorityQ, tile.segments, *tile.qTree, tile.debugData, tile.intersections,
+			heatmap, *tile.context, &tile.leaving);
+	}
+}
+
+// Cuts a segment at every tile border it crosses. The pieces are added to segments and qTree, the segment itself
+// keeps the part at its end. Pieces are not linked to each other, the cut points are added to cuts instead
+static void cutAtTileBorders(Segment* segment, const GeneratorConfig& config, int tilesX, int tilesY,
+	SegmentStore& segments, SpatialIndex<Segment*>& qTree, std::vector<Intersection*>& intersections,
+	GenerationContext& context, std::vector<Point>& cuts) {
+
+	const double tileWidth = (config.maxx - config.minx) / static_cast<double>(tilesX);
+	const double tileHeight = (config.maxy - config.miny) / static_cast<double>(tilesY);
+
+	while (true) {
+		// the first border between the current start and the end
+		double cut = 1;
+		Point d = segment->end - segment->start;
+		for (int x = 1; x < tilesX; x++) {
+			double t = d.x != 0 ? (config.minx + x * tileWidth - segment->start.x) / d.x : -1;
+			if (t > 1e-9 && t < cut)
+				cut = t;
+		}
+		for (int y = 1; y < tilesY; y++) {
+			double t = d.y != 0 ? (config.miny + y * tileHeight - segment->start.y) / d.y : -1;
+			if (t > 1e-9 && t < cut)
+				cut = t;
+		}
+		if (cut >= 1 - 1e-9)
+			return;
+
+		Point point = segment->start + d * cut;
+		segment->split(point, nullptr, segments, qTree, intersections, context);
+		Segment* piece = segments[static_cast<SegmentHandle>(segments.size() - 1)];
+
+		for (auto link : { piece, segment }) {
+			Segment* other = link == piece ? segment : piece;
+			link->links_b.erase(std::remove(link->links_b.begin(), link->links_b.end(), other), link->links_b.end());
+			link->links_f.erase(std::remove(link->links_f.begin(), link->links_f.end(), other), link->links_f.end());
+		}
+		cuts.push_back(point);
+	}
+}
+
+void generateTiled(
+	SegmentStore& segments,
+	SpatialIndex<Segment*>& qTree,
+	DebugData& debugData,
+	std::vector<Intersection*>& intersections,
+	const HeatmapView& heatmap,
+	GenerationContext& context,
+	int tilesX,
+	int tilesY,
+	int threadCount
+) {
+	const GeneratorConfig& config = context.config();
+	const size_t segmentLimit = static_cast<size_t>(std::max(config.segmentCountLimit, 0));
+	tilesX = std::max(tilesX, 1);
+	tilesY = std::max(tilesY, 1);
+	const int tileCount = tilesX * tilesY;
+	const double tileWidth = (config.maxx - config.minx) / static_cast<double>(tilesX);
+	const double tileHeight = (config.maxy - config.miny) / static_cast<double>(tilesY);
+
+	std::vector<GenerationTile> tiles(tileCount);
+	for (int i = 0; i < tileCount; i++) {
+		GeneratorConfig tileConfig = config;
+		int x = i % tilesX;
+		int y = i / tilesX;
+		tileConfig.tileMinx = static_cast<float>(config.minx + x * tileWidth);
+		tileConfig.tileMiny = static_cast<float>(config.miny + y * tileHeight);
+		tileConfig.tileMaxx = x == tilesX - 1 ? config.maxx : static_cast<float>(config.minx + (x + 1) * tileWidth);
+		tileConfig.tileMaxy = y == tilesY - 1 ? config.maxy : static_cast<float>(config.miny + (y + 1) * tileHeight);
+		tileConfig.seed = config.seed + i + 1;
+
+		context.tiles.emplace_back(new GenerationContext(tileConfig));
+		tiles[i].context = context.tiles.back().get();
+		tiles[i].priorityQ.reset(makePriorityQueue<Segment*>(Config::PRIORITY_QUEUE_TYPE, [](const Segment* s) { return s->t; }));
+		// segments may stick out of the map a bit, so the quadtrees cover the whole map instead of the tile
+		tiles[i].qTree.reset(makeSpatialIndex<Segment*>(Bounds{ config.minx, config.miny, config.maxx - config.minx, config.maxy - config.miny }));
+	}
+
+	// index of the tile containing a point, -1 outside of the map
+	auto tileAt = [&tiles](Point p) {
+		for (size_t i = 0; i < tiles.size(); i++) {
+			if (tiles[i].context->config().insideTile(p.x, p.y))
+				return static_cast<int>(i);
+		}
+		return -1;
+	};
+
+	// the tile a piece of a segment belongs to, pieces sticking out of the map belong to the closest tile
+	auto tileOfPiece = [&](Segment* piece) {
+		Point mid = (piece->start + piece->end) / 2;
+		mid.x = std::min(std::max(mid.x, static_cast<double>(config.minx)), std::nextafter(static_cast<double>(config.maxx), -DBL_MAX));
+		mid.y = std::min(std::max(mid.y, static_cast<double>(config.miny)), std::nextafter(static_cast<double>(config.maxy), -DBL_MAX));
+		return std::max(tileAt(mid), 0);
+	};
+
+	// hands the segments growing from an accepted segment to the tile they start in
+	auto queueBranches = [&](Segment* segment) {
+		for (auto branch : globalGoalsGenerate(segment, heatmap, context)) {
+			branch->t = segment->t + 1 + branch->t;
+			int tile = tileAt(branch->start);
+			if (tile >= 0)
+				tiles[tile].priorityQ->enqueue(branch);
+		}
+	};
+
+	std::vector<Point> cuts;
+	SegmentStore pieces;
+
+	/*
+	* Streets die out after a few hundred segments, the highways are what carries the growth across the map.
+	* So the highways are grown first, serially and with the usual rules. Streets branching off them are not
+	* evaluated yet but queued in the tile they start in, and the highways are cut at the tile borders.
+	*/
+	{
+		PriorityQueue<Segment*>* priorityQ = makePriorityQueue<Segment*>(Config::PRIORITY_QUEUE_TYPE, [](const Segment* s) { return s->t; });
+		for (auto segment : makeInitialSegments(context))
+			priorityQ->enqueue(segment);
+
+		while (!priorityQ->empty() && pieces.size() < segmentLimit) {
+			Segment* segment = priorityQ->dequeue();
+			int tile = tileAt(segment->start);
+			if (tile < 0)
+				continue;
+
+			if (segment->q.highway)
+				evaluateSegment(segment, *priorityQ, pieces, qTree, debugData, intersections, heatmap, context);
+			else
+				tiles[tile].priorityQ->enqueue(segment);
+		}
+		delete priorityQ;
+
+		const size_t highwayCount = pieces.size();
+		for (SegmentHandle h = 0; h < highwayCount; h++)
+			cutAtTileBorders(pieces[h], config, tilesX, tilesY, pieces, qTree, intersections, context, cuts);
+	}
+
+	// the tiles share nothing but the heatmap, which is only read
+	if (threadCount <= 0)
+		threadCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+	threadCount = std::min(threadCount, tileCount);
+
+	/*
+	* The tiles grow in rounds. In each round every tile grows from its queue until it is empty, on the worker threads.
+	* Then the segments that left their tile are stitched in serially with the same local constraints as the serial
+	* generation, now against the whole map. They are cut at the borders and the segments growing from them are
+	* queued in the tiles they start in for the next round. Everything between the rounds happens in tile order,
+	* so the result doesn't depend on which thread grew which tile.
+	*/
+	size_t segmentCount = pieces.size();
+	while (true) {
+		// hand the new pieces to their tiles. They are already in the quadtree of the whole map
+		for (auto piece : pieces) {
+			GenerationTile& tile = tiles[tileOfPiece(piece)];
+			tile.segments.add(piece, *tile.qTree);
+			tile.published = tile.segments.size();
+		}
+		pieces.clear();
+
+		// the tiles' stores don't know about their segments split while stitching
+		for (auto& tile : tiles)
+			tile.segments.syncAll();
+
+		size_t queued = 0;
+		for (auto& tile : tiles)
+			queued += tile.priorityQ->size();
+		if (queued == 0 || segmentCount >= segmentLimit)
+			break;
+
+		// the rest of the segment budget is shared in proportion to the queued segments
+		std::vector<size_t> limits(tileCount);
+		for (int i = 0; i < tileCount; i++) {
+			size_t share = (segmentLimit - segmentCount) * tiles[i].priorityQ->size() / queued;
+			limits[i] = tiles[i].segments.size() + std::max<size_t>(share, 1);
+		}
+
+		std::atomic<int> nextTile{ 0 };
+		std::vector<std::exception_ptr> errors(tileCount);
+		auto worker = [&]() {
+			for (int i = nextTile++; i < tileCount; i = nextTile++) {
+				try {
+					growTile(tiles[i], heatmap, limits[i]);
+				}
+				catch (...) {
+					errors[i] = std::current_exception();
+				}
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (int t = 1; t < threadCount; t++)
+			threads.emplace_back(worker);
+		worker();
+		for (auto& thread : threads)
+			thread.join();
+
+		for (auto& error : errors) {
+			if (error)
+				std::rethrow_exception(error);
+		}
+
+		segmentCount = 0;
+		for (auto& tile : tiles) {
+			for (size_t h = tile.published; h < tile.segments.size(); h++) {
+				Segment* segment = tile.segments[static_cast<SegmentHandle>(h)];
+				qTree.insert(segment->limits(), segment);
 			}
+			tile.published = tile.segments.size();
+			segmentCount += tile.segments.size();
 		}
+
+		for (auto& tile : tiles) {
+			for (auto segment : tile.leaving) {
+				if (segmentCount + pieces.size() >= segmentLimit)
+					break;
+				if (!localConstraints(segment, pieces, qTree, debugData, intersections, context))
+					continue;
+
+				linkBranch(segment);
+				pieces.add(segment, qTree);
+				queueBranches(segment);
+				cutAtTileBorders(segment, config, tilesX, tilesY, pieces, qTree, intersections, context, cuts);
+			}
+			tile.leaving.clear();
+		}
+		segmentCount += pieces.size();
 	}
 
-	// Sort the to_erase vector and remove duplicates for efficient erasure
-	std::sort(to_erase.begin(), to_erase.end());
-	to_erase.erase(std::unique(to_erase.begin(), to_erase.end()), to_erase.end());
+	// The tiles numbered their segments themselves, the merged network gets new IDs
+	for (auto& tile : tiles) {
+		std::vector<Segment*> tileSegments = tile.segments.pointers();
+		tile.segments.clear();
+		for (auto segment : tileSegments) {
+			segment->ID = context.segmentIDs.next();
+			segments.push_back(segment);
+		}
+
+		debugData.snaps.insert(debugData.snaps.end(), tile.debugData.snaps.begin(), tile.debugData.snaps.end());
+		debugData.intersectionsRadius.insert(debugData.intersectionsRadius.end(),
+			tile.debugData.intersectionsRadius.begin(), tile.debugData.intersectionsRadius.end());
+		debugData.intersections.insert(debugData.intersections.end(),
+			tile.debugData.intersections.begin(), tile.debugData.intersections.end());
+	}
 
-	for (auto segment : to_erase) {
-		auto it = std::find(segments.begin(), segments.end(), segment);
-		if (it != segments.end()) {
-			segments.erase(it);
+	// the quadtree of the whole map only got the bounds the tile segments had when they were published
+	segments.rebuildTree(qTree);
+
+	// link the pieces at the cuts again, they may have been split since so they are looked up by position
+	for (auto point : cuts) {
+		std::vector<Segment*> atCut;
+		qTree.query(Bounds{ point.x, point.y, 0, 0 }, [&](Segment* segment) {
+			if ((Math::equalV(segment->start, point) || Math::equalV(segment->end, point)) &&
+				segments.contains(segment) && std::find(atCut.begin(), atCut.end(), segment) == atCut.end())
+				atCut.push_back(segment);
+		});
+		for (auto segment : atCut) {
+			std::vector<Segment*>& links = Math::equalV(segment->start, point) ? segment->links_b : segment->links_f;
+			for (auto other : atCut) {
+				if (other != segment && std::find(links.begin(), links.end(), other) == links.end())
+					links.push_back(other);
+			}
 		}
 	}
 }
 
+// If there are segments intersecting they should be removed
+void removeConflictingSegments(SegmentStore& segments, SpatialIndex<Segment*>& qTree, int threadCount)
+{
+	// generation is over, the candidates come from a tree packed from the final segments instead of qTree
+	StaticRTree<Segment*> index;
+	segments.buildStaticIndex(index);
+
+	/*
+	* The segments are tested in chunks of handles on up to threadCount threads, which all read the same tree. A thread
+	* only flags the segments of its own chunks and keeps the other segment of every intersecting pair in a list of
+	* its own. The lists are merged when all threads are done, so the flags don't depend on the thread count.
+	*/
+	const size_t chunkSize = 1024;
+	const size_t chunkCount = (segments.size() + chunkSize - 1) / chunkSize;
+	if (threadCount <= 0)
+		threadCount = static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+	threadCount = static_cast<int>(std::min<size_t>(threadCount, std::max<size_t>(chunkCount, 1)));
+
+	// one flag per handle, both segments of an intersecting pair are marked
+	std::vector<char> conflicting(segments.size(), 0);
+	std::vector<std::vector<SegmentHandle>> others(threadCount);
+	std::vector<std::exception_ptr> errors(threadCount);
+	std::atomic<size_t> nextChunk{ 0 };
+
+	auto worker = [&](int t) {
+		try {
+			// the candidates of one segment, tested together
+			std::vector<Segment*> candidates;
+			CandidateBlock block;
+			CandidateTests tests;
+
+			for (size_t c = nextChunk++; c < chunkCount; c = nextChunk++) {
+				const SegmentHandle last = static_cast<SegmentHandle>(std::min((c + 1) * chunkSize, segments.size()));
+				for (SegmentHandle h = static_cast<SegmentHandle>(c * chunkSize); h < last; h++) {
+					Segment* segment = segments[h];
+
+					candidates.clear();
+					block.clear();
+					index.query(segments.limits(h), [&](Segment* other) {
+						if (segment == other) return;  // Ensure the segment doesn't intersect with itself
+						candidates.push_back(other);
+						block.push(other->start, other->end);
+					});
+
+					BatchMath::intersectAll(segments.start(h), segments.end(h), block, tests);
+					for (size_t i = 0; i < candidates.size(); i++) {
+						if (tests.crosses[i]) {
+							conflicting[h] = 1;
+							if (segments.contains(candidates[i]))
+								others[t].push_back(candidates[i]->handle);
+						}
+					}
+				}
+			}
+		}
+		catch (...) {
+			errors[t] = std::current_exception();
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int t = 1; t < threadCount; t++)
+		threads.emplace_back(worker, t);
+	worker(0);
+	for (auto& thread : threads)
+		thread.join();
+
+	for (auto& error : errors) {
+		if (error)
+			std::rethrow_exception(error);
+	}
+
+	for (const auto& handles : others) {
+		for (SegmentHandle h : handles)
+			conflicting[h] = 1;
+	}
+
+	// a single compaction instead of one erase per conflicting segment
+	segments.removeIf([&conflicting](SegmentHandle h) { return conflicting[h] != 0; }, qTree);
+}
+
+/*
+* How far apart the angles dir() gives two segments are, |dir(a) - dir(b)|, without trigonometry. The angles lie in
+* (-180, 180), and vertical segments get 0. Their difference is the angle between the segments if the shorter way from
+* one to the other passes the y axis, otherwise 360 minus it. The key only grows with the difference: 1 - cos of the
+* angle between in the first case, 3 + cos in the second. Segments of length 0 get NaN, like their dir()
+*/
+static double dirDifferenceKey(Segment* a, Segment* b)
+{
+	Point u = a->end - a->start;
+	Point v = b->end - b->start;
+	if (Math::lengthV2(u) == 0 || Math::lengthV2(v) == 0)
+		return std::numeric_limits<double>::quiet_NaN();
+	if (u.x == 0)
+		u = Point{ 0, 1 };
+	if (v.x == 0)
+		v = Point{ 0, 1 };
+
+	const double cosine = Math::dotProduct(u, v) / (Math::lengthV(u) * Math::lengthV(v));
+
+	// on the same side of the y axis the shorter way passes it, otherwise if it turns clockwise from the left one
+	bool passesYAxis = (u.x > 0) == (v.x > 0);
+	if (!passesYAxis)
+		passesYAxis = u.x > 0 ? Math::crossProduct(v, u) <= 0 : Math::crossProduct(u, v) <= 0;
+	return passesYAxis ? 1 - cosine : 3 + cosine;
+}
+
+/* the key of dirDifferenceKey for a difference of degrees, from 0 to 360 */
+static double dirDifferenceKey(double degrees)
+{
+	const double cosine = std::cos((degrees * M_PI) / 180);
+	return degrees <= 180 ? 1 - cosine : 3 + cosine;
+}
+
+// findOrderAtEnd takes two segments at an end for one road if their angles are less than 20 degrees apart,
+// arePerpendicular wants them more than 30 degrees apart
+static const double CONTINUING_DIR_KEY = dirDifferenceKey(20.0);
+static const double PERPENDICULAR_DIR_KEY = dirDifferenceKey(30.0);
+
 void findOrderAtEnd(Segment* segment, bool isStart)
 {
 	std::vector<Segment*> links = (isStart ? segment->links_b : segment->links_f);
@@ -366,7 +887,7 @@ void findOrderAtEnd(Segment* segment, bool isStart)
 	else if (links.size() == 2) {
 		if (isStart) {
 			// check the angle it has with the other two
-			if (abs(fmod(links[0]->dir(), 180) - fmod(links[1]->dir(), 180)) < 20) {
+			if (dirDifferenceKey(links[0], links[1]) < CONTINUING_DIR_KEY) {
 				// if its in the backwards links of the other
 				if (std::find(links[0]->links_b.begin(), links[0]->links_b.end(), segment) != links[0]->links_b.end()) {
 					links[0]->startOrder = segment->startOrder + 1;
@@ -388,7 +909,7 @@ void findOrderAtEnd(Segment* segment, bool isStart)
 		}
 		else {
 			// check the angle it has with the other two
-			if (abs(fmod(links[0]->dir(), 180) - fmod(links[1]->dir(), 180)) < 20) {
+			if (dirDifferenceKey(links[0], links[1]) < CONTINUING_DIR_KEY) {
 				// if its in the backwards links of the other
 				if (std::find(links[0]->links_b.begin(), links[0]->links_b.end(), segment) != links[0]->links_b.end()) {
 					links[0]->startOrder = segment->endOrder + 1;
@@ -412,8 +933,7 @@ void findOrderAtEnd(Segment* segment, bool isStart)
 	else if (links.size() >= 3) {
 		std::vector<std::pair<Segment*, double>> segmentAngles;
 		for (auto link : links) {
-			double angle = abs(fmod(link->dir(), 180) - fmod(segment->dir(), 180));
-			segmentAngles.push_back({ link, angle });
+			segmentAngles.push_back({ link, dirDifferenceKey(link, segment) });
 		}
 
 		auto cmp = [](const std::pair<Segment*, double>& lhs, const std::pair<Segment*, double>& rhs) { return (lhs.second < rhs.second);  };
@@ -444,93 +964,142 @@ void findOrderAtEnd(Segment* segment, bool isStart)
 }
 
 /* it checks roads and gives them a Z ordering based on forwards and backwards links */
-void findOrderOfRoads(std::vector<Segment*>& segments)
+void findOrderOfRoads(SegmentStore& segments)
 {
 	for (auto segment : segments) {
 		findOrderAtEnd(segment, true);
 		findOrderAtEnd(segment, false);
 	}
+	// orders are written through the links, copy them back into the arrays
+	segments.syncAll();
 }
 
 /* remove intersections with the same position */
-void removeDuplicateIntersections(std::vector<Intersection*>& intersections) {
-	std::vector<Point> seenPositions;
-
-	for (size_t i = 0; i < intersections.size(); ++i) {
-		bool isDuplicate = false;
-		for (size_t j = 0; j < seenPositions.size(); ++j) {
-			if (intersections[i]->position == seenPositions[j]) {
-				isDuplicate = true;
-				break;
-			}
+/* merge intersections that are closer than some value */
+void mergeCloseIntersections(SegmentStore& segments, std::vector<Intersection*>& intersections, GenerationContext& context,
+	double distance)
+{
+	const size_t count = intersections.size();
+	if (count < 2)
+		return;
+
+	// union-find over the intersections, the root of a cluster is its first intersection
+	std::vector<uint32_t> parent(count);
+	for (size_t i = 0; i < count; i++)
+		parent[i] = static_cast<uint32_t>(i);
+	auto find = [&parent](uint32_t i) {
+		while (parent[i] != i) {
+			parent[i] = parent[parent[i]];
+			i = parent[i];
 		}
+		return i;
+	};
 
-		if (!isDuplicate) {
-			seenPositions.push_back(intersections[i]->position);
+	// every intersection is joined with the ones before it that are closer than distance, they lie in its cell or
+	// the 8 around it. The intersections of a cell are chained through nextInCell
+	const double cellSize = distance > 0 ? distance : 1.0;
+	const uint32_t NONE = UINT32_MAX;
+	std::unordered_map<GridCell, uint32_t, GridCellHash> firstInCell;
+	std::vector<uint32_t> nextInCell(count, NONE);
+	firstInCell.reserve(count);
+
+	for (uint32_t i = 0; i < count; i++) {
+		const Point p = intersections[i]->position;
+		const GridCell cell{ static_cast<long long>(std::floor(p.x / cellSize)), static_cast<long long>(std::floor(p.y / cellSize)) };
+
+		for (long long dy = -1; dy <= 1; dy++) {
+			for (long long dx = -1; dx <= 1; dx++) {
+				auto it = firstInCell.find(GridCell{ cell.x + dx, cell.y + dy });
+				if (it == firstInCell.end())
+					continue;
+				for (uint32_t j = it->second; j != NONE; j = nextInCell[j]) {
+					if ((intersections[j]->position - p).length() >= distance)
+						continue;
+					uint32_t a = find(i);
+					uint32_t b = find(j);
+					if (a != b)
+						parent[std::max(a, b)] = std::min(a, b);
+				}
+			}
 		}
-		else {
-			delete intersections[i]; // Don't forget to deallocate memory if necessary
-			intersections.erase(intersections.begin() + i);
-			--i; // Decrement to adjust for removed element
+
+		auto inserted = firstInCell.insert({ cell, i });
+		if (!inserted.second) {
+			nextInCell[i] = inserted.first->second;
+			inserted.first->second = i;
 		}
 	}
-}
 
-/* merge intersections that are closer than some value */
-void mergeCloseIntersections(std::vector<Intersection*>& intersections) {
-	
-	// lambda function for comparing two intersections based on their distance to origin
-	auto compareIntersectionsBasedOnDistanceToOrigin = [](const Intersection* inter1, const Intersection* inter2) {
-		return (inter1->position.length() < inter2->position.length());
+	// the members of every cluster in order, chained from their root through nextMember
+	std::vector<uint32_t> nextMember(count, NONE);
+	std::vector<uint32_t> lastMember(count, NONE);
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t root = find(i);
+		if (root != i)
+			nextMember[lastMember[root]] = i;
+		lastMember[root] = i;
+	}
+
+	/*
+	* A cluster becomes one intersection at the mean position of its members, with the branches of all of them, in
+	* place of its first member. The intersection IDs of the branch ends that pointed to a member are rewritten in
+	* the same sweep, the other ends keep theirs.
+	*/
+	size_t kept = 0;
+	size_t merged = 0;
+	struct BranchEnds {
+		Segment* segment;
+		int startID;
+		int endID;
+		bool startInCluster;
+		bool endInCluster;
 	};
+	std::vector<BranchEnds> branchEnds;
+	for (uint32_t i = 0; i < count; i++) {
+		if (find(i) != i)
+			continue;
+		if (nextMember[i] == NONE) {
+			intersections[kept++] = intersections[i];
+			continue;
+		}
 
-	// sort the intersections based on their distance to origin
-	std::sort(intersections.begin(), intersections.end(), compareIntersectionsBasedOnDistanceToOrigin);
-
-	// iterate through the intersections
-	for (auto it = intersections.begin(); it != intersections.end() - 1;) {
-		auto thisIntersection = *it;
-		auto nextIntersection = *(it + 1);
-		/* if adjacent intersections are close than some distance */
-		if ((thisIntersection->position - nextIntersection->position).length() < Config::DEFAULT_ROADPART_LENGTH) {
-			/* their position shall be averaged */
-			Point newPosition = (thisIntersection->position + nextIntersection->position) / 2;
-			/* dont include duplicate segments when merging two intersections */
-			std::unordered_set<int> uniqueIDs;
-			std::vector<Segment*> uniqueSegments;
-			/* for the first intersection just include all the branches */
-			for (auto branch : thisIntersection->branches) {
-				uniqueIDs.insert(branch->ID);
-				uniqueSegments.push_back(branch);
-			}
-			/* for the second one, check with the ones already added, if not present then add */
-			for (auto branch : nextIntersection->branches) {
-				if (uniqueIDs.find(branch->ID) != uniqueIDs.end()) {
-					uniqueIDs.insert(branch->ID);
-					uniqueSegments.push_back(branch);
-				}
+		Point position{ 0, 0 };
+		size_t members = 0;
+		std::vector<Segment*> branches;
+		branchEnds.clear();
+		for (uint32_t m = i; m != NONE; m = nextMember[m]) {
+			position = position + intersections[m]->position;
+			members++;
+			for (auto branch : intersections[m]->branches) {
+				if (std::find(branches.begin(), branches.end(), branch) == branches.end())
+					branches.push_back(branch);
 			}
-
-			Intersection* newIntersection = new Intersection(uniqueSegments, newPosition);
-			*it = newIntersection;
-			
-			// now fix the startIntersectionID and endIntersectionID for all the segments inside
-			for (auto segment : newIntersection->branches) {
-				bool isStart = ((segment->start - newIntersection->position).length() < (segment->end - newIntersection->position).length());
-				if (isStart)
-					segment->startIntersectionID = newIntersection->ID;
-				else
-					segment->endIntersectionID = newIntersection->ID;
+		}
+		for (auto branch : branches) {
+			bool startInCluster = false;
+			bool endInCluster = false;
+			for (uint32_t m = i; m != NONE; m = nextMember[m]) {
+				startInCluster = startInCluster || branch->startIntersectionID == intersections[m]->ID;
+				endInCluster = endInCluster || branch->endIntersectionID == intersections[m]->ID;
 			}
-
-			UE_LOG(LogTemp, Warning, TEXT("deleted something"));
-			it = intersections.erase(it + 1);
+			branchEnds.push_back(BranchEnds{ branch, branch->startIntersectionID, branch->endIntersectionID, startInCluster, endInCluster });
 		}
-		else {
-			++it;
+
+		// the constructor gives the ID to the closest end of every branch, which isn't always the end in the cluster
+		Intersection* intersection = Intersection::create(context, std::move(branches), position / static_cast<double>(members));
+		for (const BranchEnds& ends : branchEnds) {
+			ends.segment->startIntersectionID = ends.startInCluster ? intersection->ID : ends.startID;
+			ends.segment->endIntersectionID = ends.endInCluster ? intersection->ID : ends.endID;
+			segments.sync(ends.segment);
 		}
+
+		intersections[kept++] = intersection;
+		merged += members;
 	}
+	intersections.resize(kept);
 
+	if (merged > 0)
+		PROCSIM_LOG(Log, "merged %d close intersections into %d", static_cast<int>(merged), static_cast<int>(merged - (count - kept)));
 }
 
 /*  > this functions is used to cut a road off by speficic amount at specified end. 
@@ -553,41 +1122,43 @@ void cutRoadFromSpecifiedEndBySpecifiedAmount(Segment* segment, bool isStart, do
 		// normalize
 		direction = { direction.x / sqrt(direction.x * direction.x + direction.y * direction.y),
 					direction.y / sqrt(direction.x * direction.x + direction.y * direction.y) };
-		// multiply by amount
-		Point directionMultipliedByAmount = direction * amount;
 		// set the point
 		segment->end = segment->end + direction * amount;
 	}
 	// (this is all in 2D)
 }
 
-void cutRoadsLeadingIntoIntersections(std::vector<Segment*>& segments, std::vector<Intersection*> intersections)
+void cutRoadsLeadingIntoIntersections(SegmentStore& segments, const std::vector<Intersection*>& intersections)
 {
+	// the segments by ID, instead of searching all of them for every branch
+	IdTable segmentIndex;
+	for (SegmentHandle h = 0; h < segments.size(); h++)
+		segmentIndex.insert(segments[h]->ID, h);
+
 	// iterate over intersections
 	for (auto intersection : intersections) {
 		// iterate over segments inside the intersections
 		for (auto intersectionSegment : intersection->branches) {
 			// find the segment from the list of all segments
-			int currentSegmentID = intersectionSegment->ID;
-			for (auto it = segments.begin(); it != segments.end(); ++it) {
-				if ((*it)->ID == currentSegmentID) {
-					auto currentSegment = *it;
-					// don't cut if smaller than specified amount
-					bool canCut = currentSegment->length() > 1000;
-					// we have to cut off currentSegment, NOT intersectionSegment. throw that away
-					bool isStart = (currentSegment->start - intersection->position).length() < (currentSegment->end - intersection->position).length();
-					if (isStart && canCut) {
-						// prune start point by a specific amount
-						// TODO: calculate this amount based on road width and angles
-						cutRoadFromSpecifiedEndBySpecifiedAmount(currentSegment, true, 600);
-					}
-					else if (!isStart && canCut) {
-						// prune end point by a specific amount
-						// TODO: calculate this amount based on road width and angles
-						cutRoadFromSpecifiedEndBySpecifiedAmount(currentSegment, false, 600);
-					}
-				}
+			if (!segmentIndex.contains(intersectionSegment->ID))
+				continue;
+			SegmentHandle h = segmentIndex.find(intersectionSegment->ID);
+			auto currentSegment = segments[h];
+			// don't cut if smaller than specified amount
+			bool canCut = currentSegment->length() > 1000;
+			// we have to cut off currentSegment, NOT intersectionSegment. throw that away
+			bool isStart = (currentSegment->start - intersection->position).length() < (currentSegment->end - intersection->position).length();
+			if (isStart && canCut) {
+				// prune start point by a specific amount
+				// TODO: calculate this amount based on road width and angles
+				cutRoadFromSpecifiedEndBySpecifiedAmount(currentSegment, true, 600);
+			}
+			else if (!isStart && canCut) {
+				// prune end point by a specific amount
+				// TODO: calculate this amount based on road width and angles
+				cutRoadFromSpecifiedEndBySpecifiedAmount(currentSegment, false, 600);
 			}
+			segments.sync(h);
 		}
 	}
 }
@@ -606,7 +1177,7 @@ bool arePerpendicular(Segment* s1, Segment* s2)
 	double cosineTheta = dot / (mag_v1 * mag_v2);
 	return cosineTheta >= -0.866025 && cosineTheta <= 0.866025;*/
 
-	return abs(fmod(s1->dir(), 180) - fmod(s2->dir(), 180)) > 30;
+	return dirDifferenceKey(s1, s2) > PERPENDICULAR_DIR_KEY;
 
 
 }
@@ -616,57 +1187,130 @@ bool isClose(Point pos1, Point pos2)
 	return (pos1 - pos2).length() < 0.0001;
 }
 
-struct PointHash {
-	size_t operator()(const Point& p) const {
-		return std::hash<double>()(p.x) ^ std::hash<double>()(p.y);
+void weldSegmentEnds(SegmentStore& segments, std::vector<Intersection*>& intersections, GenerationContext& context, double distance)
+{
+	if (distance != segments.getTopology().getWeldDistance())
+		segments.reweld(distance);
+	const SegmentTopology& topology = segments.getTopology();
+
+	// every segment is linked to the other segments at its ends
+	for (SegmentHandle h = 0; h < segments.size(); h++) {
+		Segment* segment = segments[h];
+		segment->links_b.clear();
+		segment->links_f.clear();
+		segments.forLinks(h, true, [segment](Segment* other) { segment->links_b.push_back(other); });
+		segments.forLinks(h, false, [segment](Segment* other) { segment->links_f.push_back(other); });
 	}
-};
 
-void populateSegmentLinks(std::vector<Segment*>& segments) {
-	// Map for storing segments based on their start or end points
-	std::unordered_map<Point, std::vector<Segment*>, PointHash> segmentsMap;
-
-	// Populate the map
-	for (Segment* segment : segments) {
-		segmentsMap[segment->start].push_back(segment);
-		segmentsMap[segment->end].push_back(segment);
+	// and every node is an intersection of its segments, made when its first end comes up. That segment comes last
+	std::vector<char> made(topology.nodeCapacity(), 0);
+	intersections.reserve(intersections.size() + topology.nodeCount());
+	for (SegmentHandle h = 0; h < segments.size(); h++) {
+		for (uint32_t e = 2 * h; e < 2 * h + 2; e++) {
+			const SegmentTopology::NodeHandle node = topology.nodeOf(e);
+			if (made[node])
+				continue;
+			made[node] = 1;
+
+			Segment* segment = segments[h];
+			std::vector<Segment*> branches = e % 2 == 0 ? segment->links_b : segment->links_f;
+			branches.push_back(segment);
+			intersections.push_back(Intersection::create(context, std::move(branches), topology.position(node)));
+		}
 	}
 
-	// Populate links for each segment
-	for (Segment* segment : segments) {
-		// Populate links_b for the segment's start point
-		if (segmentsMap.find(segment->start) != segmentsMap.end()) {
-			segment->links_b = segmentsMap[segment->start];
-		}
+	// intersections set the intersection IDs of their branches
+	segments.syncAll();
+}
 
-		// Populate links_f for the segment's end point
-		if (segmentsMap.find(segment->end) != segmentsMap.end()) {
-			segment->links_f = segmentsMap[segment->end];
-		}
+/* scales segments and intersections and moves them by offset, used to go from generation to world coordinates */
+void transformSegmentsAndIntersections(SegmentStore& segments, std::vector<Intersection*>& intersections, SpatialIndex<Segment*>& qTree,
+	double scale, Point offset)
+{
+	for (SegmentHandle h = 0; h < segments.size(); h++) {
+		segments.setStart(h, segments.start(h) * scale + offset);
+		segments.setEnd(h, segments.end(h) * scale + offset);
+	}
 
-		// Removing current segment from its own links_b and links_f
-		segment->links_b.erase(std::remove(segment->links_b.begin(), segment->links_b.end(), segment), segment->links_b.end());
-		segment->links_f.erase(std::remove(segment->links_f.begin(), segment->links_f.end(), segment), segment->links_f.end());
+	// the quadtree moves along, with all segments at their new bounds
+	const Bounds& b = qTree.getBounds();
+	Point corner = Point{ b.x, b.y } * scale + offset;
+	Point opposite = Point{ b.x + b.width, b.y + b.height } * scale + offset;
+	qTree.reset(Bounds{ std::min(corner.x, opposite.x), std::min(corner.y, opposite.y),
+		std::abs(opposite.x - corner.x), std::abs(opposite.y - corner.y) });
+	segments.rebuildTree(qTree);
+
+	for (auto intersection : intersections) {
+		intersection->position = intersection->position * scale + offset;
 	}
 }
 
-void GenerateIntersections(std::vector<Segment*>& segments, std::vector<Intersection*>& intersections)
+/* Remove segments and intersections outside of the region */
+void removeOutsideOfRegion(SegmentStore& segments, std::vector<Intersection*>& intersections, SpatialIndex<Segment*>& qTree,
+	float minx, float maxx, float miny, float maxy)
 {
-	std::unordered_set<Point> seenPoints{};
+	auto isOutside = [minx, maxx, miny, maxy](float x, float y) {
+		return (x > maxx || x < minx || y > maxy || y < miny);
+	};
 
-	for (auto segment : segments) {
+	// iterate over all segments, select the ones outside of the region
+	// remove it from the branches vector from each of the intersections containing it
+	// then remove the segment itself
+	std::vector<char> outside(segments.size(), 0);
+
+	// the intersections by ID, so a segment is taken out of its intersections with two lookups
+	IdTable intersectionIndex;
+	for (size_t i = 0; i < intersections.size(); i++)
+		intersectionIndex.insert(intersections[i]->ID, static_cast<uint32_t>(i));
+
+	// erase segment from the branches vector of the intersection with this ID
+	auto detach = [&intersections, &intersectionIndex](int ID, Segment* segment) {
+		if (!intersectionIndex.contains(ID))
+			return;
+		std::vector<Segment*>& branches = intersections[intersectionIndex.find(ID)]->branches;
+		auto it = std::find(branches.begin(), branches.end(), segment);
+		if (it != branches.end())
+			branches.erase(it);
+	};
 
-		auto func = [&segment, &seenPoints, &intersections](Point pos, std::vector<Segment*> links) {
-			if (seenPoints.find(pos) == seenPoints.end()) {
-				links.push_back(segment);
-				Intersection* intersection = new Intersection(links, pos);
-				intersections.push_back(intersection);
-				seenPoints.insert(pos);
-			}
-		};
-		
-		func(segment->start, segment->links_b);
-		func(segment->end, segment->links_f);
+	for (SegmentHandle h = 0; h < segments.size(); h++) {
+		bool startOutside = isOutside(segments.startX[h], segments.startY[h]);
+		bool endOutside = isOutside(segments.endX[h], segments.endY[h]);
 
+		if (startOutside || endOutside) {
+			outside[h] = 1;
+			detach(segments.startIntersectionID[h], segments[h]);
+			detach(segments.endIntersectionID[h], segments[h]);
+		}
+	}
+
+	// usually most segments are outside. Taking them out of qTree one by one means a search and a shift in a crowded
+	// leaf for each, putting the remaining ones in again is linear
+	segments.removeIf([&outside](SegmentHandle h) { return outside[h] != 0; });
+	segments.rebuildTree(qTree);
+
+	// the intersections outside of the region leave a tombstone in the table and are dropped in one compaction
+	size_t kept = 0;
+	for (size_t i = 0; i < intersections.size(); i++) {
+		Intersection* intersection = intersections[i];
+		if (isOutside(intersection->position.x, intersection->position.y)) {
+			intersectionIndex.remove(intersection->ID);
+			continue;
+		}
+		intersections[kept++] = intersection;
+	}
+	const bool removedIntersections = kept < intersections.size();
+	intersections.resize(kept);
+
+	// detach the remaining segments from the removed intersections in one pass
+	if (removedIntersections) {
+		for (SegmentHandle h = 0; h < segments.size(); h++) {
+			if (intersectionIndex.wasRemoved(segments.startIntersectionID[h])) {
+				segments.setStartIntersectionID(h, -1);
+			}
+			if (intersectionIndex.wasRemoved(segments.endIntersectionID[h])) {
+				segments.setEndIntersectionID(h, -1);
+			}
+		}
 	}
 }
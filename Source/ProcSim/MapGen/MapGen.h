@@ -3,16 +3,21 @@
 #include <iostream>
 #include <vector>
 #include <unordered_set>
-#include <functional>
 #include <algorithm>
 #include <climits>
 #include <memory>
 #include <unordered_map>
+#include <cstdint>
 
 #include "Config.h"
-#include "Quadtree.h"
+#include "SpatialIndex.h"
+#include "StaticRTree.h"
+#include "SegmentTopology.h"
+#include "PriorityQueue.h"
+#include "GenerationContext.h"
 #include "Math.h"
 #include "SimplexNoise.h"
+#include "Log.h"
 #include <random>
 
 struct MetaInfo {
@@ -21,13 +26,17 @@ struct MetaInfo {
 	bool severed;
 };
 
+/** index of a segment in a SegmentStore, 32 bits are enough and keep the handle arrays small */
+typedef uint32_t SegmentHandle;
+const SegmentHandle INVALID_SEGMENT_HANDLE = UINT32_MAX;
+
 class Intersection;
+class SegmentStore;
 
 class Segment {
 
 public:
-	/** each segment has a unique ID and a static int to track the current generated ID **/
-	static int IDTracker;
+	/** each segment has an ID, unique within its generation (handed out by GenerationContext::segmentIDs) **/
 	int ID{};
 	/* these positions are used two give width to the segment */
 	double startOrder{ -1 };
@@ -49,20 +58,31 @@ public:
 	*
 	* the backwards links are which segments merge with this road segment at it's this.start point,
 	* the forwards links are which segments split off at the end point
+	*
+	* they are kept by the growth rules while generating, weldSegmentEnds sets them again from the topology of the
+	* SegmentStore at the end
 	*/
 	std::vector<Segment*> links_b {};
 	std::vector<Segment*> links_f {};
 	double width;
-	std::function<void()> setupBranchLinks = nullptr;
 	Point start;
 	Point end;
 
-	Segment* prev;
+	/* the segment this one branches off from, null for the initial segments */
+	Segment* prev = nullptr;
+	/* set by branchFrom: the links to prev are still to be made by linkBranch */
+	bool branchLinksPending = false;
+
+	/* position of this segment in the SegmentStore it was added to, invalid while it is not stored */
+	SegmentHandle handle{ INVALID_SEGMENT_HANDLE };
 
-	Segment(Point start, Point end, double t = 0, MetaInfo q = {}) : start(start), end(end), t(t), q(q) {
+	Segment(int ID, Point start, Point end, double t = 0, MetaInfo q = {}) : ID(ID), t(t), q(q), start(start), end(end) {
 		width = q.highway ? Config::HIGHWAY_SEGMENT_WIDTH : Config::DEFAULT_SEGMENT_WIDTH;
-		ID = IDTracker;
-		IDTracker += 1;
+	}
+
+	/* creates a segment in the arena of the context, with the next segment ID of the context */
+	static Segment* create(GenerationContext& context, Point start, Point end, double t = 0, MetaInfo q = {}) {
+		return context.arena.create<Segment>(context.segmentIDs.next(), start, end, t, q);
 	}
 
 	double dir() {
@@ -71,6 +91,14 @@ public:
 		return -1 * Math::sign(Math::crossProduct({ 0, 1 }, { dx, dy })) * Math::angleBetween({ 0, 1 }, { dx, dy });
 	}
 
+	/* the direction of dir() as a unit vector */
+	Point heading() const {
+		double dx = end.x - start.x;
+		double dy = end.y - start.y;
+		double length = std::sqrt(dx * dx + dy * dy);
+		return { dx / length, dy / length };
+	}
+
 	double length() {
 		return sqrt(pow(end.x - start.x, 2) + pow(end.y - start.y, 2));
 	}
@@ -101,8 +129,9 @@ public:
 			return ba;
 		}
 		else {
+			// only the pieces generateTiled cuts out of a road at the tile borders have no links, they grow from the start
 			if (links_f.empty())
-				throw std::runtime_error("No backwards or forward links: impossible");
+				return true;
 
 			return Math::equalV(links_f[0]->start, end) || Math::equalV(links_f[0]->end, end);
 		}
@@ -132,34 +161,343 @@ public:
    * left example in https://phiresky.github.io/procedural-cities/img/20151213214559.png
    *
    * @param point the coordinates the split will be at
-   * @param thirdSegment the third segment that will be joined to the newly created crossing
+   * @param thirdSegment the third segment that will be joined to the newly created crossing, null to only cut this one in two
    * @param segmentList the full list of all segments (new segment will be added here)
-   * @param qTree quadtree for faster finding of segments (new segment will be added here)
+   * @param qTree spatial index for faster finding of segments (new segment will be added here)
    */
 
 	/* this is defined outside of the class because it depends on the Intersection class*/
-	inline void split(Point point, Segment* thirdSegment, std::vector<Segment*>& segmentList, Quadtree<Segment*>& qTree, std::vector<Intersection*>& intersections);
+	inline void split(Point point, Segment* thirdSegment, SegmentStore& segmentList, SpatialIndex<Segment*>& qTree,
+		std::vector<Intersection*>& intersections, GenerationContext& context);
 
 
-	Segment* clone() {
-		return new Segment(start, end, t, q);
+	Segment* clone(GenerationContext& context) {
+		return create(context, start, end, t, q);
 	}
 
-	static Segment* usingDirection(const Point& start, double t, const MetaInfo& q = {}, double dir = 90, double length = Config::DEFAULT_SEGMENT_LENGTH) {
+	static Segment* usingDirection(GenerationContext& context, const Point& start, double t, const MetaInfo& q = {}, double dir = 90, double length = Config::DEFAULT_SEGMENT_LENGTH) {
 		Point end = {
 			start.x + length * std::sin((dir * M_PI) / 180),
 			start.y + length * std::cos((dir * M_PI) / 180)
 		};
-		return new Segment(start, end, t, q);
+		return create(context, start, end, t, q);
 	}
 
-	LineSegmentIntersection* intersectWith(const Segment* s) {
+	/* like usingDirection, with the direction as a unit vector */
+	static Segment* usingHeading(GenerationContext& context, const Point& start, double t, const MetaInfo& q, const Point& heading, double length) {
+		Point end = {
+			start.x + length * heading.x,
+			start.y + length * heading.y
+		};
+		return create(context, start, end, t, q);
+	}
+
+	OptionalIntersection intersectWith(const Segment* s) const {
 		return Math::doLineSegmentsIntersect(start, end, s->start, s->end, true);
 	}
 
 };
 
-int Segment::IDTracker = 0;
+/**
+* The accepted segments of a generation.
+*
+* Segments still live in the generation arena and keep their cold data there (links, meta info, prev and the
+* branchLinksPending flag that linkBranch clears), but the fields read by every pass over the whole network (end points, width, delay, flags, intersection IDs and
+* orders) are mirrored in contiguous arrays indexed by SegmentHandle. Passes that only need those fields walk the
+* arrays linearly instead of dereferencing one heap object per segment.
+*
+* The setters write through to the Segment object. Code that changes a stored segment through its pointer
+* (e.g. Segment::split) calls sync() afterwards so that both sides stay the same.
+*
+* A store can also keep the spatial index entries of its segments: segments added with add(segment, qTree) are moved
+* in the index by sync(segment, qTree) and taken out of it by removeIf(pred, qTree), so the index always
+* has the current bounds.
+*
+* It also keeps which segment ends meet (a SegmentTopology) up to date through the same calls. The topology lives
+* alongside the links of the segments, it doesn't replace them: the growth rules still read links_b and links_f,
+* and weldSegmentEnds builds the final links and the intersections from the topology.
+*/
+class SegmentStore {
+public:
+	enum Flag : uint8_t {
+		HIGHWAY = 1 << 0,
+		SEVERED = 1 << 1
+	};
+
+	std::vector<double> startX;
+	std::vector<double> startY;
+	std::vector<double> endX;
+	std::vector<double> endY;
+	std::vector<double> width;
+	std::vector<double> t;
+	std::vector<uint8_t> flags;
+	std::vector<int> startIntersectionID;
+	std::vector<int> endIntersectionID;
+	std::vector<double> startOrder;
+	std::vector<double> endOrder;
+	/* entry of the segment in the spatial index kept with this store, INVALID_SPATIAL_HANDLE if it was added without one */
+	std::vector<SpatialHandle> treeEntry;
+
+	SegmentHandle add(Segment* segment) {
+		SegmentHandle handle = static_cast<SegmentHandle>(segments.size());
+		segment->handle = handle;
+		segments.push_back(segment);
+
+		startX.push_back(0); startY.push_back(0);
+		endX.push_back(0); endY.push_back(0);
+		width.push_back(0);
+		t.push_back(0);
+		flags.push_back(0);
+		startIntersectionID.push_back(-1);
+		endIntersectionID.push_back(-1);
+		startOrder.push_back(-1);
+		endOrder.push_back(-1);
+		treeEntry.push_back(INVALID_SPATIAL_HANDLE);
+		topology.resize(2 * segments.size());
+
+		sync(handle);
+		return handle;
+	}
+
+	/* adds the segment to the store and to qTree with its current bounds */
+	SegmentHandle add(Segment* segment, SpatialIndex<Segment*>& qTree) {
+		SegmentHandle handle = add(segment);
+		treeEntry[handle] = qTree.insert(limits(handle), segment);
+		return handle;
+	}
+
+	/* same as add, so the store can be filled like the vector it replaces */
+	void push_back(Segment* segment) {
+		add(segment);
+	}
+
+	/* copies the fields of the Segment object into the arrays */
+	void sync(SegmentHandle handle) {
+		const Segment* segment = segments[handle];
+		placeEnds(handle, segment->start, segment->end);
+		startX[handle] = segment->start.x;
+		startY[handle] = segment->start.y;
+		endX[handle] = segment->end.x;
+		endY[handle] = segment->end.y;
+		width[handle] = segment->width;
+		t[handle] = segment->t;
+		flags[handle] = (segment->q.highway ? HIGHWAY : 0) | (segment->q.severed ? SEVERED : 0);
+		startIntersectionID[handle] = segment->startIntersectionID;
+		endIntersectionID[handle] = segment->endIntersectionID;
+		startOrder[handle] = segment->startOrder;
+		endOrder[handle] = segment->endOrder;
+	}
+
+	/* does nothing for segments that are not in the store */
+	void sync(const Segment* segment) {
+		if (contains(segment))
+			sync(segment->handle);
+	}
+
+	/* same as sync, and moves the segment to its new bounds in qTree */
+	void sync(const Segment* segment, SpatialIndex<Segment*>& qTree) {
+		if (!contains(segment))
+			return;
+		sync(segment->handle);
+		if (treeEntry[segment->handle] != INVALID_SPATIAL_HANDLE)
+			qTree.update(treeEntry[segment->handle], limits(segment->handle));
+	}
+
+	void syncAll() {
+		for (SegmentHandle h = 0; h < segments.size(); h++)
+			sync(h);
+	}
+
+	bool contains(const Segment* segment) const {
+		return segment->handle < segments.size() && segments[segment->handle] == segment;
+	}
+
+	size_t size() const { return segments.size(); }
+
+	bool empty() const { return segments.empty(); }
+
+	Segment* get(SegmentHandle handle) const { return segments[handle]; }
+
+	Segment* operator[](SegmentHandle handle) const { return segments[handle]; }
+
+	/* the stored segments in handle order */
+	const std::vector<Segment*>& pointers() const { return segments; }
+
+	std::vector<Segment*>::const_iterator begin() const { return segments.begin(); }
+
+	std::vector<Segment*>::const_iterator end() const { return segments.end(); }
+
+	Point start(SegmentHandle handle) const { return { startX[handle], startY[handle] }; }
+
+	Point end(SegmentHandle handle) const { return { endX[handle], endY[handle] }; }
+
+	bool isHighway(SegmentHandle handle) const { return (flags[handle] & HIGHWAY) != 0; }
+
+	/* same as Segment::limits, from the arrays */
+	Bounds limits(SegmentHandle handle) const {
+		double minX = std::min(startX[handle], endX[handle]);
+		double minY = std::min(startY[handle], endY[handle]);
+		double w = std::abs(startX[handle] - endX[handle]);
+		double h = std::abs(startY[handle] - endY[handle]);
+		return { minX, minY, w, h };
+	}
+
+	void setStart(SegmentHandle handle, Point p) {
+		placeEnds(handle, p, end(handle));
+		startX[handle] = p.x;
+		startY[handle] = p.y;
+		segments[handle]->start = p;
+	}
+
+	void setEnd(SegmentHandle handle, Point p) {
+		placeEnds(handle, start(handle), p);
+		endX[handle] = p.x;
+		endY[handle] = p.y;
+		segments[handle]->end = p;
+	}
+
+	void setStartIntersectionID(SegmentHandle handle, int id) {
+		startIntersectionID[handle] = id;
+		segments[handle]->startIntersectionID = id;
+	}
+
+	void setEndIntersectionID(SegmentHandle handle, int id) {
+		endIntersectionID[handle] = id;
+		segments[handle]->endIntersectionID = id;
+	}
+
+	/**
+	* Removes every segment for which pred(handle) is true and compacts the arrays, keeping the order of the others.
+	* Handles of the remaining segments change, removed segments get INVALID_SEGMENT_HANDLE. Returns the number removed.
+	*/
+	template<typename Pred>
+	size_t removeIf(Pred pred) {
+		SegmentHandle kept = 0;
+		const SegmentHandle count = static_cast<SegmentHandle>(segments.size());
+
+		for (SegmentHandle h = 0; h < count; h++) {
+			if (pred(h)) {
+				segments[h]->handle = INVALID_SEGMENT_HANDLE;
+				topology.detach(2 * h);
+				topology.detach(2 * h + 1);
+				continue;
+			}
+			if (kept != h)
+				moveEntry(h, kept);
+			kept++;
+		}
+
+		resize(kept);
+		return count - kept;
+	}
+
+	/* same as removeIf, the removed segments are also removed from qTree */
+	template<typename Pred>
+	size_t removeIf(Pred pred, SpatialIndex<Segment*>& qTree) {
+		return removeIf([this, &pred, &qTree](SegmentHandle h) {
+			if (!pred(h))
+				return false;
+			if (treeEntry[h] != INVALID_SPATIAL_HANDLE)
+				qTree.remove(treeEntry[h]);
+			return true;
+		});
+	}
+
+	/* adds every segment to qTree again with its current bounds, e.g. after qTree was reset or the segments moved */
+	void rebuildTree(SpatialIndex<Segment*>& qTree) {
+		qTree.clear();
+		for (SegmentHandle h = 0; h < segments.size(); h++)
+			treeEntry[h] = qTree.insert(limits(h), segments[h]);
+	}
+
+	/* packs every segment into index with its current bounds, for the passes that only read the network */
+	void buildStaticIndex(StaticRTree<Segment*>& index) const {
+		index.clear();
+		index.reserve(segments.size());
+		for (SegmentHandle h = 0; h < segments.size(); h++)
+			index.add(limits(h), segments[h]);
+		index.build();
+	}
+
+	void clear() {
+		for (auto segment : segments)
+			segment->handle = INVALID_SEGMENT_HANDLE;
+		topology.clear();
+		resize(0);
+	}
+
+	/* which segment ends meet */
+	const SegmentTopology& getTopology() const { return topology; }
+
+	/* calls visit(other) for every other segment whose start or end meets the start (atStart) or end of the segment, in handle order */
+	template<typename Visitor>
+	void forLinks(SegmentHandle handle, bool atStart, Visitor&& visit) const {
+		const SegmentTopology::NodeHandle node = topology.nodeOf(2 * handle + (atStart ? 0 : 1));
+		if (node == SegmentTopology::NONE)
+			return;
+		topology.forEndsAt(node, [&](uint32_t e) {
+			if (e / 2 != handle)
+				visit(segments[e / 2]);
+		});
+	}
+
+	/* finds the meeting ends again, with a new weld distance */
+	void reweld(double weldDistance) {
+		topology.reset(weldDistance);
+		for (SegmentHandle h = 0; h < segments.size(); h++) {
+			topology.attach(2 * h, start(h));
+			topology.attach(2 * h + 1, end(h));
+		}
+	}
+
+private:
+	std::vector<Segment*> segments;
+	SegmentTopology topology;
+
+	// moves the ends of a segment in the topology, if they moved
+	void placeEnds(SegmentHandle handle, Point newStart, Point newEnd) {
+		if (topology.nodeOf(2 * handle) == SegmentTopology::NONE || !(start(handle) == newStart))
+			topology.attach(2 * handle, newStart);
+		if (topology.nodeOf(2 * handle + 1) == SegmentTopology::NONE || !(end(handle) == newEnd))
+			topology.attach(2 * handle + 1, newEnd);
+	}
+
+	void moveEntry(SegmentHandle from, SegmentHandle to) {
+		segments[to] = segments[from];
+		segments[to]->handle = to;
+		startX[to] = startX[from];
+		startY[to] = startY[from];
+		endX[to] = endX[from];
+		endY[to] = endY[from];
+		width[to] = width[from];
+		t[to] = t[from];
+		flags[to] = flags[from];
+		startIntersectionID[to] = startIntersectionID[from];
+		endIntersectionID[to] = endIntersectionID[from];
+		startOrder[to] = startOrder[from];
+		endOrder[to] = endOrder[from];
+		treeEntry[to] = treeEntry[from];
+		topology.move(2 * from, 2 * to);
+		topology.move(2 * from + 1, 2 * to + 1);
+	}
+
+	void resize(size_t n) {
+		segments.resize(n);
+		startX.resize(n);
+		startY.resize(n);
+		endX.resize(n);
+		endY.resize(n);
+		width.resize(n);
+		t.resize(n);
+		flags.resize(n);
+		startIntersectionID.resize(n);
+		endIntersectionID.resize(n);
+		startOrder.resize(n);
+		endOrder.resize(n);
+		treeEntry.resize(n);
+		topology.resize(2 * n);
+	}
+};
 
 class Intersection {
 
@@ -168,11 +506,10 @@ public:
 	std::vector<Segment*> branches{};
 	Point position{};
 
-	static int IDTracker;
+	/* unique within the generation, handed out by GenerationContext::intersectionIDs */
 	int ID{};
 
-	Intersection(std::vector<Segment*> branches, Point position) : branches(branches), position(position) {
-		ID = IDTracker;
+	Intersection(int ID, std::vector<Segment*> branches, Point position) : branches(branches), position(position), ID(ID) {
 		for (auto branch : branches) {
 			bool isStart = (branch->start - position).length() < (branch->end - position).length();
 			if (isStart)
@@ -180,28 +517,29 @@ public:
 			else
 				branch->endIntersectionID = ID;
 		}
+	}
 
-		IDTracker++;
+	/* creates an intersection in the arena of the context, with the next intersection ID of the context */
+	static Intersection* create(GenerationContext& context, std::vector<Segment*> branches, Point position) {
+		return context.arena.create<Intersection>(context.intersectionIDs.next(), std::move(branches), position);
 	}
 
 	bool IsAtQueriedPosition(Point pos) { return ((this->position - pos).length() < 0.0001); };
 
 	void printIntersection() {
-		UE_LOG(LogTemp, Warning, TEXT("Intersection: %d, Position is: (%f,%f)"), branches.size(), position.x, position.y);
+		PROCSIM_LOG(Warning, "Intersection: %d, Position is: (%f,%f)", static_cast<int>(branches.size()), position.x, position.y);
 	}
 };
 
-int Intersection::IDTracker = 0;
-
-void Segment::split(Point point, Segment* thirdSegment, std::vector<Segment*>& segmentList, Quadtree<Segment*>& qTree, std::vector<Intersection*>& intersections) {
+void Segment::split(Point point, Segment* thirdSegment, SegmentStore& segmentList, SpatialIndex<Segment*>& qTree,
+	std::vector<Intersection*>& intersections, GenerationContext& context) {
 	
-	Segment* splitPart = clone();
+	Segment* splitPart = clone(context);
 	bool startIsBackwards = this->startIsBackwards();
-	segmentList.push_back(splitPart);
-	Bounds pRect = splitPart->limits();
-	qTree.insert(pRect, splitPart);
 	splitPart->end = point;
 	start = point;
+	segmentList.add(splitPart, qTree);
+	segmentList.sync(this, qTree);
 	splitPart->links_b = links_b;
 	splitPart->links_f = links_f;
 
@@ -238,153 +576,152 @@ void Segment::split(Point point, Segment* thirdSegment, std::vector<Segment*>& s
 
 
 	}
+	if (thirdSegment == nullptr) {
+		firstSplit->links_f = { secondSplit };
+		secondSplit->links_b = { firstSplit };
+		return;
+	}
+
 	firstSplit->links_f = { thirdSegment, secondSplit };
 	secondSplit->links_b = { thirdSegment, firstSplit };
 	thirdSegment->links_f.push_back(firstSplit);
 	thirdSegment->links_f.push_back(secondSplit);
 
-	/* Adding new intersection */
-	
-	// TODO: fix
-	//Intersection* intersection = new Intersection(std::vector<Segment*>{firstSplit, secondSplit, thirdSegment}, point);
-	//intersections.push_back(intersection);
-
+	// the three segments meet at point in the topology of segmentList once thirdSegment is added, the intersection is made from there
 }
 
 
-/* This class is used to store the heatmap image data in the form of a shared pointer to an unsigned char[]*/
-class Heatmap {
+/**
+* Immutable view of the heatmap image. The pixels are reference counted and shared by every copy of the view,
+* so passing a view around (by value or by reference) never copies the image.
+*/
+class HeatmapView {
 public:
 
-	/* these variables are */
-	bool completely_random;
-	
-	std::unique_ptr<unsigned char[]> image;
-	int width{};
-	int height{};
+	HeatmapView() = default;
 
-	// Copy constructor
-	Heatmap(const Heatmap& other) : width(other.width), height(other.height),
-		completely_random(other.completely_random) {
-		image = std::make_unique<unsigned char[]>(width * height);
-		std::copy(other.image.get(), other.image.get() + (width * height), image.get());
-	}
-
-	// This constructor is used to create a random Heatmap
-	Heatmap(int width, int height) : width(width), height(height) {
-		
-		image = std::make_unique<unsigned char[]>(width * height);
-		
-		/* random parameters for simplex noise*/
-		std::random_device rd;
-		std::mt19937 generator(rd());
-		std::uniform_real_distribution<double> distribution(0.0, 300.0);
-		std::uniform_real_distribution<double> distribution2(50.0, 300.0);
-		double offset_x1 = distribution(generator);
-		double offset_x2 = distribution(generator);
-		double offset_y1 = distribution(generator);
-		double offset_y2 = distribution(generator);
-
-		double denominator = distribution2(generator);
-
-		/* This changes the scale. If not set to random, the noise will be zoomed in and appear less noisy*/
-		if (Config::COMPLETELYRANDOM)
-			denominator /= 10;
-
-		/* Iterate over pixels and create the noisy image */
-		for (int y = 0; y < height; y++) {
-			for (int x = 0; x < width; x++) {
-
-				double value1 = (SimplexNoise::noise(x / denominator, y / denominator) + 1) / 2.0;
-				double value2 = (SimplexNoise::noise(x / (denominator * 2) + offset_x1, y / (denominator * 2) + offset_y1) + 1) / 2.0;
-				double value3 = (SimplexNoise::noise(x / (denominator * 2) + offset_x2, y / (denominator * 2) + offset_y2) + 1) / 2.0;
-
-				this->image[y * width + x] = static_cast<int>(255 * pow((value1 * value2 + value3) / 2, 2));
-			}
-		}
-	}
+	HeatmapView(std::shared_ptr<const unsigned char> pixels, int width, int height) :
+		pixels(std::move(pixels)), width(width), height(height) {}
 
-	// This constructor is used after an image is loaded from the disk
-	Heatmap(unsigned char* loadedImage, int width, int height) : width(width), height(height) {
-		image = std::unique_ptr<unsigned char[]>(loadedImage);
-	}
+	bool isValid() const { return pixels != nullptr; }
 
-	// Returns the heatmap image
-	std::unique_ptr<unsigned char[]> getImage() {
-		return std::move(image);
-	}
+	const unsigned char* data() const { return pixels.get(); }
 
-	// Set the heatmap image
-	void setImage(std::unique_ptr<unsigned char[]> img) {
-		image = std::move(img);
-	}
+	int getWidth() const { return width; }
+
+	int getHeight() const { return height; }
 
 	// Takes segment as input and calculates the population along it
-	double popOnRoad(const Segment& r) {
-		return (populationAt(r.start.x, r.start.y) + populationAt(r.end.x, r.end.y)) / 2.0;
+	double popOnRoad(const Segment& r, const GeneratorConfig& config) const {
+		return (populationAt(r.start.x, r.start.y, config) + populationAt(r.end.x, r.end.y, config)) / 2.0;
 	}
 
-	// Transforms (x,y) real coordinates to image coordinates from the heatmap
-	double populationAt(double x, double y) {
+	// Transforms (x,y) real coordinates to image coordinates from the heatmap. The image covers the map of the config
+	double populationAt(double x, double y, const GeneratorConfig& config) const {
 		// To generate title page of the presentation: if(x < 7000 && y < 3500 && x > -7000 && y > 2000) return 0; else if(1) return Math.random()/4+config.NORMAL_BRANCH_POPULATION_THRESHOLD;
-		
-		if (x < Config::minx || x > Config::maxx || y < Config::miny || y > Config::maxy)
+
+		if (x < config.minx || x > config.maxx || y < config.miny || y > config.maxy)
 			return 0.0;
-		
-		int newx = static_cast<int>((Config::maxx - x) * (this->width / (Config::maxx - Config::minx)));
 
-		int newy = static_cast<int>((Config::maxy - y) * (this->height / (Config::maxy - Config::miny)));
+		int newx = static_cast<int>((config.maxx - x) * (this->width / (config.maxx - config.minx)));
+
+		int newy = static_cast<int>((config.maxy - y) * (this->height / (config.maxy - config.miny)));
 		int idx = newy * width + newx;
-		auto aa = this->image[idx];
+		auto aa = this->pixels.get()[idx];
 
 		return static_cast<double>(aa) / 255.0;
 	}
-};
 
-struct DebugData {
-	std::vector<Point> snaps;
-	std::vector<Point> intersectionsRadius;
-	std::vector<LineSegmentIntersection> intersections;
+private:
+	std::shared_ptr<const unsigned char> pixels;
+	int width{};
+	int height{};
 };
 
-struct Action {
-	int priority;
-	std::function<bool()> func = nullptr;
-	double t;
+/**
+* The random parameters of a simplex noise heatmap. They make a pattern patternWidth x patternHeight pixels large,
+* which Heatmap renders at any resolution: a larger image shows the same pattern in more detail.
+*/
+struct HeatmapNoise {
+	int patternWidth{};
+	int patternHeight{};
+
+	/* if true, the heatmap will be very noisy and random */
+	bool completelyRandom{};
+
+	double offsetX1{};
+	double offsetX2{};
+	double offsetY1{};
+	double offsetY2{};
+	double denominator = 1;
+
+	/* random parameters for simplex noise, drawn from seed */
+	static HeatmapNoise random(int patternWidth, int patternHeight, bool completelyRandom, unsigned int seed);
+
+	/* the pixel at (x, y) of the pattern, in pixels of the pattern */
+	unsigned char pixelAt(double x, double y) const;
 };
 
-template<typename T>
-class PriorityQueue {
+/* This class creates the heatmap image (random or from a loaded image). The image is handed out as a HeatmapView */
+class Heatmap {
 public:
-	std::vector<T> elements;
-	std::function<int(T)> getPriority;
 
-	PriorityQueue(std::function<int(T)> priorityFunc) : getPriority(priorityFunc) {}
+	/* if true, the heatmap will be very noisy and random */
+	bool completely_random{};
 
-	void enqueue(const T item) {
-		elements.push_back(item);
-	}
+	int width{};
+	int height{};
 
-	T dequeue() {
-		int minT = INT_MAX;
-		int minT_i = 0;
+	Heatmap(const Heatmap& other) = delete;
+	Heatmap& operator=(const Heatmap& other) = delete;
 
-		for (size_t i = 0; i < elements.size(); ++i) {
-			int t = getPriority(elements[i]);
-			if (t < minT) {
-				minT = t;
-				minT_i = i;
-			}
-		}
+	// This constructor is used to create a random Heatmap, its pattern is as large as the image
+	Heatmap(int width, int height, bool completelyRandom, int threadCount = 0) :
+		Heatmap(HeatmapNoise::random(width, height, completelyRandom, std::random_device()()), width, height, threadCount) {}
 
-		T minValue = elements[minT_i];
-		elements.erase(elements.begin() + minT_i);
-		return minValue;
-	}
+	/**
+	* Renders the pattern of noise at width x height. The rows are filled on up to threadCount threads (all cores if
+	* threadCount <= 0), the image is the same for every count.
+	*/
+	Heatmap(const HeatmapNoise& noise, int width, int height, int threadCount = 0);
+
+	// This constructor is used after an image is loaded from the disk. The loaded buffer is shared, not copied
+	Heatmap(std::shared_ptr<const unsigned char> loadedImage, int width, int height) :
+		width(width), height(height), image(std::move(loadedImage)) {}
 
-	bool empty() const {
-		return elements.empty();
+	// Returns a view sharing the heatmap image
+	HeatmapView view() const {
+		return HeatmapView(image, width, height);
 	}
+
+private:
+	std::shared_ptr<const unsigned char> image;
+};
+
+struct DebugData {
+	std::vector<Point> snaps;
+	std::vector<Point> intersectionsRadius;
+	std::vector<LineSegmentIntersection> intersections;
+};
+
+/* the best way found by localConstraints to fit a segment in, applied once every candidate was looked at */
+struct Action {
+	/* a kind with a higher value wins over the lower ones */
+	enum Kind {
+		NONE = 0,
+		/* end the segment on other, where it passes within snap distance of the end */
+		SNAP_TO_LINE = 2,
+		/* end the segment on the end of other */
+		SNAP_TO_END = 3,
+		/* cut the segment where it crosses other */
+		CROSS = 4
+	};
+
+	Kind kind = NONE;
+	Segment* other = nullptr;
+	Point point{ 0, 0 };
+	/* where the segment crosses other, from 0 at its start to 1 at its end */
+	double t = 0;
 };
 
 struct GeneratorResult {
@@ -393,31 +730,108 @@ struct GeneratorResult {
 	Quadtree<Segment> qTree;
 };
 
-bool localConstraints(Segment* segment, std::vector<Segment*>& segments, Quadtree<Segment*>& qTree,
-	DebugData& debugData, std::vector<Intersection*>& intersections);
+bool localConstraints(Segment* segment, SegmentStore& segments, SpatialIndex<Segment*>& qTree,
+	DebugData& debugData, std::vector<Intersection*>& intersections, GenerationContext& context);
+
+/* makes branch grow from previousSegment: sets prev, the two are linked by linkBranch once branch is accepted */
+void branchFrom(Segment* branch, Segment* previousSegment);
 
-std::vector<Segment*> globalGoalsGenerate(Segment* previousSegment, Heatmap heatmap);
+/* links a branch to the segment it grows from and to the other branches of that segment, if branchFrom left that to do */
+void linkBranch(Segment* branch);
 
-std::vector<Segment*> makeInitialSegments();
+std::vector<Segment*> globalGoalsGenerate(Segment* previousSegment, const HeatmapView& heatmap, GenerationContext& context);
+
+std::vector<Segment*> makeInitialSegments(GenerationContext& context, Point origin = Point{ 0, 0 });
 
 void generationStep(
 	PriorityQueue<Segment*>& priorityQ,
-	std::vector<Segment*>& segments,
-	Quadtree<Segment*>& qTree,
+	SegmentStore& segments,
+	SpatialIndex<Segment*>& qTree,
+	DebugData& debugData,
+	std::vector<Intersection*>& intersections,
+	const HeatmapView& heatmap,
+	GenerationContext& context
+);
+
+/* how far a generation has come, returned by advanceGeneration */
+struct GenerationProgress {
+	/* accepted segments */
+	size_t segments = 0;
+	/* segments waiting to be evaluated */
+	size_t queued = 0;
+	/* the queue is empty or the segment limit is reached */
+	bool finished = false;
+};
+
+/**
+* The generationStep loop in slices: runs steps until the queue is empty, segmentLimit segments are accepted or
+* budgetSeconds have passed. At least one step is done per call, so every call makes progress.
+*/
+GenerationProgress advanceGeneration(
+	PriorityQueue<Segment*>& priorityQ,
+	SegmentStore& segments,
+	SpatialIndex<Segment*>& qTree,
 	DebugData& debugData,
 	std::vector<Intersection*>& intersections,
-	Heatmap heatmap
+	const HeatmapView& heatmap,
+	GenerationContext& context,
+	size_t segmentLimit,
+	double budgetSeconds
 );
 
-void removeConflictingSegments(std::vector<Segment*>& segments, Quadtree<Segment*> qTree);
+/**
+* Parallel version of the generationStep loop for large maps. The map of the context's config is split into
+* tilesX * tilesY tiles. The highways are grown serially first and cut at the tile borders, then the streets
+* are grown in rounds: every tile grows its queued segments with its share of the segment limit on up to
+* threadCount threads (all cores if threadCount <= 0), and only accepts segments that end inside the tile.
+* Between the rounds the segments leaving a tile are stitched in with localConstraints, in tile order, and their
+* branches are queued in the tile they grow into, so the result doesn't depend on threadCount.
+*
+* Unlike the serial loop nothing grows outside of the map. The accepted segments are added to segments and qTree
+* like the serial loop does. They live in the arenas of context.tiles, segments created outside of the tiles live
+* in the arena of the context.
+*/
+void generateTiled(
+	SegmentStore& segments,
+	SpatialIndex<Segment*>& qTree,
+	DebugData& debugData,
+	std::vector<Intersection*>& intersections,
+	const HeatmapView& heatmap,
+	GenerationContext& context,
+	int tilesX,
+	int tilesY,
+	int threadCount = 0
+);
+
+/**
+* Removes both segments of every intersecting pair from segments and qTree. The pairs are found in a StaticRTree of
+* the segments on up to threadCount threads (all cores if threadCount <= 0), the result is the same for every count.
+*/
+void removeConflictingSegments(SegmentStore& segments, SpatialIndex<Segment*>& qTree, int threadCount = 0);
 void findOrderAtEnd(Segment* segment, bool isStart);
-void findOrderOfRoads(std::vector<Segment*>& segments);
-void removeDuplicateIntersections(std::vector<Intersection*>& intersections);
-void mergeCloseIntersections(std::vector<Intersection*>& intersections);
+void findOrderOfRoads(SegmentStore& segments);
+/**
+* Merges every cluster of intersections closer than distance to each other into one intersection at their mean
+* position, with the branches of all of them. Clusters are found with a hashed grid and union-find in about linear
+* time. The branch ends that pointed to a merged intersection get the ID of the new one, also in segments.
+*/
+void mergeCloseIntersections(SegmentStore& segments, std::vector<Intersection*>& intersections, GenerationContext& context,
+	double distance = Config::DEFAULT_ROADPART_LENGTH);
 void cutRoadFromSpecifiedEndBySpecifiedAmount(Segment* segment, bool isStart, double amount);
-void cutRoadsLeadingIntoIntersections(std::vector<Segment*>& segments, std::vector<Intersection*> intersections);
+void cutRoadsLeadingIntoIntersections(SegmentStore& segments, const std::vector<Intersection*>& intersections);
 
 bool arePerpendicular(Segment* s1, Segment* s2);
 bool isClose(Point pos1, Point pos2);
-void populateSegmentLinks(std::vector<Segment*>& segments);
-void GenerateIntersections(std::vector<Segment*>& segments, std::vector<Intersection*>& intersections);
\ No newline at end of file
+
+/**
+* Reads the meeting segment ends off the topology the store keeps (welded at distance, the store welds its ends
+* again first if it used another distance). Every segment gets the other segments at its start in links_b and at its
+* end in links_f, and every node becomes an Intersection of its segments at the node's position. Links and
+* intersections come out in handle order, start first.
+*/
+void weldSegmentEnds(SegmentStore& segments, std::vector<Intersection*>& intersections, GenerationContext& context,
+	double distance = Config::ENDPOINT_WELD_DISTANCE);
+void transformSegmentsAndIntersections(SegmentStore& segments, std::vector<Intersection*>& intersections, SpatialIndex<Segment*>& qTree,
+	double scale, Point offset);
+void removeOutsideOfRegion(SegmentStore& segments, std::vector<Intersection*>& intersections, SpatialIndex<Segment*>& qTree,
+	float minx, float maxx, float miny, float maxy);
\ No newline at end of file
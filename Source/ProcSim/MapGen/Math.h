@@ -3,8 +3,12 @@
 #include <algorithm>
 #include <cmath>
 #include <cstdlib>
+#include <functional>
+#include <random>
 
+#ifndef M_PI
 # define M_PI           3.14159265358979323846
+#endif
 
 class Point {
 public:
@@ -42,6 +46,15 @@ public:
         return sqrt(pow(x, 2) + pow(y, 2));
     }
 
+    // unit vector in the same direction, zero vector if the length is (almost) zero
+    Point normalized() const {
+        double length2 = x * x + y * y;
+        if (length2 < 1e-8)
+            return { 0, 0 };
+        double l = std::sqrt(length2);
+        return { x / l, y / l };
+    }
+
     double dot(const Point& other) {
         return x * other.x + y * other.y;
     }
@@ -85,6 +98,25 @@ struct LineSegmentIntersection {
     double t;
 };
 
+/* Result of an intersection test, returned by value so that testing candidates never allocates.
+   Converts to false when the segments don't intersect, otherwise behaves like a pointer to the intersection */
+struct OptionalIntersection {
+    bool found = false;
+    LineSegmentIntersection value{};
+
+    explicit operator bool() const {
+        return found;
+    }
+
+    const LineSegmentIntersection& operator*() const {
+        return value;
+    }
+
+    const LineSegmentIntersection* operator->() const {
+        return &value;
+    }
+};
+
 class Math {
 public:
     static Point subtractPoints(const Point& p1, const Point& p2) {
@@ -95,13 +127,14 @@ public:
         return a.x * b.y - a.y * b.x;
     }
 
-    static LineSegmentIntersection* doLineSegmentsIntersect(const Point& a, const Point& b, const Point& p, const Point& d, bool c) {
+    static OptionalIntersection doLineSegmentsIntersect(const Point& a, const Point& b, const Point& p, const Point& d, bool c) {
         Point bb = subtractPoints(b, a);
         Point dd = subtractPoints(d, p);
         double f = crossProduct(subtractPoints(p, a), bb);
         double k = crossProduct(bb, dd);
+        OptionalIntersection result;
         if ((0 == f && 0 == k) || 0 == k) {
-            return nullptr;
+            return result;
         }
         f /= k;
         double e = crossProduct(subtractPoints(p, a), dd) / k;
@@ -109,13 +142,12 @@ public:
             ? (0.001 < e && 0.999 > e && 0.001 < f && 0.999 > f)
             : (0 <= e && 1 >= e && 0 <= f && 1 >= f);
         if (intersect) {
-            LineSegmentIntersection* result = new LineSegmentIntersection();
-            result->x = a.x + e * bb.x;
-            result->y = a.y + e * bb.y;
-            result->t = e;
-            return result;
+            result.found = true;
+            result.value.x = a.x + e * bb.x;
+            result.value.y = a.y + e * bb.y;
+            result.value.t = e;
         }
-        return nullptr;
+        return result;
     }
 
     static double minDegreeDifference(double val1, double val2) {
@@ -154,6 +186,32 @@ public:
 
     }
 
+    /*
+    * Directions as vectors instead of angles. Angles turn clockwise from the y axis like Segment::dir, the direction
+    * of the angle a is (sin a, cos a).
+    */
+
+    // a turned clockwise by degrees, no turn and right angles are exact and need no trigonometry
+    static Point turn(const Point& a, double degrees) {
+        if (degrees == 0)
+            return a;
+        if (degrees == 90)
+            return { a.y, -a.x };
+        if (degrees == -90)
+            return { -a.y, a.x };
+        double radians = (degrees * M_PI) / 180;
+        double s = std::sin(radians);
+        double c = std::cos(radians);
+        return { a.x * c + a.y * s, a.y * c - a.x * s };
+    }
+
+    // whether the lines along a and b are closer than the angle whose sine is given (0 to 90 degrees), like
+    // minDegreeDifference of their angles. Lines of length 0 are never close
+    static bool linesCloserThan(const Point& a, const Point& b, double sine) {
+        double cross = crossProduct(a, b);
+        return cross * cross < sine * sine * lengthV2(a) * lengthV2(b);
+    }
+
     static int sign(double a) {
         return (0 < a) ? 1 : ((0 > a) ? -1 : 0);
     }
@@ -163,40 +221,55 @@ public:
         return { a.x + bb.x * e, a.y + bb.y * e };
     }
 
-    static double randomRange(double a, double b) {
-        return std::rand() / (RAND_MAX + 1.0) * (b - a) + a;
+    // uniform in [0, 1). Computed from the raw engine output instead of std::uniform_real_distribution,
+    // whose results differ between standard libraries, so a seed gives the same numbers on every platform
+    static double random01(std::mt19937& random) {
+        return random() / (static_cast<double>(std::mt19937::max()) + 1.0);
+    }
+
+    static double randomRange(std::mt19937& random, double a, double b) {
+        return random01(random) * (b - a) + a;
     }
 
     static Point addPoints(const Point& a, const Point& b) {
         return { a.x + b.x, a.y + b.y };
     }
 
-    static struct DistanceToLineResult {
+    struct DistanceToLineResult {
         double distance2;
         Point pointOnLine;
         double lineProj2;
         double length2;
-    } distanceToLine(const Point& a, const Point& b, const Point& e) {
+    };
+
+    struct ProjectResult {
+        double dotProduct;
+        Point projected;
+    };
+
+    static DistanceToLineResult distanceToLine(const Point& a, const Point& b, const Point& e) {
         Point d = subtractPoints(a, b);
         Point ee = subtractPoints(e, b);
-        struct DistanceToLineResult result;
+        DistanceToLineResult result;
         result.distance2 = length2(addPoints(b, project(d, ee).projected), a);
         result.pointOnLine = addPoints(b, project(d, ee).projected);
         result.lineProj2 = sign(project(d, ee).dotProduct) * lengthV2(project(d, ee).projected);
         result.length2 = lengthV2(ee);
         return result;
     }
-    static struct ProjectResult {
-        double dotProduct;
-        Point projected;
-    } project(const Point& a, const Point& b) {
+    static ProjectResult project(const Point& a, const Point& b) {
         double e = dotProduct(a, b);
-        struct ProjectResult result;
+        ProjectResult result;
         result.dotProduct = e;
         result.projected = multVScalar(b, e / lengthV2(b));
         return result;
     }
 
+    // cross product of (a.x, a.y, 0) with (0, 0, z), the result lies in the xy plane again
+    static Point crossWithZ(const Point& a, double z) {
+        return { a.y * z, -a.x * z };
+    }
+
     static Point multVScalar(const Point& a, double b) {
         return { a.x * b, a.y * b };
     }
@@ -213,11 +286,11 @@ public:
         return { lerp(a.x, b.x, x), lerp(a.y, b.y, x) };
     }
 
-    static double randomNearCubic(double b) {
+    static double randomNearCubic(std::mt19937& random, double b) {
         double d = std::pow(std::abs(b), 3);
         double c = 0;
-        while (c == 0 || std::rand() / (RAND_MAX + 1.0) < std::pow(std::abs(c), 3) / d) {
-            c = randomRange(-b, b);
+        while (c == 0 || random01(random) < std::pow(std::abs(c), 3) / d) {
+            c = randomRange(random, -b, b);
         }
         return c;
     }
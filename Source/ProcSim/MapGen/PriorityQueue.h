@@ -0,0 +1,194 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+
+#include "Config.h"
+
+/**
+* Priority queues used by the generation loop. The element with the lowest priority is dequeued first,
+* elements with the same priority are dequeued in the order they were enqueued.
+* All implementations give exactly the same order, so they can be swapped without changing the output.
+*/
+template<typename T>
+class PriorityQueue {
+public:
+	std::function<int(T)> getPriority;
+
+	PriorityQueue(std::function<int(T)> priorityFunc) : getPriority(priorityFunc) {}
+	virtual ~PriorityQueue() = default;
+
+	virtual void enqueue(const T item) = 0;
+	virtual T dequeue() = 0;
+	virtual bool empty() const = 0;
+	virtual size_t size() const = 0;
+};
+
+/* Original implementation: scans all elements on every dequeue. O(n) per dequeue */
+template<typename T>
+class LinearPriorityQueue : public PriorityQueue<T> {
+public:
+	std::vector<T> elements;
+
+	LinearPriorityQueue(std::function<int(T)> priorityFunc) : PriorityQueue<T>(priorityFunc) {}
+
+	void enqueue(const T item) override {
+		elements.push_back(item);
+	}
+
+	T dequeue() override {
+		int minT = INT_MAX;
+		int minT_i = 0;
+
+		for (size_t i = 0; i < elements.size(); ++i) {
+			int t = this->getPriority(elements[i]);
+			if (t < minT) {
+				minT = t;
+				minT_i = i;
+			}
+		}
+
+		T minValue = elements[minT_i];
+		elements.erase(elements.begin() + minT_i);
+		return minValue;
+	}
+
+	bool empty() const override {
+		return elements.empty();
+	}
+
+	size_t size() const override {
+		return elements.size();
+	}
+};
+
+/* Binary min-heap. Priority is evaluated once on enqueue, ties are broken by an insertion counter. O(log n) */
+template<typename T>
+class HeapPriorityQueue : public PriorityQueue<T> {
+private:
+	struct Entry {
+		int priority;
+		uint64_t order;
+		T item;
+	};
+
+	// std heap functions build a max-heap, so "less" means "dequeued later"
+	static bool later(const Entry& a, const Entry& b) {
+		if (a.priority != b.priority)
+			return a.priority > b.priority;
+		return a.order > b.order;
+	}
+
+	std::vector<Entry> heap;
+	uint64_t counter = 0;
+
+public:
+	HeapPriorityQueue(std::function<int(T)> priorityFunc) : PriorityQueue<T>(priorityFunc) {}
+
+	void enqueue(const T item) override {
+		heap.push_back(Entry{ this->getPriority(item), counter++, item });
+		std::push_heap(heap.begin(), heap.end(), later);
+	}
+
+	T dequeue() override {
+		if (heap.empty())
+			throw std::runtime_error("dequeue from empty priority queue");
+
+		std::pop_heap(heap.begin(), heap.end(), later);
+		T minValue = heap.back().item;
+		heap.pop_back();
+		return minValue;
+	}
+
+	bool empty() const override {
+		return heap.empty();
+	}
+
+	size_t size() const override {
+		return heap.size();
+	}
+};
+
+/**
+* Bucket (calendar) queue: one FIFO bucket per integer priority, kept in a sliding window that starts at the
+* lowest priority still queued. Segment delays are small integers, so only a handful of buckets are alive
+* at any time and both enqueue and dequeue are O(1) amortized.
+*/
+template<typename T>
+class BucketPriorityQueue : public PriorityQueue<T> {
+private:
+	std::deque<std::deque<T>> buckets;
+	/* priority of buckets.front() */
+	int base = 0;
+	size_t count = 0;
+
+public:
+	BucketPriorityQueue(std::function<int(T)> priorityFunc) : PriorityQueue<T>(priorityFunc) {}
+
+	void enqueue(const T item) override {
+		int priority = this->getPriority(item);
+
+		if (buckets.empty()) {
+			base = priority;
+		}
+		else if (priority < base) {
+			// never happens during generation since children are always later than their parent
+			buckets.insert(buckets.begin(), static_cast<size_t>(base - priority), std::deque<T>{});
+			base = priority;
+		}
+
+		size_t index = static_cast<size_t>(priority - base);
+		if (index >= buckets.size())
+			buckets.resize(index + 1);
+
+		buckets[index].push_back(item);
+		count++;
+	}
+
+	T dequeue() override {
+		if (count == 0)
+			throw std::runtime_error("dequeue from empty priority queue");
+
+		// drop drained buckets from the front of the window
+		while (buckets.front().empty()) {
+			buckets.pop_front();
+			base++;
+		}
+
+		T minValue = buckets.front().front();
+		buckets.front().pop_front();
+		count--;
+
+		if (count == 0)
+			buckets.clear();
+
+		return minValue;
+	}
+
+	bool empty() const override {
+		return count == 0;
+	}
+
+	size_t size() const override {
+		return count;
+	}
+};
+
+/* Creates the priority queue implementation selected by type */
+template<typename T>
+PriorityQueue<T>* makePriorityQueue(PriorityQueueType type, std::function<int(T)> priorityFunc) {
+	switch (type) {
+	case PriorityQueueType::Linear:
+		return new LinearPriorityQueue<T>(priorityFunc);
+	case PriorityQueueType::BinaryHeap:
+		return new HeapPriorityQueue<T>(priorityFunc);
+	case PriorityQueueType::Bucket:
+	default:
+		return new BucketPriorityQueue<T>(priorityFunc);
+	}
+}
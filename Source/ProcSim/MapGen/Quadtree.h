@@ -1,130 +1,413 @@
 #pragma once
 
 #include <vector>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
 
 #include "Math.h"
+#include "SpatialEntries.h"
 
-struct Bounds {
-    double x;
-    double y;
-    double width;
-    double height;
-};
-
+/**
+* All nodes of a tree are kept in one array, the four children of a node are next to each other and are found by index.
+* The objects of the leaves are stored inline in the shared pools of SpatialEntries, every leaf owns one run of them.
+* Nothing is freed before clear, emptied nodes are not merged.
+*/
 template<typename T>
 class Quadtree {
 private:
+    typedef SpatialEntries<T> Entries;
+    typedef typename Entries::Entry Entry;
+    typedef typename Entries::Run Run;
+    static const uint32_t NONE = Entries::NONE;
+    /* entries of the first run of a leaf */
+    static const uint32_t LEAF_RUN_LENGTH = 4;
+
+    /* the children of an inner node are firstChild + 0..3: top left, top right, bottom left, bottom right */
     struct Node {
-        enum class Type { Leaf, Inner };
-        Type type;
-        std::vector<Bounds> objects;
-        std::vector<T> objectsO;
-        Quadtree<T>* topLeft;
-        Quadtree<T>* topRight;
-        Quadtree<T>* bottomLeft;
-        Quadtree<T>* bottomRight;
+        Bounds bounds;
+        uint32_t firstChild;
+        /* the objects of a leaf */
+        Run run;
+        uint8_t level;
+
+        bool isLeaf() const { return firstChild == NONE; }
     };
 
-    Node node;
-    Bounds bounds;
+    /* nodes[0] is the root */
+    std::vector<Node> nodes;
+    Entries entries;
     int max_objects;
     int max_levels;
-    int level;
 
 public:
-    Quadtree(const Bounds bounds, int max_objects = 10, int max_levels = 4, int level = 0)
-        : bounds(bounds), max_objects(max_objects), max_levels(max_levels), level(level) {
-        node.type = Node::Type::Leaf;
-        node.objects = std::vector<Bounds>();
-        node.objectsO = std::vector<T>();
+    Quadtree(const Bounds bounds, int max_objects = 10, int max_levels = 4)
+        : entries(LEAF_RUN_LENGTH), max_objects(max_objects), max_levels(max_levels) {
+        nodes.push_back(makeNode(bounds, 0));
+    }
+
+    Quadtree(const Quadtree&) = delete;
+    Quadtree& operator=(const Quadtree&) = delete;
+
+    /**
+    * Calls visit(obj) once for every object whose bounds overlap rect (touching edges count), without allocating.
+    * An object lying in several leaves is only reported by the leaf holding the top left corner of its overlap with rect,
+    * so unlike retrieve there are no duplicates and no objects from the leaves that are far from rect.
+    */
+    template<typename Visitor>
+    void query(const Bounds& rect, Visitor&& visit) const {
+        const double inf = std::numeric_limits<double>::infinity();
+        queryNode(0, rect, [&visit](const Bounds&, const T& obj) { visit(obj); }, -inf, inf, -inf, inf);
+    }
+
+    /* Like query, for the objects whose bounds are at most radius away from center */
+    template<typename Visitor>
+    void queryRadius(Point center, double radius, Visitor&& visit) const {
+        const double inf = std::numeric_limits<double>::infinity();
+        const double radius2 = radius * radius;
+        Bounds rect{ center.x - radius, center.y - radius, 2 * radius, 2 * radius };
+
+        queryNode(0, rect, [&visit, center, radius2](const Bounds& b, const T& obj) {
+            double dx = std::max({ b.x - center.x, 0.0, center.x - (b.x + b.width) });
+            double dy = std::max({ b.y - center.y, 0.0, center.y - (b.y + b.height) });
+            if (dx * dx + dy * dy <= radius2)
+                visit(obj);
+        }, -inf, inf, -inf, inf);
+    }
+
+    /* removes every object, the bounds and limits stay. Handles start from 0 again. The memory is kept for reuse */
+    void clear() {
+        Bounds bounds = nodes[0].bounds;
+        nodes.clear();
+        nodes.push_back(makeNode(bounds, 0));
+        entries.clear();
+    }
+
+    /* removes every object and moves the tree to new bounds */
+    void reset(const Bounds newBounds) {
+        clear();
+        nodes[0].bounds = newBounds;
+    }
+
+    const Bounds& getBounds() const { return nodes[0].bounds; }
+
+    /* number of objects in the tree */
+    size_t size() const { return entries.size(); }
+
+    /**
+    * Writes the whole tree depth first: writer.tree(bounds, maxObjects, maxLevels) once, then writer.node(isInner, objectCount)
+    * for every node and writer.object(handle, bounds, obj) for every object of a leaf.
+    * load gives back exactly the same tree, with the objects and handles in the same order in every leaf. Inserting the
+    * objects again wouldn't, updates and removals change the order.
+    */
+    template<typename Writer>
+    void save(Writer& writer) const {
+        writer.tree(nodes[0].bounds, max_objects, max_levels);
+        saveNode(0, writer);
+    }
+
+    /**
+    * Replaces the content of this tree, including its bounds and limits, with a tree written by save.
+    * Returns false if the reader fails, the tree is left empty then.
+    */
+    template<typename Reader>
+    bool load(Reader& reader) {
+        clear();
+        Bounds bounds{};
+        if (!reader.tree(bounds, max_objects, max_levels)) {
+            clear();
+            return false;
+        }
+        nodes[0].bounds = bounds;
+        if (!loadNode(0, reader)) {
+            clear();
+            return false;
+        }
+
+        entries.restoreFreeHandles();
+        return true;
+    }
+
+    /* Adds obj with the given bounds. The returned handle stays valid until the object is removed */
+    SpatialHandle insert(const Bounds pRect, const T obj) {
+        SpatialHandle handle = entries.addHandle(pRect);
+        insertEntry(0, Entry{ pRect, obj, handle });
+        return handle;
+    }
+
+    /**
+    * Moves an object to new bounds. Leaves that hold the object before and after keep it at its place, so objects
+    * that only shrink (segments being split) are found in the same order as before.
+    */
+    void update(SpatialHandle handle, const Bounds newBounds) {
+        if (!entries.contains(handle))
+            return;
+
+        const Bounds oldBounds = entries.boundsOf(handle);
+        T obj{};
+        if (!findObject(0, handle, oldBounds, obj))
+            return;
+
+        entries.setBounds(handle, newBounds);
+        updateEntry(0, handle, obj, oldBounds, newBounds, true);
+    }
+
+    /* Removes an object, its handle may be handed out again. Emptied nodes are not merged */
+    void remove(SpatialHandle handle) {
+        if (!entries.contains(handle))
+            return;
+
+        if (removeEntry(0, handle, entries.boundsOf(handle)))
+            entries.freeHandle(handle);
+    }
+
+    /* every object of the leaves pRect touches, objects in several of them more than once */
+    std::vector<T> retrieve(const Bounds pRect) const {
+        std::vector<T> relevant;
+        retrieveNode(0, pRect, relevant);
+        return relevant;
+    }
+
+private:
+    static Node makeNode(const Bounds& bounds, int level) {
+        return Node{ bounds, NONE, Entries::emptyRun(), static_cast<uint8_t>(level) };
+    }
+
+    void split(uint32_t n) {
+        makeChildren(n);
+
+        // the children may move the pools, so the entries are copied out one by one
+        for (uint32_t i = 0; i < nodes[n].run.count; i++) {
+            const Entry entry = entries.at(nodes[n].run.first + i);
+            forRelevantChildren(n, entry.bounds, [&](uint32_t child) {
+                insertEntry(child, entry);
+            });
+        }
+
+        entries.release(nodes[n].run);
     }
 
-    void split() {
-        int lvl = this->level + 1;
+    void makeChildren(uint32_t n) {
+        const Bounds bounds = nodes[n].bounds;
+        const int lvl = nodes[n].level + 1;
         double width = bounds.width / 2;
         double height = bounds.height / 2;
         double x = bounds.x;
         double y = bounds.y;
 
-        if (node.type != Node::Type::Leaf)
-            throw std::runtime_error("Can't split non-leaf");
+        uint32_t first = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(makeNode(Bounds{ x, y, width, height }, lvl));
+        nodes.push_back(makeNode(Bounds{ x + width, y, width, height }, lvl));
+        nodes.push_back(makeNode(Bounds{ x, y + height, width, height }, lvl));
+        nodes.push_back(makeNode(Bounds{ x + width, y + height, width, height }, lvl));
+        nodes[n].firstChild = first;
+    }
 
-        node.type = Node::Type::Inner;
-        node.topRight = new Quadtree<T>(Bounds{ x + width, y, width, height }, max_objects, max_levels, lvl);
-        node.topLeft = new Quadtree<T>(Bounds{ x, y, width, height }, max_objects, max_levels, lvl);
-        node.bottomLeft = new Quadtree<T>(Bounds{ x, y + height, width, height }, max_objects, max_levels, lvl);
-        node.bottomRight = new Quadtree<T>(Bounds{ x + width, y + height, width, height }, max_objects, max_levels, lvl);
+    // the children an object with bounds r is stored in: top left, bottom left, top right, bottom right.
+    // f may add nodes, so nothing is read from the node after the first call
+    template<typename F>
+    void forRelevantChildren(uint32_t n, const Bounds& r, F&& f) const {
+        const Node& node = nodes[n];
+        const uint32_t first = node.firstChild;
+        double midX = node.bounds.x + node.bounds.width / 2;
+        double midY = node.bounds.y + node.bounds.height / 2;
 
-        for (size_t i = 0; i < node.objects.size(); i++) {
-            const Bounds rect = node.objects[i];
-            const T obj = node.objectsO[i];
-            //if (rect == nullptr)
-            //    throw std::runtime_error("Impossible");
+        bool isTop = r.y <= midY;
+        bool isBottom = r.y + r.height > midY;
+        bool isLeft = r.x <= midX;
+        bool isRight = r.x + r.width > midX;
 
-            for (auto subnode : getRelevantNodes(rect)) {
-                subnode->insert(rect, obj);
-            }
+        if (isLeft) {
+            if (isTop) f(first);
+            if (isBottom) f(first + 2);
+        }
+        if (isRight) {
+            if (isTop) f(first + 1);
+            if (isBottom) f(first + 3);
+        }
+    }
+
+    void insertEntry(uint32_t n, const Entry& entry) {
+        if (!nodes[n].isLeaf()) {
+            forRelevantChildren(n, entry.bounds, [&](uint32_t child) {
+                insertEntry(child, entry);
+            });
+            return;
         }
 
-        node.objects.clear();
-        node.objectsO.clear();
+        entries.push(nodes[n].run, entry);
+
+        if (nodes[n].run.count > static_cast<uint32_t>(max_objects) && nodes[n].level < max_levels) {
+            split(n);
+        }
     }
 
-    std::vector<Quadtree<T>*> getRelevantNodes(const Bounds r) {
-        if (node.type == Node::Type::Leaf)
-            throw std::runtime_error("Can't get relevant nodes in leaf");
+    // returns whether a leaf held the object
+    bool removeEntry(uint32_t n, SpatialHandle handle, const Bounds& rect) {
+        if (nodes[n].isLeaf()) {
+            int i = entries.find(nodes[n].run, handle);
+            if (i < 0)
+                return false;
+            entries.erase(nodes[n].run, i);
+            return true;
+        }
 
-        double midX = bounds.x + bounds.width / 2;
-        double midY = bounds.y + bounds.height / 2;
+        bool removed = false;
+        forRelevantChildren(n, rect, [&](uint32_t child) {
+            removed |= removeEntry(child, handle, rect);
+        });
+        return removed;
+    }
 
-        std::vector<Quadtree<T>*> qs;
+    // called for the nodes on the path of the old bounds, inNew tells if the node is on the path of the new bounds too
+    void updateEntry(uint32_t n, SpatialHandle handle, const T& obj, const Bounds& oldBounds, const Bounds& newBounds, bool inNew) {
+        if (nodes[n].isLeaf()) {
+            int i = entries.find(nodes[n].run, handle);
+            if (i < 0)
+                return;
+            if (inNew)
+                entries.rects[nodes[n].run.first + i] = newBounds;
+            else
+                entries.erase(nodes[n].run, i);
+            return;
+        }
 
-        bool isTop = r.y <= midY;
-        bool isBottom = r.y + r.height > midY;
+        // indexed by the position of the child, firstChild + c
+        const uint32_t first = nodes[n].firstChild;
+        bool toOld[4] = {};
+        bool toNew[4] = {};
+        forRelevantChildren(n, oldBounds, [&](uint32_t child) { toOld[child - first] = true; });
+        if (inNew)
+            forRelevantChildren(n, newBounds, [&](uint32_t child) { toNew[child - first] = true; });
 
-        if (r.x <= midX) {
-            // left
-            if (isTop) qs.push_back(node.topLeft);
-            if (isBottom) qs.push_back(node.bottomLeft);
+        // same order as forRelevantChildren
+        const uint32_t order[4] = { 0, 2, 1, 3 };
+        for (uint32_t c : order) {
+            if (toOld[c])
+                updateEntry(first + c, handle, obj, oldBounds, newBounds, toNew[c]);
+            else if (toNew[c])
+                insertEntry(first + c, Entry{ newBounds, obj, handle });
         }
-        if (r.x + r.width > midX) {
-            // right
-            if (isTop) qs.push_back(node.topRight);
-            if (isBottom) qs.push_back(node.bottomRight);
+    }
+
+    // the object of a handle, looked up in the leaves on the path of its bounds
+    bool findObject(uint32_t n, SpatialHandle handle, const Bounds& rect, T& obj) const {
+        if (nodes[n].isLeaf()) {
+            int i = entries.find(nodes[n].run, handle);
+            if (i < 0)
+                return false;
+            obj = entries.objects[nodes[n].run.first + i];
+            return true;
+        }
+
+        bool found = false;
+        forRelevantChildren(n, rect, [&](uint32_t child) {
+            found = found || findObject(child, handle, rect, obj);
+        });
+        return found;
+    }
+
+    void retrieveNode(uint32_t n, const Bounds& rect, std::vector<T>& relevant) const {
+        const Node& node = nodes[n];
+        if (node.isLeaf()) {
+            for (uint32_t i = 0; i < node.run.count; i++)
+                relevant.push_back(entries.objects[node.run.first + i]);
+            return;
         }
 
-        return qs;
+        forRelevantChildren(n, rect, [&](uint32_t child) {
+            retrieveNode(child, rect, relevant);
+        });
     }
 
-    void insert(const Bounds pRect, const T obj) {
-        if (node.type != Node::Type::Leaf) {
-            for (Quadtree<T>* subnode : getRelevantNodes(pRect)) {
-                subnode->insert(pRect, obj);
+    static bool overlaps(const Bounds& a, const Bounds& b) {
+        return a.x <= b.x + b.width && b.x <= a.x + a.width && a.y <= b.y + b.height && b.y <= a.y + a.height;
+    }
+
+    // The area of a node is (minX, maxX] x (minY, maxY], split the same way forRelevantChildren does.
+    // The outer nodes reach to infinity, they also hold the objects outside the bounds of the tree
+    template<typename Visitor>
+    void queryNode(uint32_t n, const Bounds& rect, const Visitor& visit, double minX, double maxX, double minY, double maxY) const {
+        const Node& node = nodes[n];
+        if (node.isLeaf()) {
+            const Bounds* run = entries.rects.data() + node.run.first;
+            for (uint32_t i = 0; i < node.run.count; i++) {
+                const Bounds& b = run[i];
+                if (!overlaps(b, rect))
+                    continue;
+
+                // the corner lies in every leaf-to-be of the object and of rect, exactly one leaf reports it
+                double cornerX = std::max(b.x, rect.x);
+                double cornerY = std::max(b.y, rect.y);
+                if (cornerX > minX && cornerX <= maxX && cornerY > minY && cornerY <= maxY)
+                    visit(b, entries.objects[node.run.first + i]);
             }
             return;
         }
 
-        node.objects.push_back(pRect);
-        node.objectsO.push_back(obj);
+        const uint32_t first = node.firstChild;
+        double midX = node.bounds.x + node.bounds.width / 2;
+        double midY = node.bounds.y + node.bounds.height / 2;
 
-        if (node.objects.size() > max_objects && level < max_levels) {
-            split();
+        bool isTop = rect.y <= midY;
+        bool isBottom = rect.y + rect.height > midY;
+
+        if (rect.x <= midX) {
+            if (isTop) queryNode(first, rect, visit, minX, midX, minY, midY);
+            if (isBottom) queryNode(first + 2, rect, visit, minX, midX, midY, maxY);
+        }
+        if (rect.x + rect.width > midX) {
+            if (isTop) queryNode(first + 1, rect, visit, midX, maxX, minY, midY);
+            if (isBottom) queryNode(first + 3, rect, visit, midX, maxX, midY, maxY);
         }
     }
 
-    std::vector<T> retrieve(const Bounds pRect) {
-        if (node.type == Node::Type::Leaf) {
-            return node.objectsO;
+    template<typename Writer>
+    void saveNode(uint32_t n, Writer& writer) const {
+        const Node& node = nodes[n];
+        writer.node(!node.isLeaf(), node.run.count);
+
+        if (!node.isLeaf()) {
+            for (uint32_t c = 0; c < 4; c++)
+                saveNode(node.firstChild + c, writer);
+            return;
         }
 
-        std::vector<T> relevant;
+        for (uint32_t i = node.run.first; i < node.run.first + node.run.count; i++)
+            writer.object(entries.handles[i], entries.rects[i], entries.objects[i]);
+    }
+
+    template<typename Reader>
+    bool loadNode(uint32_t n, Reader& reader) {
+        bool inner = false;
+        size_t count = 0;
+        if (!reader.node(inner, count))
+            return false;
 
-        for (auto subnode : getRelevantNodes(pRect)) {
-            auto subnodeObjects = subnode->retrieve(pRect);
-            relevant.insert(relevant.end(), subnodeObjects.begin(), subnodeObjects.end());
+        if (inner) {
+            if (nodes[n].level >= max_levels)
+                return false;
+            makeChildren(n);
+            const uint32_t first = nodes[n].firstChild;
+            for (uint32_t c = 0; c < 4; c++) {
+                if (!loadNode(first + c, reader))
+                    return false;
+            }
+            return true;
         }
 
-        return relevant;
+        for (size_t i = 0; i < count; i++) {
+            Entry entry{ Bounds{}, T{}, INVALID_SPATIAL_HANDLE };
+            if (!reader.object(entry.handle, entry.bounds, entry.obj) || entry.handle == INVALID_SPATIAL_HANDLE)
+                return false;
+            // a leaf holds an object once
+            if (entries.find(nodes[n].run, entry.handle) >= 0 || !entries.restoreHandle(entry.handle, entry.bounds))
+                return false;
+            entries.push(nodes[n].run, entry);
+        }
+        return true;
     }
+};
 
-};
\ No newline at end of file
+template<typename T>
+const uint32_t Quadtree<T>::NONE;
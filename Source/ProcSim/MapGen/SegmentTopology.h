@@ -0,0 +1,259 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "Config.h"
+#include "Math.h"
+
+/* cell of a hashed grid, used by SegmentTopology and mergeCloseIntersections */
+struct GridCell {
+	long long x;
+	long long y;
+
+	bool operator==(const GridCell& other) const {
+		return x == other.x && y == other.y;
+	}
+};
+
+struct GridCellHash {
+	size_t operator()(const GridCell& cell) const {
+		uint64_t h = static_cast<uint64_t>(cell.x) * 0x9E3779B97F4A7C15ull;
+		h ^= static_cast<uint64_t>(cell.y) + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2);
+		return static_cast<size_t>(h);
+	}
+};
+
+/**
+* Which segment ends meet, kept up to date by SegmentStore while segments are added, split, snapped, moved and removed.
+*
+* End 2 * h is the start of segment h, 2 * h + 1 its end. Ends at most weldDistance apart share a node: an end joins
+* the closest node within weldDistance, or makes a new node at its position. The ends of a node are chained in the
+* order of their indices, so whatever order they arrived in, reading a node gives them in handle order.
+*
+* Nodes are found through a hashed grid of cells several times weldDistance wide, so most lookups look at one cell.
+*/
+class SegmentTopology {
+public:
+	typedef uint32_t NodeHandle;
+	enum : uint32_t { NONE = UINT32_MAX };
+
+	explicit SegmentTopology(double weldDistance = Config::ENDPOINT_WELD_DISTANCE) {
+		reset(weldDistance);
+	}
+
+	double getWeldDistance() const { return weldDistance; }
+
+	/* detaches every end and forgets every node, the ends can then be attached again with another weld distance */
+	void reset(double newWeldDistance) {
+		weldDistance = std::max(newWeldDistance, 0.0);
+		cellSize = weldDistance > 0 ? 4 * weldDistance : 1.0;
+		std::fill(nodeOfEnd.begin(), nodeOfEnd.end(), static_cast<NodeHandle>(NONE));
+		std::fill(nextEnd.begin(), nextEnd.end(), static_cast<uint32_t>(NONE));
+		std::fill(prevEnd.begin(), prevEnd.end(), static_cast<uint32_t>(NONE));
+		nodes.clear();
+		freeNodes.clear();
+		firstInCell.clear();
+	}
+
+	void clear() {
+		nodeOfEnd.clear();
+		nextEnd.clear();
+		prevEnd.clear();
+		reset(weldDistance);
+	}
+
+	/* number of ends, new ones are detached. The ends cut off must be detached */
+	void resize(size_t endCount) {
+		nodeOfEnd.resize(endCount, NONE);
+		nextEnd.resize(endCount, NONE);
+		prevEnd.resize(endCount, NONE);
+	}
+
+	/* the node an end is in, NONE if it is detached */
+	NodeHandle nodeOf(uint32_t end) const { return nodeOfEnd[end]; }
+
+	/* the nodes are numbered below nodeCapacity, the handles of removed nodes are used again */
+	size_t nodeCapacity() const { return nodes.size(); }
+
+	size_t nodeCount() const { return nodes.size() - freeNodes.size(); }
+
+	Point position(NodeHandle node) const { return nodes[node].position; }
+
+	size_t degree(NodeHandle node) const { return nodes[node].degree; }
+
+	/* calls visit(end) for every end of a node, in index order */
+	template<typename Visitor>
+	void forEndsAt(NodeHandle node, Visitor&& visit) const {
+		for (uint32_t e = nodes[node].firstEnd; e != NONE; e = nextEnd[e])
+			visit(e);
+	}
+
+	/* moves an end to p: it leaves its node and joins the node at p */
+	void attach(uint32_t end, Point p) {
+		detach(end);
+
+		NodeHandle node = findNode(p);
+		if (node == NONE)
+			node = makeNode(p);
+
+		// the chain stays sorted, nodes have a handful of ends
+		Node& n = nodes[node];
+		uint32_t prev = NONE;
+		uint32_t next = n.firstEnd;
+		while (next != NONE && next < end) {
+			prev = next;
+			next = nextEnd[next];
+		}
+		nodeOfEnd[end] = node;
+		prevEnd[end] = prev;
+		nextEnd[end] = next;
+		if (prev != NONE)
+			nextEnd[prev] = end;
+		else
+			n.firstEnd = end;
+		if (next != NONE)
+			prevEnd[next] = end;
+		n.degree++;
+	}
+
+	/* takes an end out of its node, nodes without ends are removed */
+	void detach(uint32_t end) {
+		const NodeHandle node = nodeOfEnd[end];
+		if (node == NONE)
+			return;
+
+		unlink(end, node);
+		nodeOfEnd[end] = NONE;
+		prevEnd[end] = NONE;
+		nextEnd[end] = NONE;
+		if (--nodes[node].degree == 0)
+			removeNode(node);
+	}
+
+	/*
+	* Gives the end at index from the index to, which must be detached. SegmentStore renumbers the ends with this when it
+	* compacts, the order of the remaining ends doesn't change then so the chains stay sorted.
+	*/
+	void move(uint32_t from, uint32_t to) {
+		const NodeHandle node = nodeOfEnd[from];
+		nodeOfEnd[to] = node;
+		prevEnd[to] = prevEnd[from];
+		nextEnd[to] = nextEnd[from];
+		nodeOfEnd[from] = NONE;
+		prevEnd[from] = NONE;
+		nextEnd[from] = NONE;
+		if (node == NONE)
+			return;
+
+		if (prevEnd[to] != NONE)
+			nextEnd[prevEnd[to]] = to;
+		else
+			nodes[node].firstEnd = to;
+		if (nextEnd[to] != NONE)
+			prevEnd[nextEnd[to]] = to;
+	}
+
+private:
+	struct Node {
+		Point position;
+		GridCell cell;
+		/* first end of the chain */
+		uint32_t firstEnd;
+		uint32_t degree;
+		/* next node of the same cell */
+		NodeHandle nextInCell;
+	};
+
+	double weldDistance = 0;
+	double cellSize = 1;
+
+	/* per end: its node and its neighbours in the chain of the node */
+	std::vector<NodeHandle> nodeOfEnd;
+	std::vector<uint32_t> nextEnd;
+	std::vector<uint32_t> prevEnd;
+
+	std::vector<Node> nodes;
+	std::vector<NodeHandle> freeNodes;
+	std::unordered_map<GridCell, NodeHandle, GridCellHash> firstInCell;
+
+	GridCell cellOf(Point p) const {
+		return GridCell{ static_cast<long long>(std::floor(p.x / cellSize)), static_cast<long long>(std::floor(p.y / cellSize)) };
+	}
+
+	// the closest node at most weldDistance away from p, the lower handle if two are as close
+	NodeHandle findNode(Point p) const {
+		const GridCell low = cellOf(Point{ p.x - weldDistance, p.y - weldDistance });
+		const GridCell high = cellOf(Point{ p.x + weldDistance, p.y + weldDistance });
+		const double weldDistance2 = weldDistance * weldDistance;
+
+		NodeHandle best = NONE;
+		double bestDistance2 = 0;
+		for (long long y = low.y; y <= high.y; y++) {
+			for (long long x = low.x; x <= high.x; x++) {
+				auto it = firstInCell.find(GridCell{ x, y });
+				if (it == firstInCell.end())
+					continue;
+				for (NodeHandle node = it->second; node != NONE; node = nodes[node].nextInCell) {
+					double dx = nodes[node].position.x - p.x;
+					double dy = nodes[node].position.y - p.y;
+					double distance2 = dx * dx + dy * dy;
+					if (distance2 > weldDistance2)
+						continue;
+					if (best == NONE || distance2 < bestDistance2 || (distance2 == bestDistance2 && node < best)) {
+						best = node;
+						bestDistance2 = distance2;
+					}
+				}
+			}
+		}
+		return best;
+	}
+
+	NodeHandle makeNode(Point p) {
+		NodeHandle node;
+		if (!freeNodes.empty()) {
+			node = freeNodes.back();
+			freeNodes.pop_back();
+		}
+		else {
+			node = static_cast<NodeHandle>(nodes.size());
+			nodes.push_back(Node{});
+		}
+
+		const GridCell cell = cellOf(p);
+		auto inserted = firstInCell.insert({ cell, node });
+		nodes[node] = Node{ p, cell, NONE, 0, inserted.second ? static_cast<NodeHandle>(NONE) : inserted.first->second };
+		inserted.first->second = node;
+		return node;
+	}
+
+	void removeNode(NodeHandle node) {
+		auto it = firstInCell.find(nodes[node].cell);
+		if (it->second == node) {
+			if (nodes[node].nextInCell == NONE)
+				firstInCell.erase(it);
+			else
+				it->second = nodes[node].nextInCell;
+		}
+		else {
+			NodeHandle prev = it->second;
+			while (nodes[prev].nextInCell != node)
+				prev = nodes[prev].nextInCell;
+			nodes[prev].nextInCell = nodes[node].nextInCell;
+		}
+		freeNodes.push_back(node);
+	}
+
+	void unlink(uint32_t end, NodeHandle node) {
+		if (prevEnd[end] != NONE)
+			nextEnd[prevEnd[end]] = nextEnd[end];
+		else
+			nodes[node].firstEnd = nextEnd[end];
+		if (nextEnd[end] != NONE)
+			prevEnd[nextEnd[end]] = prevEnd[end];
+	}
+};
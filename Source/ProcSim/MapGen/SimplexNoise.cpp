@@ -24,8 +24,6 @@
  * or copy at http://opensource.org/licenses/MIT)
  */
 
-#pragma once
-
 #include "SimplexNoise.h"
 
 #include <cstdint>  // int32_t/uint8_t
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+
+struct Bounds {
+    double x;
+    double y;
+    double width;
+    double height;
+};
+
+/** identifies an object in a spatial index (Quadtree or HashGrid), handed out by insert */
+typedef uint32_t SpatialHandle;
+const SpatialHandle INVALID_SPATIAL_HANDLE = UINT32_MAX;
+
+/**
+* The objects of a spatial index, shared by Quadtree and HashGrid.
+*
+* The objects of every cell (leaf of a Quadtree, cell of a HashGrid) are stored inline in shared pools, the bounds apart
+* from the objects and handles so that overlap tests read only bounds. Every cell owns one Run of the pools, runLength
+* entries long at first (about the number of objects a cell holds), and gets a run twice as long when it is full, in
+* place if its run is the last one. Runs given back are used again for runs of the same length. An object lying in several cells is stored in each of them with the same handle.
+*
+* It also keeps the current bounds of every handle, so update and remove know which cells hold an object.
+*/
+template<typename T>
+class SpatialEntries {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    /* an object in a cell, as it is passed around. In the pools its members are kept apart */
+    struct Entry {
+        Bounds bounds;
+        T obj;
+        SpatialHandle handle;
+    };
+
+    /* the entries of one cell, rects[first .. first + count). first is NONE before the first object */
+    struct Run {
+        uint32_t first;
+        uint32_t count;
+        uint8_t sizeClass;
+    };
+
+    std::vector<Bounds> rects;
+    std::vector<T> objects;
+    std::vector<SpatialHandle> handles;
+
+    explicit SpatialEntries(uint32_t runLength) : runLength(std::max<uint32_t>(runLength, 1)) {}
+
+    static Run emptyRun() {
+        return Run{ NONE, 0, 0 };
+    }
+
+    /* removes every object, handles start from 0 again. The memory is kept for reuse */
+    void clear() {
+        rects.clear();
+        objects.clear();
+        handles.clear();
+        freeRuns.clear();
+        entryBounds.clear();
+        freed.clear();
+        freeHandles.clear();
+        restored.clear();
+    }
+
+    /* number of objects */
+    size_t size() const { return entryBounds.size() - freeHandles.size(); }
+
+    /* whether handle belongs to an object in the index, removed objects don't count */
+    bool contains(SpatialHandle handle) const {
+        return handle < entryBounds.size() && !freed[handle];
+    }
+
+    const Bounds& boundsOf(SpatialHandle handle) const { return entryBounds[handle]; }
+
+    void setBounds(SpatialHandle handle, const Bounds& bounds) { entryBounds[handle] = bounds; }
+
+    /* a handle for a new object, handles of removed objects are handed out again first */
+    SpatialHandle addHandle(const Bounds& bounds) {
+        SpatialHandle handle;
+        if (!freeHandles.empty()) {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+            entryBounds[handle] = bounds;
+            freed[handle] = false;
+        }
+        else {
+            handle = static_cast<SpatialHandle>(entryBounds.size());
+            entryBounds.push_back(bounds);
+            freed.push_back(false);
+        }
+        return handle;
+    }
+
+    /* the handle of a removed object, it must be in use */
+    void freeHandle(SpatialHandle handle) {
+        freed[handle] = true;
+        freeHandles.push_back(handle);
+    }
+
+    /**
+    * while loading: a handle that some cell holds, with its bounds. The caller has made sure the handle is in range.
+    * Returns false if another cell gave the handle other bounds
+    */
+    bool restoreHandle(SpatialHandle handle, const Bounds& bounds) {
+        if (handle >= entryBounds.size()) {
+            entryBounds.resize(handle + 1, Bounds{});
+            freed.resize(handle + 1, false);
+            restored.resize(handle + 1, false);
+        }
+        if (restored[handle]) {
+            const Bounds& known = entryBounds[handle];
+            return known.x == bounds.x && known.y == bounds.y && known.width == bounds.width && known.height == bounds.height;
+        }
+        entryBounds[handle] = bounds;
+        restored[handle] = true;
+        return true;
+    }
+
+    /* after loading: the handles that no cell holds were free when the index was saved */
+    void restoreFreeHandles() {
+        freeHandles.clear();
+        for (SpatialHandle h = 0; h < entryBounds.size(); h++) {
+            freed[h] = !restored[h];
+            if (freed[h])
+                freeHandles.push_back(h);
+        }
+        restored.clear();
+    }
+
+    Entry at(uint32_t i) const {
+        return Entry{ rects[i], objects[i], handles[i] };
+    }
+
+    // appends to a run, moving it to a longer run when it is full
+    void push(Run& run, const Entry& entry) {
+        if (run.count == capacity(run)) {
+            if (run.first == NONE) {
+                run.first = allocateRun(0);
+                run.sizeClass = 0;
+            }
+            else if (run.first + run.count == rects.size()) {
+                resizePools(rects.size() + run.count);
+                run.sizeClass++;
+            }
+            else {
+                uint32_t first = allocateRun(run.sizeClass + 1);
+                moveEntries(run.first, run.count, first);
+                releaseRun(run.first, run.sizeClass);
+                run.first = first;
+                run.sizeClass++;
+            }
+        }
+        rects[run.first + run.count] = entry.bounds;
+        objects[run.first + run.count] = entry.obj;
+        handles[run.first + run.count] = entry.handle;
+        run.count++;
+    }
+
+    // index of the handle in the run, -1 if it isn't there
+    int find(const Run& run, SpatialHandle handle) const {
+        if (run.count == 0)
+            return -1;
+        const SpatialHandle* first = handles.data() + run.first;
+        for (uint32_t i = 0; i < run.count; i++) {
+            if (first[i] == handle)
+                return static_cast<int>(i);
+        }
+        return -1;
+    }
+
+    // removes the i-th entry of a run, the entries after it move up so the order stays
+    void erase(Run& run, int i) {
+        moveEntries(run.first + i + 1, run.count - i - 1, run.first + i);
+        run.count--;
+    }
+
+    /* gives the memory of a run back, the run is empty afterwards */
+    void release(Run& run) {
+        if (run.first != NONE)
+            releaseRun(run.first, run.sizeClass);
+        run = emptyRun();
+    }
+
+private:
+    /* entries of the shortest run */
+    uint32_t runLength;
+
+    /* free runs by size class, a run of class k is runLength << k entries long */
+    std::vector<std::vector<uint32_t>> freeRuns;
+
+    /* the current bounds of every handle, whether it is free, and the handles of removed objects */
+    std::vector<Bounds> entryBounds;
+    std::vector<bool> freed;
+    std::vector<SpatialHandle> freeHandles;
+    /* the handles restoreHandle was called for while loading */
+    std::vector<bool> restored;
+
+    uint32_t capacity(const Run& run) const {
+        return run.first == NONE ? 0 : runLength << run.sizeClass;
+    }
+
+    uint32_t allocateRun(uint8_t sizeClass) {
+        if (sizeClass < freeRuns.size() && !freeRuns[sizeClass].empty()) {
+            uint32_t first = freeRuns[sizeClass].back();
+            freeRuns[sizeClass].pop_back();
+            return first;
+        }
+        uint32_t first = static_cast<uint32_t>(rects.size());
+        resizePools(rects.size() + (static_cast<size_t>(runLength) << sizeClass));
+        return first;
+    }
+
+    void releaseRun(uint32_t first, uint8_t sizeClass) {
+        if (freeRuns.size() <= sizeClass)
+            freeRuns.resize(sizeClass + 1);
+        freeRuns[sizeClass].push_back(first);
+    }
+
+    void resizePools(size_t size) {
+        rects.resize(size);
+        objects.resize(size);
+        handles.resize(size);
+    }
+
+    // moves count entries from one place of the pools to another, the ranges may overlap if to < from
+    void moveEntries(uint32_t from, uint32_t count, uint32_t to) {
+        std::copy(rects.begin() + from, rects.begin() + from + count, rects.begin() + to);
+        std::copy(objects.begin() + from, objects.begin() + from + count, objects.begin() + to);
+        std::copy(handles.begin() + from, handles.begin() + from + count, handles.begin() + to);
+    }
+};
+
+template<typename T>
+const uint32_t SpatialEntries<T>::NONE;
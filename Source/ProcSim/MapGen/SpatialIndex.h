@@ -0,0 +1,31 @@
+#pragma once
+
+#include "Config.h"
+#include "Quadtree.h"
+#include "HashGrid.h"
+
+/**
+* The spatial index the generation keeps its segments in. It is the Quadtree, or the HashGrid if PROCSIM_HASH_GRID is
+* defined to 1; both have the same interface. makeSpatialIndex makes one with the limits from Config.
+*/
+#if defined(PROCSIM_HASH_GRID) && PROCSIM_HASH_GRID
+
+template<typename T>
+using SpatialIndex = HashGrid<T>;
+
+template<typename T>
+SpatialIndex<T>* makeSpatialIndex(const Bounds& bounds) {
+    return new HashGrid<T>(bounds, Config::HASH_GRID_CELL_SIZE);
+}
+
+#else
+
+template<typename T>
+using SpatialIndex = Quadtree<T>;
+
+template<typename T>
+SpatialIndex<T>* makeSpatialIndex(const Bounds& bounds) {
+    return new Quadtree<T>(bounds, Config::QUADTREE_MAX_OBJECTS, Config::QUADTREE_MAX_LEVELS);
+}
+
+#endif
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <cstdint>
+
+#include "Math.h"
+#include "SpatialEntries.h"
+
+/**
+* An R-tree that is packed once from a finished set of objects (Sort-Tile-Recursive bulk loading, O(n log n)) and
+* only read afterwards, for the passes that run when generation is over. Every object is stored once, in the leaf
+* it was packed into, so queries need no deduplication.
+*
+* Objects are collected with add and become visible with build. After build the tree is not changed until the next
+* clear or build: query and queryRadius only read it and can be called from any number of threads at the same time.
+*
+* Nodes are kept in one array, level by level from the leaves up, the root is the last node. The children of a node
+* (the objects of a leaf) are next to each other and are found by index.
+*/
+template<typename T>
+class StaticRTree {
+private:
+    /* children of an inner node, objects of a leaf */
+    static const uint32_t NODE_SIZE = 16;
+
+    /*
+    * The children of an inner node are nodes[first .. first + count), the objects of a leaf rects[first .. first + count).
+    * The box is kept as its edges: the right edge is the largest x + width of the contents, width = right - x could
+    * round to a box that ends before them.
+    */
+    struct Node {
+        double minX;
+        double minY;
+        double maxX;
+        double maxY;
+        uint32_t first;
+        uint32_t count;
+    };
+
+    std::vector<Bounds> rects;
+    std::vector<T> objects;
+    std::vector<Node> nodes;
+    /* nodes[0 .. leafCount) are the leaves */
+    uint32_t leafCount = 0;
+    /* whether the objects added since the last build are in the tree */
+    bool built = true;
+
+public:
+    StaticRTree() {}
+
+    StaticRTree(const StaticRTree&) = delete;
+    StaticRTree& operator=(const StaticRTree&) = delete;
+
+    /* removes every object. The memory is kept for reuse */
+    void clear() {
+        rects.clear();
+        objects.clear();
+        nodes.clear();
+        leafCount = 0;
+        built = true;
+    }
+
+    void reserve(size_t count) {
+        rects.reserve(count);
+        objects.reserve(count);
+    }
+
+    /* Adds obj with the given bounds. It is found by queries after the next build */
+    void add(const Bounds& bounds, const T obj) {
+        rects.push_back(bounds);
+        objects.push_back(obj);
+        built = false;
+    }
+
+    /* packs every object added so far into the tree */
+    void build() {
+        nodes.clear();
+        leafCount = 0;
+        built = true;
+        if (rects.empty())
+            return;
+
+        // the objects are reordered so that every leaf owns a contiguous run of them
+        std::vector<uint32_t> order;
+        packOrder(rects, order);
+        std::vector<Bounds> packedRects(rects.size());
+        std::vector<T> packedObjects(objects.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            packedRects[i] = rects[order[i]];
+            packedObjects[i] = objects[order[i]];
+        }
+        rects.swap(packedRects);
+        objects.swap(packedObjects);
+
+        nodes.reserve(rects.size() / NODE_SIZE * 16 / 15 + 2);
+        for (size_t first = 0; first < rects.size(); first += NODE_SIZE)
+            nodes.push_back(makeLeaf(static_cast<uint32_t>(first),
+                static_cast<uint32_t>(std::min<size_t>(NODE_SIZE, rects.size() - first))));
+        leafCount = static_cast<uint32_t>(nodes.size());
+
+        // every level is packed like the objects were, from the bounds of the level below
+        size_t levelStart = 0;
+        std::vector<Bounds> boxes;
+        std::vector<Node> level;
+        while (nodes.size() - levelStart > 1) {
+            const size_t levelEnd = nodes.size();
+            boxes.clear();
+            for (size_t n = levelStart; n < levelEnd; n++)
+                boxes.push_back(boundsOf(nodes[n]));
+            packOrder(boxes, order);
+
+            level.assign(nodes.begin() + levelStart, nodes.end());
+            for (size_t i = 0; i < order.size(); i++)
+                nodes[levelStart + i] = level[order[i]];
+
+            for (size_t first = levelStart; first < levelEnd; first += NODE_SIZE)
+                nodes.push_back(makeParent(static_cast<uint32_t>(first),
+                    static_cast<uint32_t>(std::min<size_t>(NODE_SIZE, levelEnd - first))));
+            levelStart = levelEnd;
+        }
+    }
+
+    /* number of objects in the tree */
+    size_t size() const { return built ? rects.size() : 0; }
+
+    /* the bounds of all objects, empty if there are none */
+    Bounds getBounds() const {
+        return nodes.empty() ? Bounds{} : boundsOf(nodes.back());
+    }
+
+    /* Calls visit(obj) once for every object whose bounds overlap rect (touching edges count), without allocating */
+    template<typename Visitor>
+    void query(const Bounds& rect, Visitor&& visit) const {
+        if (nodes.empty() || !overlaps(nodes.back(), rect))
+            return;
+        queryNode(static_cast<uint32_t>(nodes.size() - 1), rect, [&visit](const Bounds&, const T& obj) { visit(obj); });
+    }
+
+    /* Like query, for the objects whose bounds are at most radius away from center */
+    template<typename Visitor>
+    void queryRadius(Point center, double radius, Visitor&& visit) const {
+        const double radius2 = radius * radius;
+        Bounds rect{ center.x - radius, center.y - radius, 2 * radius, 2 * radius };
+        if (nodes.empty() || !overlaps(nodes.back(), rect))
+            return;
+
+        queryNode(static_cast<uint32_t>(nodes.size() - 1), rect, [&visit, center, radius2](const Bounds& b, const T& obj) {
+            double dx = std::max({ b.x - center.x, 0.0, center.x - (b.x + b.width) });
+            double dy = std::max({ b.y - center.y, 0.0, center.y - (b.y + b.height) });
+            if (dx * dx + dy * dy <= radius2)
+                visit(obj);
+        });
+    }
+
+private:
+    static bool overlaps(const Bounds& a, const Bounds& b) {
+        return a.x <= b.x + b.width && b.x <= a.x + a.width && a.y <= b.y + b.height && b.y <= a.y + a.height;
+    }
+
+    /* a node's box is tested against the edges of rect the way overlaps tests an object, so it never misses one */
+    static bool overlaps(const Node& node, const Bounds& rect) {
+        return node.minX <= rect.x + rect.width && rect.x <= node.maxX && node.minY <= rect.y + rect.height && rect.y <= node.maxY;
+    }
+
+    static Bounds boundsOf(const Node& node) {
+        return Bounds{ node.minX, node.minY, node.maxX - node.minX, node.maxY - node.minY };
+    }
+
+    /* a leaf for rects[first .. first + count), with the box around all of them */
+    Node makeLeaf(uint32_t first, uint32_t count) const {
+        Node leaf{ rects[first].x, rects[first].y, rects[first].x + rects[first].width, rects[first].y + rects[first].height, first, count };
+        for (uint32_t i = first + 1; i < first + count; i++) {
+            leaf.minX = std::min(leaf.minX, rects[i].x);
+            leaf.minY = std::min(leaf.minY, rects[i].y);
+            leaf.maxX = std::max(leaf.maxX, rects[i].x + rects[i].width);
+            leaf.maxY = std::max(leaf.maxY, rects[i].y + rects[i].height);
+        }
+        return leaf;
+    }
+
+    /* an inner node for nodes[first .. first + count), with the box around all of them */
+    Node makeParent(uint32_t first, uint32_t count) const {
+        Node parent{ nodes[first].minX, nodes[first].minY, nodes[first].maxX, nodes[first].maxY, first, count };
+        for (uint32_t i = first + 1; i < first + count; i++) {
+            parent.minX = std::min(parent.minX, nodes[i].minX);
+            parent.minY = std::min(parent.minY, nodes[i].minY);
+            parent.maxX = std::max(parent.maxX, nodes[i].maxX);
+            parent.maxY = std::max(parent.maxY, nodes[i].maxY);
+        }
+        return parent;
+    }
+
+    /**
+    * Sort-Tile-Recursive: the boxes are sorted by the x of their centers and cut into about sqrt(nodes) vertical
+    * slices, every slice is sorted by y. Consecutive runs of NODE_SIZE boxes of order then make the nodes.
+    * Ties keep the order of the input so the packing doesn't depend on the sort implementation.
+    */
+    static void packOrder(const std::vector<Bounds>& boxes, std::vector<uint32_t>& order) {
+        const size_t count = boxes.size();
+        order.resize(count);
+        std::iota(order.begin(), order.end(), 0u);
+
+        std::vector<double> centerX(count), centerY(count);
+        for (size_t i = 0; i < count; i++) {
+            centerX[i] = boxes[i].x + boxes[i].width / 2;
+            centerY[i] = boxes[i].y + boxes[i].height / 2;
+        }
+
+        const size_t nodeCount = (count + NODE_SIZE - 1) / NODE_SIZE;
+        const size_t sliceCount = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(nodeCount))));
+        const size_t sliceLength = (nodeCount + sliceCount - 1) / sliceCount * NODE_SIZE;
+
+        std::sort(order.begin(), order.end(), [&centerX](uint32_t a, uint32_t b) {
+            return centerX[a] < centerX[b] || (centerX[a] == centerX[b] && a < b);
+        });
+        for (size_t first = 0; first < count; first += sliceLength) {
+            std::sort(order.begin() + first, order.begin() + std::min(first + sliceLength, count), [&centerY](uint32_t a, uint32_t b) {
+                return centerY[a] < centerY[b] || (centerY[a] == centerY[b] && a < b);
+            });
+        }
+    }
+
+    template<typename Visitor>
+    void queryNode(uint32_t n, const Bounds& rect, const Visitor& visit) const {
+        const Node& node = nodes[n];
+        if (n < leafCount) {
+            for (uint32_t i = node.first; i < node.first + node.count; i++) {
+                if (overlaps(rects[i], rect))
+                    visit(rects[i], objects[i]);
+            }
+            return;
+        }
+
+        for (uint32_t c = node.first; c < node.first + node.count; c++) {
+            if (overlaps(nodes[c], rect))
+                queryNode(c, rect, visit);
+        }
+    }
+};
+
+template<typename T>
+const uint32_t StaticRTree<T>::NODE_SIZE;
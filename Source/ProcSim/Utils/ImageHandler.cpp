@@ -36,7 +36,7 @@ FString ImageHandler::ChooseImageFromFileDialog()
 	return FString("");
 }
 
-bool ImageHandler::LoadImageFromFile(const FString& FilePath, TArray<uint8>& OutPixels, int32& OutWidth, int32& OutHeight)
+bool ImageHandler::LoadImageFromFile(const FString& FilePath, std::shared_ptr<const uint8>& OutPixels, int32& OutWidth, int32& OutHeight)
 {
     // Load the image from the file
     TArray<uint8> FileData;
@@ -60,43 +60,37 @@ bool ImageHandler::LoadImageFromFile(const FString& FilePath, TArray<uint8>& Out
     // Get the width, height, and pixel data
     OutWidth = ImageWrapper->GetWidth();
     OutHeight = ImageWrapper->GetHeight();
-    TArray<uint8> RawPixels;
+    std::shared_ptr<TArray<uint8>> RawPixels = std::make_shared<TArray<uint8>>();
     
-    if (!ImageWrapper->GetRaw(ERGBFormat::Gray, 8, RawPixels))
+    if (!ImageWrapper->GetRaw(ERGBFormat::Gray, 8, *RawPixels))
     {
         UE_LOG(LogTemp, Error, TEXT("Failed to get raw image data: %s"), *FilePath);
         return false;
     }
 
-    // Copy pixel data row-wise into the output array (OutPixels)
-    OutPixels.Reset();
-    OutPixels.Append(RawPixels);
+    // The output shares ownership of the decoded array and points at its data (no copy)
+    OutPixels = std::shared_ptr<const uint8>(RawPixels, RawPixels->GetData());
 
-    UE_LOG(LogTemp, Warning, TEXT("The number of rawpixels are: %d"), RawPixels.Num());
+    UE_LOG(LogTemp, Warning, TEXT("The number of rawpixels are: %d"), RawPixels->Num());
 
     return true;
 }
 
-UTexture2D* ImageHandler::PixelsToTexture(const TArray<uint8>& Pixels, const int32 Width, const int32 Height)
+UTexture2D* ImageHandler::PixelsToTexture(const uint8* Pixels, const int32 Width, const int32 Height)
 {
-    if (Pixels.Num() == 0) {
+    if (Pixels == nullptr || Width * Height == 0) {
         UE_LOG(LogTemp, Warning, TEXT("Nothing in the pixels!"));
         return nullptr;
     }
 
-    // We need to repeat the pixels four times to make it BGRA format
-    TArray<uint8> coloredPixels{};
-    for (auto pixel : Pixels) {
-        for (int i = 0; i < 4; i++)
-            coloredPixels.Add(pixel);
-    }
-
     UTexture2D* Texture = UTexture2D::CreateTransient(Width, Height, PF_B8G8R8A8);
 
     uint8* TextureData = (uint8*)Texture->PlatformData->Mips[0].BulkData.Lock(LOCK_READ_WRITE);
 
-    // Copy the pixel data to the texture
-    FMemory::Memcpy(TextureData, coloredPixels.GetData(), coloredPixels.Num());
+    // We need to repeat the pixels four times to make it BGRA format
+    for (int32 i = 0; i < Width * Height; i++) {
+        FMemory::Memset(TextureData + i * 4, Pixels[i], 4);
+    }
 
     // Unlock the texture
     Texture->PlatformData->Mips[0].BulkData.Unlock();
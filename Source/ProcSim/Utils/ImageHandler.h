@@ -10,6 +10,8 @@
 #include "IImageWrapperModule.h"
 #include "IImageWrapper.h"
 
+#include <memory>
+
 
 /**
 * Static Functions used to open heatmap and display it
@@ -24,9 +26,11 @@ public:
 
 	static FString ChooseImageFromFileDialog();
 
-	static bool LoadImageFromFile(const FString& FilePath, TArray<uint8>& OutPixels, int32& OutWidth, int32& OutHeight);
+	/* OutPixels takes ownership of the decoded grayscale image, no copy is made */
+	static bool LoadImageFromFile(const FString& FilePath, std::shared_ptr<const uint8>& OutPixels, int32& OutWidth, int32& OutHeight);
 
-	static UTexture2D* PixelsToTexture(const TArray<uint8>& Pixels, const int32 Width, const int32 Height);
+	/* Expands the grayscale pixels straight into the texture's BGRA mip */
+	static UTexture2D* PixelsToTexture(const uint8* Pixels, const int32 Width, const int32 Height);
 
 	static bool ApplyTextureToProceduralMeshComponent(UProceduralMeshComponent* ProceduralMeshComponent,
 		UTexture2D* Texture, FString MaterialPath);